@@ -0,0 +1,799 @@
+﻿#include "stdafx.h"
+#include "natAsyncStream.h"
+
+#undef max
+#undef min
+
+using namespace NatsuLib;
+
+natPrefetchStream::natPrefetchStream(natRefPointer<natStream> stream, nLen blockSize, nuInt depth)
+	: natRefObjImpl{ std::move(stream) }, m_OwnedThreadPool{ std::make_unique<natThreadPool>(0, 1) }, m_ThreadPool{ *m_OwnedThreadPool }, m_BlockSize{ blockSize }, m_Depth{ depth }
+{
+	init();
+}
+
+natPrefetchStream::natPrefetchStream(natRefPointer<natStream> stream, natThreadPool& threadPool, nLen blockSize, nuInt depth)
+	: natRefObjImpl{ std::move(stream) }, m_ThreadPool{ threadPool }, m_BlockSize{ blockSize }, m_Depth{ depth }
+{
+	init();
+}
+
+natPrefetchStream::~natPrefetchStream()
+{
+	// 预读任务引用了本对象，必须等待其全部完成
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_BlockReady.wait(lock, [this]
+	{
+		return !m_PendingFetches;
+	});
+}
+
+nLen natPrefetchStream::GetBlockSize() const noexcept
+{
+	return m_BlockSize;
+}
+
+nuInt natPrefetchStream::GetDepth() const noexcept
+{
+	return m_Depth;
+}
+
+nBool natPrefetchStream::CanWrite() const
+{
+	return false;
+}
+
+nBool natPrefetchStream::CanRead() const
+{
+	return true;
+}
+
+nBool natPrefetchStream::CanResize() const
+{
+	return false;
+}
+
+nBool natPrefetchStream::CanSeek() const
+{
+	return m_InternalStream->CanSeek();
+}
+
+nBool natPrefetchStream::IsEndOfStream() const
+{
+	if (m_IssuedIndex == m_ConsumeIndex)
+	{
+		return m_InternalStream->IsEndOfStream();
+	}
+
+	const auto& block = waitCurrentBlock();
+	return !block.Exception && m_BlockOffset == block.Size && block.Size < m_BlockSize;
+}
+
+nLen natPrefetchStream::GetSize() const
+{
+	std::lock_guard<std::mutex> lock{ m_FetchMutex };
+	return m_InternalStream->GetSize();
+}
+
+void natPrefetchStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natPrefetchStream::GetPosition() const
+{
+	return m_Position;
+}
+
+void natPrefetchStream::SetPosition(NatSeek Origin, nLong Offset)
+{
+	if (!m_InternalStream->CanSeek())
+	{
+		nat_Throw(natErrException, NatErr_NotSupport, "Underlying stream cannot seek."_nv);
+	}
+
+	// 在当前数据块内移动时无需重置预读
+	if (Origin == NatSeek::Cur && m_IssuedIndex != m_ConsumeIndex)
+	{
+		const auto& block = waitCurrentBlock();
+		if (!block.Exception && (Offset >= 0 ? static_cast<nLen>(Offset) <= block.Size - m_BlockOffset : static_cast<nLen>(-Offset) <= m_BlockOffset))
+		{
+			m_BlockOffset += Offset;
+			m_Position += Offset;
+			return;
+		}
+	}
+
+	const auto consumedBytes = m_ConsumeIndex * m_BlockSize + m_BlockOffset;
+	resetPipeline();
+
+	// 内部流的位置已被预读推进，需要先退回到本流的位置
+	if (Origin == NatSeek::Cur)
+	{
+		Offset -= static_cast<nLong>(m_FetchedBytes - consumedBytes);
+	}
+
+	m_FetchedBytes = 0;
+	m_InternalStream->SetPosition(Origin, Offset);
+	m_Position = m_InternalStream->GetPosition();
+}
+
+nLen natPrefetchStream::ReadBytes(nData pData, nLen Length)
+{
+	nLen readBytes = 0;
+
+	while (readBytes < Length)
+	{
+		issueFetches();
+		waitCurrentBlock();
+
+		auto& block = m_Blocks[m_ConsumeIndex % m_Depth];
+		if (block.Exception)
+		{
+			m_Position += readBytes;
+			std::rethrow_exception(block.Exception);
+		}
+
+		const auto availableBytes = std::min(block.Size - m_BlockOffset, Length - readBytes);
+		if (!availableBytes)
+		{
+			if (block.Size < m_BlockSize)
+			{
+				break;
+			}
+
+			releaseCurrentBlock();
+			continue;
+		}
+
+		std::memcpy(pData + readBytes, block.Data.get() + m_BlockOffset, static_cast<size_t>(availableBytes));
+		readBytes += availableBytes;
+		m_BlockOffset += availableBytes;
+
+		// 尽早归还已读完的数据块以开始下一次预读
+		if (m_BlockOffset == m_BlockSize)
+		{
+			releaseCurrentBlock();
+		}
+	}
+
+	m_Position += readBytes;
+	return readBytes;
+}
+
+nLen natPrefetchStream::WriteBytes(ncData, nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+void natPrefetchStream::Flush()
+{
+}
+
+void natPrefetchStream::init()
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should not be nullptr."_nv);
+	}
+	if (!m_InternalStream->CanRead())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be readable."_nv);
+	}
+	if (!m_BlockSize || !m_Depth)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "blockSize and depth should not be zero."_nv);
+	}
+
+	m_Blocks.resize(m_Depth);
+	for (auto&& block : m_Blocks)
+	{
+		block.Data = std::make_unique<nByte[]>(static_cast<size_t>(m_BlockSize));
+		block.Size = 0;
+		block.Ready = false;
+	}
+
+	m_PendingFetches = 0;
+	m_FetchIndex = 0;
+	m_FetchedBytes = 0;
+	m_FetchReachedEnd = false;
+	m_IssuedIndex = 0;
+	m_ConsumeIndex = 0;
+	m_BlockOffset = 0;
+	m_Position = m_InternalStream->GetPosition();
+}
+
+void natPrefetchStream::issueFetches()
+{
+	while (m_IssuedIndex < m_ConsumeIndex + m_Depth)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			++m_PendingFetches;
+		}
+
+		try
+		{
+			m_ThreadPool.QueueWork([this](void*)
+			{
+				return fetchBlock();
+			});
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			--m_PendingFetches;
+			throw;
+		}
+
+		++m_IssuedIndex;
+	}
+}
+
+void natPrefetchStream::releaseCurrentBlock()
+{
+	{
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		m_Blocks[m_ConsumeIndex % m_Depth].Ready = false;
+	}
+
+	++m_ConsumeIndex;
+	m_BlockOffset = 0;
+}
+
+nuInt natPrefetchStream::fetchBlock()
+{
+	nLen size = 0;
+	std::exception_ptr exception;
+	Block* block;
+
+	{
+		// 预读任务按取得锁的顺序确定要填充的数据块，因此即使线程池乱序执行任务也能保证数据顺序
+		std::lock_guard<std::mutex> fetchLock{ m_FetchMutex };
+		block = &m_Blocks[m_FetchIndex++ % m_Depth];
+
+		if (!m_FetchReachedEnd)
+		{
+			try
+			{
+				while (size < m_BlockSize)
+				{
+					const auto readBytes = m_InternalStream->ReadBytes(block->Data.get() + size, m_BlockSize - size);
+					if (!readBytes)
+					{
+						break;
+					}
+					size += readBytes;
+				}
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+
+			m_FetchedBytes += size;
+			m_FetchReachedEnd = exception || size < m_BlockSize;
+		}
+	}
+
+	// 必须在持有锁时通知，否则等待者可能在通知前析构本对象
+	std::lock_guard<std::mutex> lock{ m_Mutex };
+	block->Size = size;
+	block->Exception = exception;
+	block->Ready = true;
+	--m_PendingFetches;
+	m_BlockReady.notify_all();
+
+	return NatErr_OK;
+}
+
+natPrefetchStream::Block const& natPrefetchStream::waitCurrentBlock() const
+{
+	auto& block = m_Blocks[m_ConsumeIndex % m_Depth];
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_BlockReady.wait(lock, [&block]
+	{
+		return block.Ready;
+	});
+	return block;
+}
+
+void natPrefetchStream::resetPipeline()
+{
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_BlockReady.wait(lock, [this]
+	{
+		return !m_PendingFetches;
+	});
+
+	for (auto&& block : m_Blocks)
+	{
+		block.Size = 0;
+		block.Ready = false;
+		block.Exception = nullptr;
+	}
+
+	m_FetchIndex = 0;
+	m_FetchReachedEnd = false;
+	m_IssuedIndex = 0;
+	m_ConsumeIndex = 0;
+	m_BlockOffset = 0;
+}
+
+natWriteBehindStream::natWriteBehindStream(natRefPointer<natStream> stream, nLen bufferSize, nLen memoryLimit)
+	: natRefObjImpl{ std::move(stream) }, m_OwnedThreadPool{ std::make_unique<natThreadPool>(0, 1) }, m_ThreadPool{ *m_OwnedThreadPool }, m_BufferSize{ bufferSize }, m_MemoryLimit{ memoryLimit }
+{
+	init();
+}
+
+natWriteBehindStream::natWriteBehindStream(natRefPointer<natStream> stream, natThreadPool& threadPool, nLen bufferSize, nLen memoryLimit)
+	: natRefObjImpl{ std::move(stream) }, m_ThreadPool{ threadPool }, m_BufferSize{ bufferSize }, m_MemoryLimit{ memoryLimit }
+{
+	init();
+}
+
+natWriteBehindStream::~natWriteBehindStream()
+{
+	try
+	{
+		submitCurrentBuffer();
+	}
+	catch (...)
+	{
+	}
+
+	// 后台写入任务引用了本对象，必须等待其完成
+	drain();
+}
+
+nLen natWriteBehindStream::GetBufferSize() const noexcept
+{
+	return m_BufferSize;
+}
+
+nLen natWriteBehindStream::GetMemoryLimit() const noexcept
+{
+	return m_MemoryLimit;
+}
+
+nBool natWriteBehindStream::CanWrite() const
+{
+	return true;
+}
+
+nBool natWriteBehindStream::CanRead() const
+{
+	return false;
+}
+
+nBool natWriteBehindStream::CanResize() const
+{
+	return m_InternalStream->CanResize();
+}
+
+nBool natWriteBehindStream::CanSeek() const
+{
+	return m_InternalStream->CanSeek();
+}
+
+nBool natWriteBehindStream::IsEndOfStream() const
+{
+	return m_Position >= GetSize();
+}
+
+nLen natWriteBehindStream::GetSize() const
+{
+	drain();
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		rethrowException(lock);
+	}
+
+	// 尚未提交的数据位于内部流的当前位置与m_Position之间
+	return std::max(m_InternalStream->GetSize(), m_Position);
+}
+
+void natWriteBehindStream::SetSize(nLen Size)
+{
+	submitCurrentBuffer();
+	drain();
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		rethrowException(lock);
+	}
+
+	m_InternalStream->SetSize(Size);
+	m_Position = m_InternalStream->GetPosition();
+}
+
+nLen natWriteBehindStream::GetPosition() const
+{
+	return m_Position;
+}
+
+void natWriteBehindStream::SetPosition(NatSeek Origin, nLong Offset)
+{
+	submitCurrentBuffer();
+	drain();
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		rethrowException(lock);
+	}
+
+	m_InternalStream->SetPosition(Origin, Offset);
+	m_Position = m_InternalStream->GetPosition();
+}
+
+nLen natWriteBehindStream::ReadBytes(nData, nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natWriteBehindStream::WriteBytes(ncData pData, nLen Length)
+{
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		rethrowException(lock);
+	}
+
+	nLen writtenBytes = 0;
+	while (writtenBytes < Length)
+	{
+		const auto copyBytes = std::min(Length - writtenBytes, m_BufferSize - m_CurrentBuffer.size());
+		m_CurrentBuffer.insert(m_CurrentBuffer.end(), pData + writtenBytes, pData + writtenBytes + copyBytes);
+		writtenBytes += copyBytes;
+		m_Position += copyBytes;
+
+		if (m_CurrentBuffer.size() == m_BufferSize)
+		{
+			submitCurrentBuffer();
+		}
+	}
+
+	return writtenBytes;
+}
+
+void natWriteBehindStream::Flush()
+{
+	submitCurrentBuffer();
+	drain();
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		rethrowException(lock);
+	}
+
+	m_InternalStream->Flush();
+}
+
+void natWriteBehindStream::init()
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should not be nullptr."_nv);
+	}
+	if (!m_InternalStream->CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable."_nv);
+	}
+	if (!m_BufferSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "bufferSize should not be zero."_nv);
+	}
+
+	m_CurrentBuffer.reserve(static_cast<size_t>(m_BufferSize));
+	// 压缩流等不可寻址的流可能不支持获取位置
+	m_Position = m_InternalStream->CanSeek() ? m_InternalStream->GetPosition() : 0;
+	m_PendingBytes = 0;
+	m_WriterRunning = false;
+}
+
+void natWriteBehindStream::submitCurrentBuffer()
+{
+	if (m_CurrentBuffer.empty())
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+
+	// 超过内存上限时等待后台写入，但总是允许至少一个缓冲区在等待写入
+	m_StateChanged.wait(lock, [this]
+	{
+		return m_Exception || !m_PendingBytes || m_PendingBytes + m_CurrentBuffer.size() <= m_MemoryLimit;
+	});
+	rethrowException(lock);
+
+	m_PendingBytes += m_CurrentBuffer.size();
+	m_PendingBuffers.emplace_back(std::move(m_CurrentBuffer));
+
+	if (m_FreeBuffers.empty())
+	{
+		m_CurrentBuffer = {};
+		m_CurrentBuffer.reserve(static_cast<size_t>(m_BufferSize));
+	}
+	else
+	{
+		m_CurrentBuffer = std::move(m_FreeBuffers.back());
+		m_FreeBuffers.pop_back();
+	}
+
+	if (!m_WriterRunning)
+	{
+		m_ThreadPool.QueueWork([this](void*)
+		{
+			return writeBuffers();
+		});
+		m_WriterRunning = true;
+	}
+}
+
+void natWriteBehindStream::drain() const
+{
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_StateChanged.wait(lock, [this]
+	{
+		return !m_WriterRunning;
+	});
+}
+
+nuInt natWriteBehindStream::writeBuffers()
+{
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+
+	while (!m_PendingBuffers.empty())
+	{
+		auto buffer = std::move(m_PendingBuffers.front());
+		m_PendingBuffers.pop_front();
+
+		lock.unlock();
+		std::exception_ptr exception;
+		try
+		{
+			nLen writtenBytes = 0;
+			while (writtenBytes < buffer.size())
+			{
+				const auto currentWrittenBytes = m_InternalStream->WriteBytes(buffer.data() + writtenBytes, buffer.size() - writtenBytes);
+				if (!currentWrittenBytes)
+				{
+					nat_Throw(natErrException, NatErr_InternalErr, "Underlying stream cannot write any more data."_nv);
+				}
+				writtenBytes += currentWrittenBytes;
+			}
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+		lock.lock();
+
+		m_PendingBytes -= buffer.size();
+		buffer.clear();
+		m_FreeBuffers.emplace_back(std::move(buffer));
+
+		if (exception)
+		{
+			m_Exception = exception;
+			for (auto&& pendingBuffer : m_PendingBuffers)
+			{
+				pendingBuffer.clear();
+				m_FreeBuffers.emplace_back(std::move(pendingBuffer));
+			}
+			m_PendingBuffers.clear();
+			m_PendingBytes = 0;
+		}
+
+		m_StateChanged.notify_all();
+	}
+
+	// 必须在持有锁时通知，否则等待者可能在通知前析构本对象
+	m_WriterRunning = false;
+	m_StateChanged.notify_all();
+
+	return NatErr_OK;
+}
+
+void natWriteBehindStream::rethrowException(std::unique_lock<std::mutex>& lock) const
+{
+	assert(lock.owns_lock());
+	static_cast<void>(lock);
+
+	if (m_Exception)
+	{
+		std::rethrow_exception(std::exchange(m_Exception, nullptr));
+	}
+}
+
+natTeeStream::natTeeStream(ErrorPolicy errorPolicy)
+	: m_ThreadPool{}, m_ErrorPolicy{ errorPolicy }, m_Position{}
+{
+}
+
+natTeeStream::natTeeStream(natThreadPool& threadPool, ErrorPolicy errorPolicy)
+	: m_ThreadPool{ &threadPool }, m_ErrorPolicy{ errorPolicy }, m_Position{}
+{
+}
+
+natTeeStream::~natTeeStream()
+{
+	// natWriteBehindStream析构时会等待后台写入完成，必须在线程池析构前释放
+	m_Sinks.clear();
+}
+
+void natTeeStream::AddSink(natRefPointer<natStream> sink, nBool parallel, nLen bufferSize, nLen memoryLimit)
+{
+	if (!sink)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "sink should not be nullptr."_nv);
+	}
+	if (!sink->CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "sink should be writable."_nv);
+	}
+
+	natRefPointer<natWriteBehindStream> async;
+	if (parallel)
+	{
+		if (!m_ThreadPool)
+		{
+			m_OwnedThreadPool = std::make_unique<natThreadPool>(0, std::max(std::thread::hardware_concurrency(), 1u));
+			m_ThreadPool = m_OwnedThreadPool.get();
+		}
+
+		async = make_ref<natWriteBehindStream>(sink, *m_ThreadPool, bufferSize, memoryLimit);
+	}
+
+	m_Sinks.push_back({ std::move(sink), std::move(async) });
+}
+
+size_t natTeeStream::GetSinkCount() const noexcept
+{
+	return m_Sinks.size();
+}
+
+std::vector<natTeeStream::DetachedSink> const& natTeeStream::GetDetachedSinks() const noexcept
+{
+	return m_DetachedSinks;
+}
+
+natTeeStream::ErrorPolicy natTeeStream::GetErrorPolicy() const noexcept
+{
+	return m_ErrorPolicy;
+}
+
+nBool natTeeStream::CanWrite() const
+{
+	return true;
+}
+
+nBool natTeeStream::CanRead() const
+{
+	return false;
+}
+
+nBool natTeeStream::CanResize() const
+{
+	return false;
+}
+
+nBool natTeeStream::CanSeek() const
+{
+	return false;
+}
+
+nBool natTeeStream::IsEndOfStream() const
+{
+	return true;
+}
+
+nLen natTeeStream::GetSize() const
+{
+	return m_Position;
+}
+
+void natTeeStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natTeeStream::GetPosition() const
+{
+	return m_Position;
+}
+
+void natTeeStream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natTeeStream::ReadBytes(nData, nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natTeeStream::WriteBytes(ncData pData, nLen Length)
+{
+	forEachSink([pData, Length](natStream& sink)
+	{
+		nLen writtenBytes = 0;
+		while (writtenBytes < Length)
+		{
+			const auto currentWrittenBytes = sink.WriteBytes(pData + writtenBytes, Length - writtenBytes);
+			if (!currentWrittenBytes)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "Sink cannot write any more data."_nv);
+			}
+			writtenBytes += currentWrittenBytes;
+		}
+	});
+
+	m_Position += Length;
+	return Length;
+}
+
+void natTeeStream::Flush()
+{
+	forEachSink([](natStream& sink)
+	{
+		sink.Flush();
+	});
+}
+
+template <typename Func>
+void natTeeStream::forEachSink(Func&& func)
+{
+	if (m_AbortException)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "A sink has failed, this stream cannot be used any more."_nv);
+	}
+	if (m_Sinks.empty() && !m_DetachedSinks.empty())
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "All sinks have failed."_nv);
+	}
+
+	std::exception_ptr firstException;
+	// 先处理并行的输出流，使其在后台的写入与其他输出流的写入重叠进行
+	for (const auto parallel : { true, false })
+	{
+		for (auto iter = m_Sinks.begin(); iter != m_Sinks.end();)
+		{
+			if (static_cast<nBool>(iter->Async) != parallel)
+			{
+				++iter;
+				continue;
+			}
+
+			try
+			{
+				func(parallel ? *iter->Async : *iter->Stream);
+				++iter;
+			}
+			catch (...)
+			{
+				const auto exception = std::current_exception();
+				if (!firstException)
+				{
+					firstException = exception;
+				}
+
+				if (m_ErrorPolicy == ErrorPolicy::DetachFailed)
+				{
+					m_DetachedSinks.push_back({ std::move(iter->Stream), exception });
+					iter = m_Sinks.erase(iter);
+				}
+				else
+				{
+					++iter;
+				}
+			}
+		}
+	}
+
+	if (firstException && (m_ErrorPolicy == ErrorPolicy::Abort || m_Sinks.empty()))
+	{
+		if (m_ErrorPolicy == ErrorPolicy::Abort)
+		{
+			m_AbortException = firstException;
+		}
+		std::rethrow_exception(firstException);
+	}
+}
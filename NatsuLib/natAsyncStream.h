@@ -0,0 +1,252 @@
+﻿#pragma once
+#include "natConfig.h"
+#include "natStream.h"
+#include "natMultiThread.h"
+#include <condition_variable>
+#include <exception>
+#include <deque>
+
+namespace NatsuLib
+{
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	预读流
+	///	@remark	在线程池中提前读取内部流的后续数据块，使内部流的读取与使用者的处理（如解压、解密）重叠进行
+	///	@note	内部流仅会被预读任务顺序访问，在本流存活期间请勿直接操作内部流\n
+	///			改变位置时会等待正在进行的预读完成并丢弃所有已预读的数据
+	////////////////////////////////////////////////////////////////////////////////
+	class natPrefetchStream
+		: public natRefObjImpl<natPrefetchStream, natWrappedStream>, public nonmovable
+	{
+	public:
+		enum : nLen
+		{
+			DefaultBlockSize = 65536,
+		};
+
+		enum : nuInt
+		{
+			DefaultDepth = 4,
+		};
+
+		///	@brief	使用内部创建的线程池进行预读
+		///	@param	stream		内部流，必须可读
+		///	@param	blockSize	每次预读的数据块大小
+		///	@param	depth		最多同时预读的数据块数量
+		explicit natPrefetchStream(natRefPointer<natStream> stream, nLen blockSize = DefaultBlockSize, nuInt depth = DefaultDepth);
+		///	@brief	使用外部的线程池进行预读
+		///	@note	必须保证线程池在本流析构之后才析构
+		natPrefetchStream(natRefPointer<natStream> stream, natThreadPool& threadPool, nLen blockSize = DefaultBlockSize, nuInt depth = DefaultDepth);
+		~natPrefetchStream();
+
+		nLen GetBlockSize() const noexcept;
+		nuInt GetDepth() const noexcept;
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+		void SetSize(nLen /*Size*/) override;
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek Origin, nLong Offset) override;
+		nLen ReadBytes(nData pData, nLen Length) override;
+		nLen WriteBytes(ncData /*pData*/, nLen /*Length*/) override;
+		void Flush() override;
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<nByte[]> Data;
+			nLen Size;
+			nBool Ready;
+			std::exception_ptr Exception;
+		};
+
+		std::unique_ptr<natThreadPool> m_OwnedThreadPool;
+		natThreadPool& m_ThreadPool;
+		const nLen m_BlockSize;
+		const nuInt m_Depth;
+
+		std::vector<Block> m_Blocks;
+
+		// 以下成员由m_Mutex保护
+		mutable std::mutex m_Mutex;
+		mutable std::condition_variable m_BlockReady;
+		nuInt m_PendingFetches;
+
+		// 以下成员由m_FetchMutex保护，仅由预读任务访问
+		mutable std::mutex m_FetchMutex;
+		nLen m_FetchIndex;
+		nLen m_FetchedBytes;
+		nBool m_FetchReachedEnd;
+
+		// 以下成员仅由使用者访问
+		nLen m_IssuedIndex;
+		nLen m_ConsumeIndex;
+		nLen m_BlockOffset;
+		nLen m_Position;
+
+		void init();
+		void issueFetches();
+		void releaseCurrentBlock();
+		nuInt fetchBlock();
+		Block const& waitCurrentBlock() const;
+		void resetPipeline();
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	后写流
+	///	@remark	将写入的数据收集到缓冲区中，由线程池在后台写入内部流，使用者无需等待每次写入完成
+	///	@note	已提交但尚未写入的数据超过内存上限时写入会阻塞等待\n
+	///			后台写入发生的异常会在下一次调用或Flush时抛出，之后尚未写入的数据将被丢弃\n
+	///			除Flush外，改变位置、获取或设置大小前也会等待所有数据写入内部流
+	////////////////////////////////////////////////////////////////////////////////
+	class natWriteBehindStream
+		: public natRefObjImpl<natWriteBehindStream, natWrappedStream>, public nonmovable
+	{
+	public:
+		enum : nLen
+		{
+			DefaultBufferSize = 65536,
+			DefaultMemoryLimit = DefaultBufferSize * 64,
+		};
+
+		///	@brief	使用内部创建的线程池进行写入
+		///	@param	stream		内部流，必须可写
+		///	@param	bufferSize	每个缓冲区的大小，缓冲区满时提交给后台写入
+		///	@param	memoryLimit	已提交但尚未写入的数据量上限
+		explicit natWriteBehindStream(natRefPointer<natStream> stream, nLen bufferSize = DefaultBufferSize, nLen memoryLimit = DefaultMemoryLimit);
+		///	@brief	使用外部的线程池进行写入
+		///	@note	必须保证线程池在本流析构之后才析构
+		natWriteBehindStream(natRefPointer<natStream> stream, natThreadPool& threadPool, nLen bufferSize = DefaultBufferSize, nLen memoryLimit = DefaultMemoryLimit);
+		///	@brief	等待所有数据写入内部流
+		///	@note	此时发生的异常将被忽略，需要得知写入是否成功时请在析构前调用Flush
+		~natWriteBehindStream();
+
+		nLen GetBufferSize() const noexcept;
+		nLen GetMemoryLimit() const noexcept;
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+		void SetSize(nLen Size) override;
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek Origin, nLong Offset) override;
+		nLen ReadBytes(nData /*pData*/, nLen /*Length*/) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		///	@brief	等待所有数据写入内部流并刷新内部流
+		void Flush() override;
+
+	private:
+		std::unique_ptr<natThreadPool> m_OwnedThreadPool;
+		natThreadPool& m_ThreadPool;
+		const nLen m_BufferSize;
+		const nLen m_MemoryLimit;
+
+		// 以下成员仅由使用者访问
+		std::vector<nByte> m_CurrentBuffer;
+		nLen m_Position;
+
+		// 以下成员由m_Mutex保护
+		mutable std::mutex m_Mutex;
+		mutable std::condition_variable m_StateChanged;
+		std::deque<std::vector<nByte>> m_PendingBuffers;
+		std::vector<std::vector<nByte>> m_FreeBuffers;
+		nLen m_PendingBytes;
+		nBool m_WriterRunning;
+		mutable std::exception_ptr m_Exception;
+
+		void init();
+		void submitCurrentBuffer();
+		void drain() const;
+		nuInt writeBuffers();
+		void rethrowException(std::unique_lock<std::mutex>& lock) const;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	分流流
+	///	@remark	将写入的数据依次写入所有输出流，可用于同时写入文件及计算校验值等场合
+	///	@note	并行的输出流由natWriteBehindStream包装后在线程池中写入，适用于压缩等开销较大的输出流，\n
+	///			其他输出流在调用者的线程中按添加的顺序写入\n
+	///			每次写入及Flush都会传递给所有未被移除的输出流，之后才按照错误策略处理发生的异常
+	////////////////////////////////////////////////////////////////////////////////
+	class natTeeStream
+		: public natRefObjImpl<natTeeStream, natStream>, public nonmovable
+	{
+	public:
+		///	@brief	输出流出错时的处理策略
+		enum class ErrorPolicy
+		{
+			Abort,			///< @brief	抛出第一个异常，之后本流不能再写入
+			DetachFailed,	///< @brief	移除出错的输出流，仅在所有输出流都被移除时抛出异常
+		};
+
+		///	@brief	被移除的输出流及导致其被移除的异常
+		struct DetachedSink
+		{
+			natRefPointer<natStream> Sink;
+			std::exception_ptr Exception;
+		};
+
+		///	@brief	需要时使用内部创建的线程池写入并行的输出流
+		explicit natTeeStream(ErrorPolicy errorPolicy = ErrorPolicy::Abort);
+		///	@brief	使用外部的线程池写入并行的输出流
+		///	@note	必须保证线程池在本流析构之后才析构
+		explicit natTeeStream(natThreadPool& threadPool, ErrorPolicy errorPolicy = ErrorPolicy::Abort);
+		///	@brief	等待所有并行的输出流写入完成
+		///	@note	此时发生的异常将被忽略，需要得知写入是否成功时请在析构前调用Flush
+		~natTeeStream();
+
+		///	@brief	添加输出流
+		///	@param	sink		输出流，必须可写
+		///	@param	parallel	是否在线程池中写入此输出流
+		///	@param	bufferSize	并行写入时每次提交的数据块大小
+		///	@param	memoryLimit	并行写入时已提交但尚未写入的数据量上限
+		void AddSink(natRefPointer<natStream> sink, nBool parallel = false, nLen bufferSize = natWriteBehindStream::DefaultBufferSize, nLen memoryLimit = natWriteBehindStream::DefaultMemoryLimit);
+		///	@brief	获得未被移除的输出流的数量
+		size_t GetSinkCount() const noexcept;
+		///	@brief	获得因出错而被移除的输出流
+		std::vector<DetachedSink> const& GetDetachedSinks() const noexcept;
+		ErrorPolicy GetErrorPolicy() const noexcept;
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		///	@brief	获得已写入的总字节数
+		nLen GetSize() const override;
+		void SetSize(nLen /*Size*/) override;
+		///	@brief	获得已写入的总字节数
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek /*Origin*/, nLong /*Offset*/) override;
+		nLen ReadBytes(nData /*pData*/, nLen /*Length*/) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		///	@brief	等待并行的输出流写入完成并刷新所有输出流
+		void Flush() override;
+
+	private:
+		struct Sink
+		{
+			natRefPointer<natStream> Stream;
+			// 并行写入时为包装Stream的natWriteBehindStream，否则为nullptr
+			natRefPointer<natWriteBehindStream> Async;
+		};
+
+		std::unique_ptr<natThreadPool> m_OwnedThreadPool;
+		natThreadPool* m_ThreadPool;
+		const ErrorPolicy m_ErrorPolicy;
+
+		std::vector<Sink> m_Sinks;
+		std::vector<DetachedSink> m_DetachedSinks;
+		std::exception_ptr m_AbortException;
+		nLen m_Position;
+
+		template <typename Func>
+		void forEachSink(Func&& func);
+	};
+}
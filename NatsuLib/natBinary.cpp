@@ -1,4 +1,4 @@
-#include "stdafx.h"
+﻿#include "stdafx.h"
 #include "natBinary.h"
 
 #undef max
@@ -66,3 +66,151 @@ Environment::Endianness natBinaryWriter::GetEndianness() const noexcept
 {
 	return m_Endianness;
 }
+
+void natBinaryWriter::writeBuffer(ncData buffer, nLen size)
+{
+	nLen writtenBytes;
+	if ((writtenBytes = m_Stream->WriteBytes(buffer, size)) < size)
+	{
+		nat_Throw(natException, "Only partial data ({0} bytes/{1} bytes requested) has been successfully written."_nv, writtenBytes, size);
+	}
+}
+
+natBinaryViewReader::natBinaryViewReader(ncData data, nLen size, Environment::Endianness endianness) noexcept
+	: m_Data{ data }, m_Size{ size }, m_Position{}, m_Endianness{ endianness }, m_NeedSwapEndian{ endianness != Environment::GetEndianness() }
+{
+}
+
+natBinaryViewReader::natBinaryViewReader(natRefPointer<natStream> const& stream, Environment::Endianness endianness)
+	: m_Stream{ stream }, m_Data{}, m_Size{}, m_Position{}, m_Endianness{ endianness }, m_NeedSwapEndian{ endianness != Environment::GetEndianness() }
+{
+	if (!TryGetMemory(m_Stream, m_Data, m_Size))
+	{
+		nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+	}
+
+	auto position = m_Stream->GetPosition();
+	// natSubStream::GetPosition返回的是在内部流中的位置
+	if (const auto subStream = m_Stream.Cast<natSubStream>())
+	{
+		position -= subStream->GetStartPosition();
+	}
+	m_Position = std::min(position, m_Size);
+}
+
+nBool natBinaryViewReader::TryGetMemory(natRefPointer<natStream> const& stream, ncData& data, nLen& size)
+{
+	if (!stream)
+	{
+		return false;
+	}
+
+	if (const auto memoryStream = stream.Cast<natMemoryStream>())
+	{
+		data = memoryStream->GetInternalBuffer();
+		size = memoryStream->GetSize();
+		return true;
+	}
+
+	if (const auto memoryStream = stream.Cast<natUnsyncMemoryStream>())
+	{
+		data = memoryStream->GetInternalBuffer();
+		size = memoryStream->GetSize();
+		return true;
+	}
+
+	if (const auto externMemoryStream = stream.Cast<natExternMemoryStream>())
+	{
+		data = externMemoryStream->GetExternData();
+		size = externMemoryStream->GetSize();
+		return true;
+	}
+
+	if (const auto subStream = stream.Cast<natSubStream>())
+	{
+		ncData internalData;
+		nLen internalSize;
+		if (!TryGetMemory(subStream->GetUnderlyingStream(), internalData, internalSize) || subStream->GetEndPosition() > internalSize)
+		{
+			return false;
+		}
+
+		data = internalData + subStream->GetStartPosition();
+		size = subStream->GetSize();
+		return true;
+	}
+
+	return false;
+}
+
+ncData natBinaryViewReader::GetData() const noexcept
+{
+	return m_Data;
+}
+
+nLen natBinaryViewReader::GetSize() const noexcept
+{
+	return m_Size;
+}
+
+Environment::Endianness natBinaryViewReader::GetEndianness() const noexcept
+{
+	return m_Endianness;
+}
+
+nLen natBinaryViewReader::GetPosition() const noexcept
+{
+	return m_Position;
+}
+
+void natBinaryViewReader::SetPosition(nLen position)
+{
+	checkRange(position, 0);
+	m_Position = position;
+}
+
+nLen natBinaryViewReader::GetRemainedSize() const noexcept
+{
+	return m_Size - m_Position;
+}
+
+nBool natBinaryViewReader::IsEnd() const noexcept
+{
+	return m_Position == m_Size;
+}
+
+void natBinaryViewReader::Skip(nLen bytes)
+{
+	checkRange(m_Position, bytes);
+	m_Position += bytes;
+}
+
+ncData natBinaryViewReader::ReadBytes(nLen length)
+{
+	const auto ret = PeekBytes(m_Position, length);
+	m_Position += length;
+	return ret;
+}
+
+ncData natBinaryViewReader::PeekBytes(nLen offset, nLen length) const
+{
+	checkRange(offset, length);
+	return m_Data + offset;
+}
+
+natBinaryViewReader natBinaryViewReader::ReadView(nLen length)
+{
+	auto ret = *this;
+	ret.m_Data = ReadBytes(length);
+	ret.m_Size = length;
+	ret.m_Position = 0;
+	return ret;
+}
+
+void natBinaryViewReader::checkRange(nLen offset, nLen length) const
+{
+	if (offset > m_Size || length > m_Size - offset)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "Access ({0} bytes at offset {1}) is out of range of the view ({2} bytes)."_nv, length, offset, m_Size);
+	}
+}
@@ -7,6 +7,11 @@
 #include "natConfig.h"
 #include "natStream.h"
 #include "natEnvironment.h"
+#include <cstring>
+#include <vector>
+#ifdef _MSC_VER
+#	include <stdlib.h>
+#endif
 
 namespace NatsuLib
 {
@@ -22,6 +27,71 @@ namespace NatsuLib
 				swap(data[i], data[maxI - i]);
 			}
 		}
+
+		inline nuShort ByteSwap(nuShort value) noexcept
+		{
+#ifdef _MSC_VER
+			return _byteswap_ushort(value);
+#else
+			return __builtin_bswap16(value);
+#endif
+		}
+
+		inline nuInt ByteSwap(nuInt value) noexcept
+		{
+#ifdef _MSC_VER
+			return _byteswap_ulong(value);
+#else
+			return __builtin_bswap32(value);
+#endif
+		}
+
+		inline nuLong ByteSwap(nuLong value) noexcept
+		{
+#ifdef _MSC_VER
+			return _byteswap_uint64(value);
+#else
+			return __builtin_bswap64(value);
+#endif
+		}
+
+		// 简单的循环以便编译器向量化（如pshufb）
+		template <typename T>
+		void SwapEndianArrayImpl(nData data, std::size_t count) noexcept
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				T value;
+				std::memcpy(&value, data + i * sizeof(T), sizeof(T));
+				value = ByteSwap(value);
+				std::memcpy(data + i * sizeof(T), &value, sizeof(T));
+			}
+		}
+
+		///	@brief	分别翻转count个大小为elementSize的元素的字节序
+		inline void SwapEndianArray(nData data, std::size_t elementSize, std::size_t count)
+		{
+			switch (elementSize)
+			{
+			case 1:
+				break;
+			case 2:
+				SwapEndianArrayImpl<nuShort>(data, count);
+				break;
+			case 4:
+				SwapEndianArrayImpl<nuInt>(data, count);
+				break;
+			case 8:
+				SwapEndianArrayImpl<nuLong>(data, count);
+				break;
+			default:
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					SwapEndian(data + i * elementSize, elementSize);
+				}
+				break;
+			}
+		}
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
@@ -65,10 +135,35 @@ namespace NatsuLib
 
 			if (m_NeedSwapEndian)
 			{
-				detail_::SwapEndian(reinterpret_cast<nData>(&obj), sizeof(T));
+				detail_::SwapEndianArray(reinterpret_cast<nData>(&obj), sizeof(T), 1);
+			}
+		}
+
+		///	@brief		读取流并作为count个POD类型T解读
+		///	@note		仅调用一次内部流的读取，需要时对整个数组翻转字节序
+		///	@warning	不适用于多个成员的结构体
+		template <typename T>
+		std::enable_if_t<std::is_pod<T>::value> ReadPodArray(T* objs, std::size_t count)
+		{
+			const auto size = static_cast<nLen>(count) * sizeof(T);
+			nLen readBytes;
+			if ((readBytes = m_Stream->ReadBytes(reinterpret_cast<nData>(objs), size)) < size)
+			{
+				nat_Throw(natException, "Only partial data ({0} bytes/{1} bytes requested) has been successfully read."_nv, readBytes, size);
+			}
+
+			if (m_NeedSwapEndian)
+			{
+				detail_::SwapEndianArray(reinterpret_cast<nData>(objs), sizeof(T), count);
 			}
 		}
 
+		template <typename T, std::size_t N>
+		std::enable_if_t<std::is_pod<T>::value> ReadPodArray(T(&objs)[N])
+		{
+			ReadPodArray(objs, N);
+		}
+
 	private:
 		natRefPointer<natStream> m_Stream;
 		const Environment::Endianness m_Endianness;
@@ -95,31 +190,160 @@ namespace NatsuLib
 		template <typename T>
 		std::enable_if_t<std::is_pod<T>::value> WritePod(T const& obj)
 		{
-			nLen writtenBytes;
 			nByte buffer[sizeof(T)];
+			std::memcpy(buffer, std::addressof(obj), sizeof(T));
 			if (m_NeedSwapEndian)
 			{
-#ifdef _MSC_VER
-				const auto copyIterator = stdext::make_checked_array_iterator(buffer, std::size(buffer));
-#else
-				const auto copyIterator = buffer;
-#endif
-				std::reverse_copy(buffer, buffer + sizeof(T), copyIterator);
+				detail_::SwapEndianArray(buffer, sizeof(T), 1);
 			}
-			else
+
+			writeBuffer(buffer, sizeof(T));
+		}
+
+		///	@brief		将count个POD类型的实例写入流
+		///	@note		不需要翻转字节序时仅调用一次内部流的写入，否则分块翻转字节序后写入
+		///	@warning	不适用于多个成员的结构体
+		template <typename T>
+		std::enable_if_t<std::is_pod<T>::value> WritePodArray(const T* objs, std::size_t count)
+		{
+			if (!m_NeedSwapEndian)
 			{
-				std::memcpy(buffer, std::addressof(obj), sizeof(T));
+				writeBuffer(reinterpret_cast<ncData>(objs), static_cast<nLen>(count) * sizeof(T));
+				return;
 			}
 
-			if ((writtenBytes = m_Stream->WriteBytes(buffer, sizeof(T))) < sizeof(T))
+			// 复用翻转字节序用的缓冲区，避免每次调用都分配内存
+			const auto chunkCount = std::min(count, std::max(SwapChunkSize / sizeof(T), std::size_t{ 1 }));
+			if (m_SwapBuffer.size() < chunkCount * sizeof(T))
 			{
-				nat_Throw(natException, "Only partial data ({0} bytes/{1} bytes requested) has been successfully written."_nv, writtenBytes, sizeof(T));
+				m_SwapBuffer.resize(chunkCount * sizeof(T));
+			}
+
+			for (std::size_t i = 0; i < count; i += chunkCount)
+			{
+				const auto currentCount = std::min(chunkCount, count - i);
+				std::memcpy(m_SwapBuffer.data(), objs + i, currentCount * sizeof(T));
+				detail_::SwapEndianArray(m_SwapBuffer.data(), sizeof(T), currentCount);
+				writeBuffer(m_SwapBuffer.data(), currentCount * sizeof(T));
 			}
 		}
 
+		template <typename T, std::size_t N>
+		std::enable_if_t<std::is_pod<T>::value> WritePodArray(const T(&objs)[N])
+		{
+			WritePodArray(objs, N);
+		}
+
 	private:
+		enum : std::size_t
+		{
+			SwapChunkSize = 65536,
+		};
+
 		natRefPointer<natStream> m_Stream;
 		const Environment::Endianness m_Endianness;
 		const nBool m_NeedSwapEndian;
+		std::vector<nByte> m_SwapBuffer;
+
+		void writeBuffer(ncData buffer, nLen size);
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief		二进制视图读取类
+	///	@note		直接在内存中解读数据，返回指向内部缓冲区的指针或子视图而不进行复制\n
+	///				所有访问均会检查边界，越界时抛出natErrException（NatErr_OutOfRange）
+	///	@warning	内部缓冲区在视图存活期间不能被重新分配或释放\n
+	///				对于natMemoryStream，请勿在使用视图期间写入导致其扩容
+	////////////////////////////////////////////////////////////////////////////////
+	class natBinaryViewReader
+	{
+	public:
+		///	@brief	在一段内存上创建视图
+		natBinaryViewReader(ncData data, nLen size, Environment::Endianness endianness = Environment::GetEndianness()) noexcept;
+		///	@brief	在内存流上创建视图
+		///	@note	支持natMemoryStream、natUnsyncMemoryStream、natExternMemoryStream（包括natFileStream::MapToMemoryStream的结果）以及建立在这些流之上的natSubStream\n
+		///			视图覆盖整个流，初始位置为流的当前位置，视图会持有流的引用，流的位置不会因为视图的读取而改变
+		explicit natBinaryViewReader(natRefPointer<natStream> const& stream, Environment::Endianness endianness = Environment::GetEndianness());
+
+		///	@brief	尝试获得流所对应的内存
+		///	@return	流是否以内存为存储
+		static nBool TryGetMemory(natRefPointer<natStream> const& stream, ncData& data, nLen& size);
+
+		ncData GetData() const noexcept;
+		nLen GetSize() const noexcept;
+		Environment::Endianness GetEndianness() const noexcept;
+
+		nLen GetPosition() const noexcept;
+		void SetPosition(nLen position);
+		nLen GetRemainedSize() const noexcept;
+		nBool IsEnd() const noexcept;
+
+		void Skip(nLen bytes);
+
+		///	@brief	获得指向当前位置的指针并前进length字节
+		ncData ReadBytes(nLen length);
+		///	@brief	获得指向offset处的指针，不改变当前位置
+		ncData PeekBytes(nLen offset, nLen length) const;
+
+		///	@brief	获得从当前位置开始长度为length的子视图并前进length字节
+		///	@note	子视图的位置从0开始，与本视图共享内存及字节序
+		natBinaryViewReader ReadView(nLen length);
+
+		///	@brief		读取当前位置的数据并作为POD类型T解读，需要时翻转字节序
+		///	@warning	不适用于多个成员的结构体
+		template <typename T>
+		std::enable_if_t<std::is_pod<T>::value, T> ReadPod()
+		{
+			const auto ret = PeekPod<T>(m_Position);
+			m_Position += sizeof(T);
+			return ret;
+		}
+
+		///	@brief		读取offset处的数据并作为POD类型T解读，需要时翻转字节序，不改变当前位置
+		///	@warning	不适用于多个成员的结构体
+		template <typename T>
+		std::enable_if_t<std::is_pod<T>::value, T> PeekPod(nLen offset) const
+		{
+			T ret;
+			std::memcpy(&ret, PeekBytes(offset, sizeof(T)), sizeof(T));
+			if (m_NeedSwapEndian)
+			{
+				detail_::SwapEndianArray(reinterpret_cast<nData>(&ret), sizeof(T), 1);
+			}
+
+			return ret;
+		}
+
+		///	@brief		读取count个POD类型T到objs中，需要时翻转字节序
+		///	@warning	不适用于多个成员的结构体
+		template <typename T>
+		std::enable_if_t<std::is_pod<T>::value> ReadPodArray(T* objs, std::size_t count)
+		{
+			const auto size = static_cast<nLen>(count) * sizeof(T);
+			std::memcpy(objs, ReadBytes(size), static_cast<std::size_t>(size));
+			if (m_NeedSwapEndian)
+			{
+				detail_::SwapEndianArray(reinterpret_cast<nData>(objs), sizeof(T), count);
+			}
+		}
+
+		///	@brief	获得从当前位置开始长度为length字节的字符串视图并前进length字节
+		template <StringType encoding>
+		StringView<encoding> ReadStringView(nLen length)
+		{
+			typedef typename StringEncodingTrait<encoding>::CharType CharType;
+			const auto data = reinterpret_cast<const CharType*>(ReadBytes(length));
+			return { data, static_cast<std::size_t>(length / sizeof(CharType)) };
+		}
+
+	private:
+		natRefPointer<natStream> m_Stream;
+		ncData m_Data;
+		nLen m_Size;
+		nLen m_Position;
+		Environment::Endianness m_Endianness;
+		nBool m_NeedSwapEndian;
+
+		void checkRange(nLen offset, nLen length) const;
 	};
 }
@@ -2,6 +2,10 @@
 #include "natCompression.h"
 #include "natEncoding.h"
 #include "natCryptography.h"
+#include "natAsyncStream.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
 #undef max
 
@@ -9,6 +13,121 @@ using namespace NatsuLib;
 
 using CurrentUsingRuntimeEncoding = RuntimeEncoding<GetUsingStringType<nString>::value>;
 
+namespace
+{
+	typedef std::function<nLen(nLen, nData, nLen)> PositionalReader;
+
+	// 通过按位置读取访问另一个流的一部分，不依赖也不改变该流的当前位置，因此不同实例可在多个线程中同时使用
+	class PositionalReadStream final
+		: public natRefObjImpl<PositionalReadStream, natStream>
+	{
+	public:
+		PositionalReadStream(PositionalReader const& reader, nLen startPosition, nLen endPosition)
+			: m_Reader(reader), m_StartPosition{ startPosition }, m_EndPosition{ endPosition }, m_CurrentPosition{ startPosition }
+		{
+			assert(startPosition <= endPosition && "startPosition cannot be bigger than endPosition.");
+		}
+
+		nBool CanWrite() const override
+		{
+			return false;
+		}
+
+		nBool CanRead() const override
+		{
+			return true;
+		}
+
+		nBool CanResize() const override
+		{
+			return false;
+		}
+
+		nBool CanSeek() const override
+		{
+			return true;
+		}
+
+		nBool IsEndOfStream() const override
+		{
+			return m_CurrentPosition == m_EndPosition;
+		}
+
+		nLen GetSize() const override
+		{
+			return m_EndPosition - m_StartPosition;
+		}
+
+		void SetSize(nLen /*Size*/) override
+		{
+			nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+		}
+
+		nLen GetPosition() const override
+		{
+			return m_CurrentPosition - m_StartPosition;
+		}
+
+		void SetPosition(NatSeek Origin, nLong Offset) override
+		{
+			nLen position{};
+			switch (Origin)
+			{
+			case NatSeek::Beg:
+				position = m_StartPosition + Offset;
+				break;
+			case NatSeek::Cur:
+				position = m_CurrentPosition + Offset;
+				break;
+			case NatSeek::End:
+				position = m_EndPosition + Offset;
+				break;
+			default:
+				assert(!"Invalid Origin.");
+			}
+
+			if (position < m_StartPosition || position > m_EndPosition)
+			{
+				nat_Throw(natErrException, NatErr_InvalidArg, "Out of range."_nv);
+			}
+
+			m_CurrentPosition = position;
+		}
+
+		nLen ReadBytes(nData pData, nLen Length) override
+		{
+			const auto realLength = std::min(Length, m_EndPosition - m_CurrentPosition);
+			nLen readBytes = 0;
+			while (readBytes < realLength)
+			{
+				const auto ret = m_Reader(m_CurrentPosition, pData + readBytes, realLength - readBytes);
+				if (!ret)
+				{
+					nat_Throw(natErrException, NatErr_OutOfRange, "Reached end of underlying stream."_nv);
+				}
+				readBytes += ret;
+				m_CurrentPosition += ret;
+			}
+			return readBytes;
+		}
+
+		nLen WriteBytes(ncData /*pData*/, nLen /*Length*/) override
+		{
+			nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+		}
+
+		void Flush() override
+		{
+		}
+
+	private:
+		PositionalReader const& m_Reader;
+		const nLen m_StartPosition;
+		const nLen m_EndPosition;
+		nLen m_CurrentPosition;
+	};
+}
+
 natZipArchive::ZipEntry::~ZipEntry()
 {
 }
@@ -70,6 +189,45 @@ natRefPointer<natStream> natZipArchive::ZipEntry::Open()
 	}
 }
 
+nBool natZipArchive::ZipEntry::TryGetStoredData(ncData& data, nLen& size) const
+{
+	if (!m_Archive || !m_OriginallyInArchive || m_EverOpenedForWrite ||
+		m_CentralDirectoryFileHeader.CompressionMethod != static_cast<nuShort>(CompressionMethod::Stored) ||
+		m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::Encrypted))
+	{
+		return false;
+	}
+
+	ncData archiveData;
+	nLen archiveSize;
+	if (!natBinaryViewReader::TryGetMemory(m_Archive->m_Stream, archiveData, archiveSize))
+	{
+		return false;
+	}
+
+	// 直接在内存中解读本地文件头，不使用也不修改m_OffsetOfCompressedData，避免与其他线程竞争
+	const natBinaryViewReader view{ archiveData, archiveSize, Environment::Endianness::LittleEndian };
+	const auto localHeaderOffset = m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader;
+	if (localHeaderOffset > archiveSize || archiveSize - localHeaderOffset < LocalFileHeader::SizeOfLocalHeader ||
+		view.PeekPod<nuInt>(localHeaderOffset) != LocalFileHeader::Signature)
+	{
+		nat_Throw(InvalidData);
+	}
+
+	const auto filenameLength = view.PeekPod<nuShort>(localHeaderOffset + LocalFileHeader::OffsetToFilenameLength);
+	const auto extraFieldLength = view.PeekPod<nuShort>(localHeaderOffset + LocalFileHeader::OffsetToFilenameLength + sizeof(nuShort));
+	const auto offset = localHeaderOffset + LocalFileHeader::SizeOfLocalHeader + filenameLength + extraFieldLength;
+	const auto storedSize = m_CentralDirectoryFileHeader.CompressedSize;
+	if (offset > archiveSize || archiveSize - offset < storedSize)
+	{
+		nat_Throw(InvalidData);
+	}
+
+	data = archiveData + offset;
+	size = static_cast<nLen>(storedSize);
+	return true;
+}
+
 void natZipArchive::ZipEntry::SetPassword()
 {
 	m_Password.reset();
@@ -106,10 +264,21 @@ natZipArchive::ZipEntry::ZipEntry(natZipArchive* archive, CentralDirectoryFileHe
 	}
 }
 
-natRefPointer<natStream> natZipArchive::ZipEntry::openForRead()
+natRefPointer<natStream> natZipArchive::ZipEntry::openForRead(nBool prefetch)
 {
 	const auto offset = getOffsetOfCompressedData();
-	auto compressedStream = make_ref<natSubStream>(m_Archive->m_Stream, offset, offset + m_CentralDirectoryFileHeader.CompressedSize);
+	natRefPointer<natStream> compressedStream = make_ref<natSubStream>(m_Archive->m_Stream, offset, offset + m_CentralDirectoryFileHeader.CompressedSize);
+	// 数据过少时预读无法带来收益
+	if (prefetch && m_CentralDirectoryFileHeader.CompressedSize > natPrefetchStream::DefaultBlockSize)
+	{
+		compressedStream = make_ref<natPrefetchStream>(std::move(compressedStream));
+	}
+
+	return createDecompressor(std::move(compressedStream));
+}
+
+natRefPointer<natStream> natZipArchive::ZipEntry::createDecompressor(natRefPointer<natStream> compressedStream)
+{
 	natRefPointer<natStream> uncompressor = compressedStream;
 
 	if (m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::Encrypted))
@@ -165,6 +334,11 @@ natRefPointer<natStream> natZipArchive::ZipEntry::openForCreate()
 
 	m_EverOpenedForWrite = true;
 	m_CentralDirectoryFileHeader.CompressionMethod = static_cast<nuShort>(CompressionMethod::Deflate);
+	// 加密的入口在写入前会被完整缓存，不需要数据描述符
+	if (m_Archive->m_UseDataDescriptor && !m_Password)
+	{
+		m_CentralDirectoryFileHeader.GeneralPurposeBitFlag |= static_cast<nuShort>(BitFlag::DataDescriptor);
+	}
 
 	return make_ref<ZipEntryWriteStream>(*this, createCompressor(m_Archive->m_Stream));
 }
@@ -202,16 +376,63 @@ nLen natZipArchive::ZipEntry::getOffsetOfCompressedData()
 	return m_OffsetOfCompressedData.value();
 }
 
+nLen natZipArchive::ZipEntry::getEndOfCompressedData()
+{
+	auto endOfData = getOffsetOfCompressedData() + m_CentralDirectoryFileHeader.CompressedSize;
+
+	if (m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::DataDescriptor))
+	{
+		// 数据描述符的签名是可选的，大小字段在使用Zip64时为8字节
+		const auto stream = m_Archive->m_Stream;
+		if (endOfData + sizeof(nuInt) <= stream->GetSize())
+		{
+			stream->SetPosition(NatSeek::Beg, endOfData);
+			if (m_Archive->m_Reader->ReadPod<nuInt>() == LocalFileHeader::DataDescriptorSignature)
+			{
+				endOfData += sizeof(nuInt);
+			}
+		}
+
+		const auto usedZip64 = localHeaderHasZip64ExtraField() || m_CentralDirectoryFileHeader.CompressedSize >= Mask32Bit || m_CentralDirectoryFileHeader.UncompressedSize >= Mask32Bit;
+		endOfData += sizeof(nuInt) + (usedZip64 ? 2 * sizeof(nuLong) : 2 * sizeof(nuInt));
+	}
+
+	return endOfData;
+}
+
+nBool natZipArchive::ZipEntry::localHeaderHasZip64ExtraField()
+{
+	const auto stream = m_Archive->m_Stream;
+	const auto reader = m_Archive->m_Reader;
+
+	stream->SetPosition(NatSeek::Beg, m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader + LocalFileHeader::OffsetToFilenameLength);
+	const auto fileNameLength = reader->ReadPod<nuShort>();
+	const auto extraFieldLength = reader->ReadPod<nuShort>();
+	stream->SetPosition(NatSeek::Cur, fileNameLength);
+
+	ExtraField field;
+	const auto extraFieldStart = stream->GetPosition();
+	while (field.ReadWithLimit(reader, extraFieldStart + extraFieldLength))
+	{
+		if (field.Tag == Zip64ExtraField::Tag)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 natRefPointer<natStream> const& natZipArchive::ZipEntry::getUncompressedData()
 {
 	if (!m_UncompressedData)
 	{
-		m_UncompressedData = make_ref<natMemoryStream>(0, true, true, true);
+		m_UncompressedData = make_ref<natChunkedMemoryStream>();
 
 		if (m_OriginallyInArchive)
 		{
-			const auto decompressor = openForRead();
-			m_UncompressedData->SetSize(decompressor->GetSize());
+			// 解压期间不会有其他入口访问归档流，可以安全地预读
+			const auto decompressor = openForRead(true);
 			decompressor->CopyTo(m_UncompressedData);
 		}
 
@@ -223,7 +444,7 @@ natRefPointer<natStream> const& natZipArchive::ZipEntry::getUncompressedData()
 
 // 压缩流包装链：DisposeCallbackStream（若加密，用于获取crc32）
 //	-> natCrc32Stream（计算crc32） -> natDeflateStream（压缩数据）
-//		-> DisposeCallbackStream（若加密，用于写入到真正的输出流） -> natMemoryStream（若加密，用于保存未加密和压缩的数据）
+//		-> DisposeCallbackStream（若加密，用于写入到真正的输出流） -> natChunkedMemoryStream（若加密，用于保存未加密和压缩的数据）
 //																\-> natCryptoStream（若加密，用于加密数据） -> stream（输出流）
 // 压缩时先压缩再加密
 natRefPointer<natStream> natZipArchive::ZipEntry::createCompressor(natRefPointer<natStream> stream)
@@ -242,7 +463,7 @@ natRefPointer<natStream> natZipArchive::ZipEntry::createCompressor(natRefPointer
 		pkZipWeakProcessor->InitCipher(password.data(), password.size());
 		compressor = m_CryptoStream = make_ref<natCryptoStream>(std::move(compressor), std::move(cryptoProcessor), natCryptoStream::CryptoStreamMode::Write);
 		// 为了生成正确的头部，先缓存数据到内存流，在内容写入完成后再加密
-		auto wrappedStream = make_ref<DisposeCallbackStream>(make_ref<natMemoryStream>(0, true, true, true),
+		auto wrappedStream = make_ref<DisposeCallbackStream>(make_ref<natChunkedMemoryStream>(),
 			[this, originStream = std::move(compressor)] (DisposeCallbackStream& disposeCallbackStream)
 			{
 				writeSecurityMetadata(m_CryptoStream->GetUnderlyingStream());
@@ -282,7 +503,7 @@ void natZipArchive::ZipEntry::loadExtraFieldAndCompressedData()
 
 		const auto fileNameLength = reader->ReadPod<nuShort>();
 		const auto extraFieldLength = reader->ReadPod<nuShort>();
-		stream->SetPosition(NatSeek::Beg, fileNameLength);
+		stream->SetPosition(NatSeek::Cur, fileNameLength);
 
 		m_LocalHeaderFields.emplace();
 		auto& fields = m_LocalHeaderFields.value();
@@ -307,12 +528,59 @@ void natZipArchive::ZipEntry::loadExtraFieldAndCompressedData()
 	}
 }
 
+void natZipArchive::ZipEntry::compressUncompressedData()
+{
+	assert(m_UncompressedData && "m_UncompressedData should not be nullptr.");
+
+	const auto compressedData = make_ref<natChunkedMemoryStream>();
+	{
+		const auto compressor = createCompressor(compressedData);
+		m_UncompressedData->SetPosition(NatSeek::Beg, 0);
+		m_UncompressedData->CopyTo(compressor);
+
+		// 加密时natCrc32Stream之外还有一层DisposeCallbackStream
+		auto crc32Stream = compressor.Cast<natCrc32Stream>();
+		if (!crc32Stream)
+		{
+			crc32Stream = compressor.Cast<natWrappedStream>()->GetUnderlyingStreamAs<natCrc32Stream>();
+		}
+		assert(crc32Stream && "cannot get crc32stream.");
+
+		crc32Stream->GetUnderlyingStream().Cast<natDeflateStream>()->Finish();
+		m_CentralDirectoryFileHeader.Crc32 = crc32Stream->GetCrc32();
+		m_CentralDirectoryFileHeader.UncompressedSize = crc32Stream->GetPosition();
+	}
+
+	// 加密的数据在压缩器释放时才写入，此时已包含加密头
+	m_CentralDirectoryFileHeader.CompressedSize = compressedData->GetSize();
+	m_CompressedData = compressedData;
+	m_UncompressedData.Reset();
+}
+
 void natZipArchive::ZipEntry::writeLocalFileHeaderAndData()
 {
 	const auto stream = m_Archive->m_Stream;
 	const auto writer = m_Archive->m_Writer;
 
-	if (m_UncompressedData)
+	// 创建模式下已经写入的入口无需再处理
+	if (!m_CompressedData && !m_UncompressedData && !m_CachedCompressedData && m_Archive->m_Mode != ZipArchiveMode::Update && m_EverOpenedForWrite)
+	{
+		return;
+	}
+
+	// 以下写入的本地文件头都包含实际的Crc32及大小，数据之后不再有数据描述符
+	// 以数据描述符写入的入口在更新时也需要清除此标志，否则与文档中实际的结构不符
+	m_CentralDirectoryFileHeader.GeneralPurposeBitFlag &= ~static_cast<nuShort>(BitFlag::DataDescriptor);
+
+	if (m_CompressedData)
+	{
+		m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = stream->GetPosition();
+		LocalFileHeader::Write(writer, m_CentralDirectoryFileHeader, m_LocalHeaderFields, m_Archive->m_Encoding);
+		m_CompressedData->SetPosition(NatSeek::Beg, 0);
+		m_CompressedData->CopyTo(stream);
+		m_CompressedData.Reset();
+	}
+	else if (m_UncompressedData)
 	{
 		m_CentralDirectoryFileHeader.UncompressedSize = m_UncompressedData->GetSize();
 
@@ -328,11 +596,13 @@ void natZipArchive::ZipEntry::writeLocalFileHeaderAndData()
 		{
 			m_CentralDirectoryFileHeader.CompressionMethod = static_cast<nuShort>(CompressionMethod::Stored);
 		}
+		m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = stream->GetPosition();
 		LocalFileHeader::Write(writer, m_CentralDirectoryFileHeader, m_LocalHeaderFields, m_Archive->m_Encoding);
 		stream->WriteBytes(data.data(), data.size());
 	}
-	else if (m_Archive->m_Mode == ZipArchiveMode::Update || !m_EverOpenedForWrite)
+	else
 	{
+		m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = stream->GetPosition();
 		LocalFileHeader::Write(writer, m_CentralDirectoryFileHeader, m_LocalHeaderFields, m_Archive->m_Encoding);
 		m_EverOpenedForWrite = true;
 	}
@@ -429,11 +699,7 @@ nLen natZipArchive::ZipEntry::ZipEntryWriteStream::WriteBytes(ncData pData, nLen
 
 	if (!m_WroteData)
 	{
-		m_Entry.m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = m_Entry.m_Archive->m_Stream->GetPosition();
-		m_UseZip64 = LocalFileHeader::Write(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader, m_Entry.m_LocalHeaderFields, m_Entry.m_Archive->m_Encoding);
-		const auto ultimateUnderlyingStream = GetUltimateUnderlyingStream();
-		m_InitialPosition = ultimateUnderlyingStream->GetPosition();
-		m_WroteData = true;
+		writeLocalFileHeader();
 	}
 
 	return m_InternalStream->WriteBytes(pData, Length);
@@ -444,14 +710,33 @@ void natZipArchive::ZipEntry::ZipEntryWriteStream::Flush()
 	m_InternalStream->Flush();
 }
 
+void natZipArchive::ZipEntry::ZipEntryWriteStream::writeLocalFileHeader()
+{
+	// 输出流不可定位时加密的入口在数据全部写入后才写入本地文件头，参见finish
+	if (!m_Entry.m_Archive->m_UseDataDescriptor || !(m_Entry.m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::Encrypted)))
+	{
+		m_Entry.m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = m_Entry.m_Archive->m_Stream->GetPosition();
+		m_UseZip64 = LocalFileHeader::Write(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader, m_Entry.m_LocalHeaderFields, m_Entry.m_Archive->m_Encoding);
+	}
+	m_InitialPosition = getOutputStream()->GetPosition();
+	m_WroteData = true;
+}
+
 void natZipArchive::ZipEntry::ZipEntryWriteStream::finish()
 {
+	// 没有写入数据时压缩流不会输出任何数据，以存储方式记录空的入口
+	if (!m_WroteData)
+	{
+		m_Entry.m_CentralDirectoryFileHeader.CompressionMethod = static_cast<nuShort>(CompressionMethod::Stored);
+		writeLocalFileHeader();
+	}
+
 	GetUnderlyingStreamAs<natDeflateStream>()->Finish();
 	const auto crc32Stream = GetUnderlyingStreamAs<natCrc32Stream>();
 	assert(crc32Stream && "cannot get crc32stream.");
 	m_Entry.m_CentralDirectoryFileHeader.Crc32 = crc32Stream->GetCrc32();
 	m_Entry.m_CentralDirectoryFileHeader.UncompressedSize = crc32Stream->GetPosition();
-	m_Entry.m_CentralDirectoryFileHeader.CompressedSize = crc32Stream->GetUltimateUnderlyingStream()->GetPosition() - m_InitialPosition;
+	m_Entry.m_CentralDirectoryFileHeader.CompressedSize = getOutputStream()->GetPosition() - m_InitialPosition;
 
 	// 硬编码加入加密头的长度
 	if (m_Entry.m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::Encrypted))
@@ -459,15 +744,24 @@ void natZipArchive::ZipEntry::ZipEntryWriteStream::finish()
 		m_Entry.m_CentralDirectoryFileHeader.CompressedSize += PKzipWeakProcessor::HeaderSize;
 	}
 
-	if (m_WroteData)
+	if (m_Entry.m_CentralDirectoryFileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(BitFlag::DataDescriptor))
 	{
-		// 已经写了 LocalFileHeader，补充Crc32以及大小信息（原本写入的是不完整的，需要修正）
-		LocalFileHeader::WriteCrcAndSizes(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader, m_UseZip64);
+		// 不可定位的输出流，Crc32及大小写入到数据之后
+		LocalFileHeader::WriteDataDescriptor(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader);
 	}
-	else
+	else if (m_Entry.m_Archive->m_UseDataDescriptor)
 	{
+		// 不可定位的输出流上的加密入口，此时数据仍缓存在内存中，写入完整的本地文件头后立即输出数据
 		m_Entry.m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader = m_Entry.m_Archive->m_Stream->GetPosition();
 		LocalFileHeader::Write(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader, m_Entry.m_LocalHeaderFields, m_Entry.m_Archive->m_Encoding);
+		// 先生成加密头，再加密并输出缓存的数据
+		m_InternalStream.Cast<DisposeCallbackStream>()->CallDisposeCallback();
+		GetUnderlyingStreamAs<natDeflateStream>()->GetUnderlyingStream().Cast<DisposeCallbackStream>()->CallDisposeCallback();
+	}
+	else
+	{
+		// 已经写了 LocalFileHeader，补充Crc32以及大小信息（原本写入的是不完整的，需要修正）
+		LocalFileHeader::WriteCrcAndSizes(m_Entry.m_Archive->m_Writer, m_Entry.m_CentralDirectoryFileHeader, m_UseZip64);
 	}
 
 	if (m_FinishCallback)
@@ -476,6 +770,16 @@ void natZipArchive::ZipEntry::ZipEntryWriteStream::finish()
 	}
 }
 
+natRefPointer<natStream> natZipArchive::ZipEntry::ZipEntryWriteStream::getOutputStream() const
+{
+	// 后写流之下的流的位置落后于已写入的数据，因此以后写流作为输出流
+	if (const auto writeBehindStream = GetUnderlyingStreamAs<natWriteBehindStream>())
+	{
+		return writeBehindStream;
+	}
+	return GetUltimateUnderlyingStream();
+}
+
 natZipArchive::ZipEntry::ZipEntry(natZipArchive* archive, nStrView const& entryName)
 	: m_Archive{ archive }, m_OriginallyInArchive{ false }, m_CentralDirectoryFileHeader{}, m_EverOpenedForWrite{ false }, m_CurrentOpeningForWrite{ false }, m_DecryptStatus{ DecryptStatus::NeedNotToDecrypt }
 {
@@ -483,25 +787,33 @@ natZipArchive::ZipEntry::ZipEntry(natZipArchive* archive, nStrView const& entryN
 	m_CentralDirectoryFileHeader.FilenameLength = static_cast<nuShort>(m_CentralDirectoryFileHeader.Filename.size() * sizeof(nString::CharType));
 }
 
-natZipArchive::natZipArchive(natRefPointer<natStream> stream, ZipArchiveMode mode)
+natZipArchive::natZipArchive(natRefPointer<natStream> stream, ZipArchiveMode mode, nBool compactIndex)
 #ifdef _WIN32
-	: natZipArchive(std::move(stream), StringType::Ansi, mode)
+	: natZipArchive(std::move(stream), StringType::Ansi, mode, compactIndex)
 #else
-	: natZipArchive(std::move(stream), StringType::Utf8, mode)
+	: natZipArchive(std::move(stream), StringType::Utf8, mode, compactIndex)
 #endif
 {
 }
 
-natZipArchive::natZipArchive(natRefPointer<natStream> stream, StringType encoding, ZipArchiveMode mode)
-	: m_Stream{ std::move(stream) }, m_Reader{ make_ref<natBinaryReader>(m_Stream, Environment::Endianness::LittleEndian) }, m_Encoding{ encoding }, m_Mode{ mode }
+natZipArchive::natZipArchive(natRefPointer<natStream> stream, StringType encoding, ZipArchiveMode mode, nBool compactIndex)
+	: m_Stream{ std::move(stream) }, m_Reader{ make_ref<natBinaryReader>(m_Stream, Environment::Endianness::LittleEndian) }, m_Encoding{ encoding }, m_Mode{ mode }, m_UpdateStrategy{ UpdateStrategy::Rewrite }, m_UseDataDescriptor{ false }, m_CompactIndex{ compactIndex }, m_Zip64EndOfCentralDirectoryLocator{}, m_Zip64EndOfCentralDirectory{}
 {
+	if (compactIndex && mode != ZipArchiveMode::Read)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "compactIndex can only be used with ZipArchiveMode::Read mode."_nv);
+	}
+
 	switch (mode)
 	{
 	case ZipArchiveMode::Create:
-		if (!m_Stream->CanWrite() || !m_Stream->CanSeek())
+		if (!m_Stream->CanWrite())
 		{
-			nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable and seekable with ZipArchiveMode::Create mode."_nv);
+			nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable with ZipArchiveMode::Create mode."_nv);
 		}
+		m_UseDataDescriptor = !m_Stream->CanSeek();
+		// 创建模式下只会写入，在后台写入以使压缩与输出重叠进行
+		m_Stream = make_ref<natWriteBehindStream>(std::move(m_Stream));
 		m_Writer = make_ref<natBinaryWriter>(m_Stream, Environment::Endianness::LittleEndian);
 		break;
 	case ZipArchiveMode::Read:
@@ -536,6 +848,16 @@ natZipArchive::ZipArchiveMode natZipArchive::GetOpenMode() const noexcept
 	return m_Mode;
 }
 
+void natZipArchive::SetUpdateStrategy(UpdateStrategy strategy) noexcept
+{
+	m_UpdateStrategy = strategy;
+}
+
+natZipArchive::UpdateStrategy natZipArchive::GetUpdateStrategy() const noexcept
+{
+	return m_UpdateStrategy;
+}
+
 natRefPointer<natZipArchive::ZipEntry> natZipArchive::CreateEntry(nStrView entryName)
 {
 	auto entry = new ZipEntry(this, entryName);
@@ -546,13 +868,58 @@ natRefPointer<natZipArchive::ZipEntry> natZipArchive::CreateEntry(nStrView entry
 	return pEntry;
 }
 
+nLen natZipArchive::GetEntryCount() const noexcept
+{
+	return m_CompactIndex ? m_IndexRecords.size() : m_EntriesMap.size();
+}
+
 Linq<const natRefPointer<natZipArchive::ZipEntry>> natZipArchive::GetEntries() const
 {
+	if (m_CompactIndex)
+	{
+		return from_range(nuInt{}, static_cast<nuInt>(m_IndexRecords.size())).select([this](nuInt index) -> const natRefPointer<ZipEntry>& { return getIndexedEntry(index); });
+	}
+
 	return from(m_EntriesMap).select([](auto&& pair) -> const natRefPointer<ZipEntry>& { return pair.second; });
 }
 
+Linq<const natRefPointer<natZipArchive::ZipEntry>> natZipArchive::GetEntriesWithPrefix(nStrView prefix) const
+{
+	if (m_CompactIndex)
+	{
+		// 名称以prefix开头的记录在有序的下标中是连续的
+		const auto begin = std::lower_bound(m_SortedIndex.cbegin(), m_SortedIndex.cend(), prefix, [this](nuInt index, nStrView const& value)
+		{
+			return getIndexedName(index) < value;
+		});
+		const auto end = std::partition_point(begin, m_SortedIndex.cend(), [this, prefix](nuInt index)
+		{
+			return getIndexedName(index).StartWith(prefix);
+		});
+		return from(begin, end).select([this](nuInt index) -> const natRefPointer<ZipEntry>& { return getIndexedEntry(index); });
+	}
+
+	return from(m_EntriesMap).where([prefix = nString{ prefix }](auto&& pair)
+	{
+		return pair.first.StartWith(prefix);
+	}).select([](auto&& pair) -> const natRefPointer<ZipEntry>& { return pair.second; });
+}
+
 natRefPointer<natZipArchive::ZipEntry> natZipArchive::GetEntry(nStrView entryName) const
 {
+	if (m_CompactIndex)
+	{
+		const auto iter = std::lower_bound(m_SortedIndex.cbegin(), m_SortedIndex.cend(), entryName, [this](nuInt index, nStrView const& value)
+		{
+			return getIndexedName(index) < value;
+		});
+		if (iter == m_SortedIndex.cend() || getIndexedName(*iter) != entryName)
+		{
+			return {};
+		}
+		return getIndexedEntry(*iter);
+	}
+
 	const auto iter = m_EntriesMap.find(entryName);
 	if (iter == m_EntriesMap.cend())
 	{
@@ -561,6 +928,124 @@ natRefPointer<natZipArchive::ZipEntry> natZipArchive::GetEntry(nStrView entryNam
 	return iter->second;
 }
 
+nLen natZipArchive::ExtractAll(SinkFactory const& sinkFactory, nuInt threadCount)
+{
+	return ExtractTo({}, sinkFactory, threadCount);
+}
+
+nLen natZipArchive::ExtractTo(EntryPredicate const& predicate, SinkFactory const& sinkFactory, nuInt threadCount)
+{
+	if (m_Mode != ZipArchiveMode::Read)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Cannot extract entries while mode is not ZipArchiveMode::Read."_nv);
+	}
+
+	if (!sinkFactory)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "sinkFactory should not be empty."_nv);
+	}
+
+	// 文件流可以按位置读取，其他流只能串行地定位后读取
+	const auto fileStream = m_Stream.Cast<natFileStream>();
+	std::mutex streamMutex;
+	const PositionalReader readAt = [this, &fileStream, &streamMutex](nLen position, nData buffer, nLen length) -> nLen
+	{
+		if (fileStream)
+		{
+			return fileStream->ReadBytesAt(position, buffer, length);
+		}
+
+		std::lock_guard<std::mutex> lock{ streamMutex };
+		m_Stream->SetPosition(NatSeek::Beg, static_cast<nLong>(position));
+		return m_Stream->ReadBytes(buffer, length);
+	};
+
+	std::vector<ZipEntry*> entries;
+	entries.reserve(GetEntryCount());
+	for (auto&& entry : GetEntries())
+	{
+		if (!predicate || predicate(*entry))
+		{
+			entries.emplace_back(entry.Get());
+		}
+	}
+
+	// 按位置排序以尽量顺序地读取
+	std::sort(entries.begin(), entries.end(), [](ZipEntry const* a, ZipEntry const* b)
+	{
+		return a->m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader < b->m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader;
+	});
+
+	// 预先解析所有入口的数据位置，解压时不再访问共享的m_Reader
+	const auto streamSize = m_Stream->GetSize();
+	for (const auto entry : entries)
+	{
+		if (entry->m_OffsetOfCompressedData)
+		{
+			continue;
+		}
+
+		const auto localHeaderOffset = entry->m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader;
+		nByte header[LocalFileHeader::SizeOfLocalHeader];
+		if (localHeaderOffset + sizeof header > streamSize)
+		{
+			nat_Throw(InvalidData);
+		}
+		PositionalReadStream{ readAt, localHeaderOffset, localHeaderOffset + sizeof header }.ReadBytes(header, sizeof header);
+
+		const auto signature = static_cast<nuInt>(header[0]) | static_cast<nuInt>(header[1]) << 8 | static_cast<nuInt>(header[2]) << 16 | static_cast<nuInt>(header[3]) << 24;
+		const auto filenameLength = static_cast<nuShort>(header[LocalFileHeader::OffsetToFilenameLength] | header[LocalFileHeader::OffsetToFilenameLength + 1] << 8);
+		const auto extraFieldLength = static_cast<nuShort>(header[LocalFileHeader::OffsetToFilenameLength + 2] | header[LocalFileHeader::OffsetToFilenameLength + 3] << 8);
+		const auto offset = localHeaderOffset + sizeof header + filenameLength + extraFieldLength;
+		if (signature != LocalFileHeader::Signature || offset + entry->m_CentralDirectoryFileHeader.CompressedSize > streamSize)
+		{
+			nat_Throw(InvalidData);
+		}
+
+		entry->m_OffsetOfCompressedData = offset;
+	}
+
+	const auto realThreadCount = threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	// 线程池析构时会等待所有工作完成，因此需在readAt之后构造，保证发生异常时工作不会访问已析构的对象
+	natThreadPool threadPool{ 0, realThreadCount };
+	std::deque<std::future<natThreadPool::WorkToken>> pendingWorks;
+	nLen extractedCount = 0;
+
+	for (const auto entry : entries)
+	{
+		auto sink = sinkFactory(*entry);
+		if (!sink)
+		{
+			continue;
+		}
+
+		// 限制排队的工作数量，避免同时打开过多的输出流
+		if (pendingWorks.size() >= realThreadCount * 2)
+		{
+			pendingWorks.front().get().GetResult().get();
+			pendingWorks.pop_front();
+		}
+
+		pendingWorks.emplace_back(threadPool.QueueWork([entry, sink = std::move(sink), &readAt](void*)
+		{
+			const auto offset = entry->m_OffsetOfCompressedData.value();
+			const auto decompressor = entry->createDecompressor(make_ref<PositionalReadStream>(readAt, offset, offset + entry->m_CentralDirectoryFileHeader.CompressedSize));
+			decompressor->CopyTo(sink);
+			return static_cast<nuInt>(NatErr_OK);
+		}));
+		++extractedCount;
+	}
+
+	// 等待剩余的工作完成，同时重新抛出解压时发生的异常
+	while (!pendingWorks.empty())
+	{
+		pendingWorks.front().get().GetResult().get();
+		pendingWorks.pop_front();
+	}
+
+	return extractedCount;
+}
+
 void natZipArchive::addEntry(natRefPointer<ZipEntry> entry)
 {
 	m_EntriesMap.emplace(entry->m_CentralDirectoryFileHeader.Filename, std::move(entry));
@@ -573,6 +1058,8 @@ void natZipArchive::close()
 	case ZipArchiveMode::Create:
 	case ZipArchiveMode::Update:
 		writeToFile();
+		// 确保后台写入的错误能被发现
+		m_Stream->Flush();
 		break;
 	case ZipArchiveMode::Read:
 	default:
@@ -583,38 +1070,140 @@ void natZipArchive::close()
 
 void natZipArchive::writeToFile()
 {
-	if (m_Mode == ZipArchiveMode::Update)
+	// 需要写入本地文件头及数据的入口
+	std::vector<ZipEntry*> entries;
+	entries.reserve(m_EntriesMap.size());
+
+	if (m_Mode == ZipArchiveMode::Update && m_UpdateStrategy == UpdateStrategy::Append)
 	{
+		// 未修改的入口保持原样，其他入口写入到最后一个未修改的入口之后
+		ZipEntry* lastUnchangedEntry = nullptr;
 		for (auto&& entryPair : m_EntriesMap)
 		{
-			entryPair.second->loadExtraFieldAndCompressedData();
+			const auto& entry = entryPair.second;
+			if (entry->m_OriginallyInArchive && !entry->m_EverOpenedForWrite)
+			{
+				if (!lastUnchangedEntry || entry->m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader > lastUnchangedEntry->m_CentralDirectoryFileHeader.RelativeOffsetOfLocalHeader)
+				{
+					lastUnchangedEntry = entry.Get();
+				}
+				continue;
+			}
+
+			// 被修改的入口的数据已被缓存，此处只读取其本地文件头中的附加字段
+			entry->loadExtraFieldAndCompressedData();
+			entries.emplace_back(entry.Get());
 		}
 
-		m_Stream->SetPosition(NatSeek::Beg, 0);
-		m_Stream->SetSize(0);
+		m_Stream->SetPosition(NatSeek::Beg, lastUnchangedEntry ? lastUnchangedEntry->getEndOfCompressedData() : 0);
 	}
+	else
+	{
+		if (m_Mode == ZipArchiveMode::Update)
+		{
+			for (auto&& entryPair : m_EntriesMap)
+			{
+				entryPair.second->loadExtraFieldAndCompressedData();
+			}
 
-	for (auto&& entryPair : m_EntriesMap)
+			m_Stream->SetPosition(NatSeek::Beg, 0);
+			m_Stream->SetSize(0);
+		}
+
+		for (auto&& entryPair : m_EntriesMap)
+		{
+			entries.emplace_back(entryPair.second.Get());
+		}
+	}
+
+	std::vector<Optional<nLen>> compressionSizes;
+	compressionSizes.reserve(entries.size());
+	for (const auto entry : entries)
 	{
-		entryPair.second->writeLocalFileHeaderAndData();
+		// 需要压缩的入口记录其未压缩数据的大小
+		compressionSizes.emplace_back();
+		if (entry->m_UncompressedData)
+		{
+			compressionSizes.back().emplace(entry->m_UncompressedData->GetSize());
+		}
 	}
 
+	// 需要压缩的入口在线程池中提前并行压缩，之后仍按顺序写入
+	// 同时压缩的入口数量及未压缩数据总量均有上限，但总是允许至少一个入口正在压缩
+	const auto threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	std::unique_ptr<natThreadPool> threadPool;
+	std::deque<std::future<natThreadPool::WorkToken>> pendingWorks;
+	nLen pendingBytes = 0;
+	size_t submitIndex = 0;
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		for (; submitIndex < entries.size(); ++submitIndex)
+		{
+			const auto& size = compressionSizes[submitIndex];
+			if (!size)
+			{
+				continue;
+			}
+			if (!pendingWorks.empty() && (pendingWorks.size() >= threadCount * 2 || pendingBytes + size.value() > ParallelCompressionMemoryLimit))
+			{
+				break;
+			}
+
+			if (!threadPool)
+			{
+				threadPool = std::make_unique<natThreadPool>(0, threadCount);
+			}
+
+			const auto entry = entries[submitIndex];
+			pendingWorks.emplace_back(threadPool->QueueWork([entry](void*)
+			{
+				entry->compressUncompressedData();
+				return static_cast<nuInt>(NatErr_OK);
+			}));
+			pendingBytes += size.value();
+		}
+
+		if (compressionSizes[i])
+		{
+			assert(!pendingWorks.empty());
+			// 等待压缩完成，同时重新抛出压缩时发生的异常
+			pendingWorks.front().get().GetResult().get();
+			pendingWorks.pop_front();
+			pendingBytes -= compressionSizes[i].value();
+		}
+
+		entries[i]->writeLocalFileHeaderAndData();
+	}
+
+	// 中央目录由大量小字段组成，先在内存中生成后一次写入
+	const auto centralDirectory = make_ref<natMemoryStream>(0, false, true, true);
+	const auto centralDirectoryWriter = make_ref<natBinaryWriter>(centralDirectory, Environment::Endianness::LittleEndian);
+
 	const auto startOfCentralDirectory = m_Stream->GetPosition();
 	for (auto&& entryPair : m_EntriesMap)
 	{
-		entryPair.second->m_CentralDirectoryFileHeader.Write(m_Writer, m_Encoding);
+		entryPair.second->m_CentralDirectoryFileHeader.Write(centralDirectoryWriter, m_Encoding);
 	}
-	const auto endOfCentralDirectory = m_Stream->GetPosition();
-	const auto sizeOfCentralDirectory = endOfCentralDirectory - startOfCentralDirectory;
+	const auto sizeOfCentralDirectory = centralDirectory->GetSize();
+	const auto endOfCentralDirectory = startOfCentralDirectory + sizeOfCentralDirectory;
 
 	if (startOfCentralDirectory >= std::numeric_limits<nuInt>::max() || sizeOfCentralDirectory >= std::numeric_limits<nuInt>::max() || m_EntriesMap.size() > std::numeric_limits<nuShort>::max())
 	{
 		const auto zip64EOCDRecordStart = endOfCentralDirectory;
-		Zip64EndOfCentralDirectory::Write(m_Writer, m_EntriesMap.size(), startOfCentralDirectory, sizeOfCentralDirectory);
-		Zip64EndOfCentralDirectoryLocator::Write(m_Writer, zip64EOCDRecordStart);
+		Zip64EndOfCentralDirectory::Write(centralDirectoryWriter, m_EntriesMap.size(), startOfCentralDirectory, sizeOfCentralDirectory);
+		Zip64EndOfCentralDirectoryLocator::Write(centralDirectoryWriter, zip64EOCDRecordStart);
 	}
 
-	ZipEndOfCentralDirectory::Write(m_Writer, m_EntriesMap.size(), startOfCentralDirectory, sizeOfCentralDirectory, m_ZipEndOfCentralDirectory.ArchiveComment, m_Encoding);
+	ZipEndOfCentralDirectory::Write(centralDirectoryWriter, m_EntriesMap.size(), startOfCentralDirectory, sizeOfCentralDirectory, m_ZipEndOfCentralDirectory.ArchiveComment, m_Encoding);
+
+	m_Stream->WriteBytes(centralDirectory->GetInternalBuffer(), centralDirectory->GetSize());
+
+	// 追加更新后的文档可能比原文档短，需要移除原中央目录的剩余部分
+	if (m_Mode == ZipArchiveMode::Update && m_Stream->GetSize() > m_Stream->GetPosition())
+	{
+		m_Stream->SetSize(m_Stream->GetPosition());
+	}
 }
 
 void natZipArchive::ExtraField::Read(natRefPointer<natBinaryReader> reader)
@@ -739,6 +1328,7 @@ void natZipArchive::Zip64ExtraField::Write(natRefPointer<natBinaryWriter> writer
 {
 	constexpr auto tag = Tag;
 
+	Size = static_cast<nuShort>(GetSize() - OffsetToFirstField);
 	writer->WritePod(tag);
 	writer->WritePod(Size);
 	if (UncompressedSize)
@@ -759,6 +1349,11 @@ void natZipArchive::Zip64ExtraField::Write(natRefPointer<natBinaryWriter> writer
 	}
 }
 
+size_t natZipArchive::Zip64ExtraField::GetSize() const noexcept
+{
+	return OffsetToFirstField + (UncompressedSize ? sizeof(nuLong) : 0) + (CompressedSize ? sizeof(nuLong) : 0) + (LocalHeaderOffset ? sizeof(nuLong) : 0) + (StartDiskNumber ? sizeof(nuInt) : 0);
+}
+
 nBool natZipArchive::CentralDirectoryFileHeader::Read(natRefPointer<natBinaryReader> reader, nBool saveExtraFieldsAndComments, StringType encoding)
 {
 	if (reader->ReadPod<nuInt>() != Signature)
@@ -914,6 +1509,23 @@ void natZipArchive::CentralDirectoryFileHeader::Write(natRefPointer<natBinaryWri
 		zip64ExtraField.LocalHeaderOffset = RelativeOffsetOfLocalHeader;
 	}
 
+	// 附加字段长度需与实际写入的附加字段相符
+	auto extraFieldLength = needZip64 ? zip64ExtraField.GetSize() : 0;
+	for (auto&& item : ExtraFields)
+	{
+		extraFieldLength += item.GetSize();
+	}
+	if (extraFieldLength > std::numeric_limits<nuShort>::max())
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "Extra fields are too long."_nv);
+	}
+	ExtraFieldLength = static_cast<nuShort>(extraFieldLength);
+
+	if (needZip64 && VersionNeededToExtract < static_cast<nuShort>(ZipVersionNeeded::Zip64))
+	{
+		VersionNeededToExtract = static_cast<nuShort>(ZipVersionNeeded::Zip64);
+	}
+
 	writer->WritePod(signature);
 	writer->WritePod(VersionMadeBySpecification);
 	writer->WritePod(VersionMadeByCompatibility);
@@ -1003,6 +1615,14 @@ nBool natZipArchive::LocalFileHeader::Write(natRefPointer<natBinaryWriter> write
 	auto needZip64 = false;
 	Zip64ExtraField zip64ExtraField;
 
+	if (fileHeader.GeneralPurposeBitFlag & static_cast<nuShort>(ZipEntry::BitFlag::DataDescriptor))
+	{
+		// 大小在写入数据前未知，写入占位的Zip64附加字段，表示数据描述符中的大小为8字节
+		needZip64 = true;
+		zip64ExtraField.CompressedSize = 0;
+		zip64ExtraField.UncompressedSize = 0;
+	}
+
 	if (fileHeader.CompressedSize > std::numeric_limits<nuInt>::max())
 	{
 		needZip64 = true;
@@ -1015,6 +1635,24 @@ nBool natZipArchive::LocalFileHeader::Write(natRefPointer<natBinaryWriter> write
 		zip64ExtraField.UncompressedSize = fileHeader.UncompressedSize;
 	}
 
+	if (needZip64 && fileHeader.VersionNeededToExtract < static_cast<nuShort>(ZipVersionNeeded::Zip64))
+	{
+		fileHeader.VersionNeededToExtract = static_cast<nuShort>(ZipVersionNeeded::Zip64);
+	}
+
+	auto extraFieldLength = needZip64 ? zip64ExtraField.GetSize() : 0;
+	if (localFileHeaderFields)
+	{
+		for (auto&& item : localFileHeaderFields.value())
+		{
+			extraFieldLength += item.GetSize();
+		}
+	}
+	if (extraFieldLength > std::numeric_limits<nuShort>::max())
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "Extra fields are too long."_nv);
+	}
+
 	writer->WritePod(signature);
 	writer->WritePod(fileHeader.VersionNeededToExtract);
 	writer->WritePod(fileHeader.GeneralPurposeBitFlag);
@@ -1024,7 +1662,7 @@ nBool natZipArchive::LocalFileHeader::Write(natRefPointer<natBinaryWriter> write
 	writer->WritePod(zip64ExtraField.CompressedSize ? Mask32Bit : static_cast<nuInt>(fileHeader.CompressedSize));
 	writer->WritePod(zip64ExtraField.UncompressedSize ? Mask32Bit : static_cast<nuInt>(fileHeader.UncompressedSize));
 	writer->WritePod(fileHeader.FilenameLength);
-	writer->WritePod(fileHeader.ExtraFieldLength);
+	writer->WritePod(static_cast<nuShort>(extraFieldLength));
 	stream->WriteBytes(filenameBytes.data(), filenameBytes.size());
 
 	if (needZip64)
@@ -1069,6 +1707,17 @@ void natZipArchive::LocalFileHeader::WriteCrcAndSizes(natRefPointer<natBinaryWri
 	stream->SetPosition(NatSeek::Beg, dataEndPosition);
 }
 
+void natZipArchive::LocalFileHeader::WriteDataDescriptor(natRefPointer<natBinaryWriter> writer, CentralDirectoryFileHeader const& header)
+{
+	constexpr auto signature = DataDescriptorSignature;
+
+	// 使用数据描述符的入口的本地文件头总是包含Zip64附加字段，大小总是8字节
+	writer->WritePod(signature);
+	writer->WritePod(header.Crc32);
+	writer->WritePod(header.CompressedSize);
+	writer->WritePod(header.UncompressedSize);
+}
+
 void natZipArchive::ZipEndOfCentralDirectory::Read(natRefPointer<natBinaryReader> reader, StringType encoding)
 {
 	const auto stream = reader->GetUnderlyingStream();
@@ -1219,7 +1868,14 @@ void natZipArchive::internalOpen()
 		break;
 	case ZipArchiveMode::Read:
 		readEndOfCentralDirectory();
-		readCentralDirectory();
+		if (m_CompactIndex)
+		{
+			readCentralDirectoryIndex();
+		}
+		else
+		{
+			readCentralDirectory();
+		}
 		break;
 	case ZipArchiveMode::Update:
 	default:
@@ -1247,112 +1903,344 @@ void natZipArchive::readCentralDirectory()
 		++entriesCount;
 	}
 
-	if (entriesCount != m_ZipEndOfCentralDirectory.NumberOfEntriesInTheCentralDirectory)
+	// 入口数超过65535时EOCD中仅记录0xFFFF，实际数量需从Zip64 EOCD获得
+	const auto expectedEntriesCount = m_Zip64EndOfCentralDirectory.OffsetOfCentralDirectory ? m_Zip64EndOfCentralDirectory.NumberOfEntriesTotal : m_ZipEndOfCentralDirectory.NumberOfEntriesInTheCentralDirectory;
+	if (entriesCount != expectedEntriesCount)
 	{
 		nat_Throw(InvalidData, "Number of entries is wrong."_nv);
 	}
 }
 
+void natZipArchive::readCentralDirectoryIndex()
+{
+	const auto isZip64 = m_Zip64EndOfCentralDirectory.OffsetOfCentralDirectory != 0;
+	const nuLong offsetOfCentralDirectory = isZip64 ? m_Zip64EndOfCentralDirectory.OffsetOfCentralDirectory : m_ZipEndOfCentralDirectory.OffsetOfStartOfCentralDirectoryWithRespectToTheStartingDiskNumber;
+	const nuLong sizeOfCentralDirectory = isZip64 ? m_Zip64EndOfCentralDirectory.SizeOfCentralDirectory : m_ZipEndOfCentralDirectory.SizeOfTheCentralDirectory;
+	const nuLong expectedEntriesCount = isZip64 ? m_Zip64EndOfCentralDirectory.NumberOfEntriesTotal : m_ZipEndOfCentralDirectory.NumberOfEntriesInTheCentralDirectory;
+
+	if (offsetOfCentralDirectory + sizeOfCentralDirectory > m_Stream->GetSize())
+	{
+		nat_Throw(InvalidData, "Central directory is out of range."_nv);
+	}
+
+	// 整个中央目录一次读入内存后再解析，以内存为存储的流直接在其内存上解析
+	ncData data;
+	nLen dataSize;
+	std::vector<nByte> buffer;
+	if (natBinaryViewReader::TryGetMemory(m_Stream, data, dataSize))
+	{
+		data += offsetOfCentralDirectory;
+	}
+	else
+	{
+		buffer.resize(static_cast<size_t>(sizeOfCentralDirectory));
+		m_Stream->SetPosition(NatSeek::Beg, offsetOfCentralDirectory);
+		nLen readBytes = 0;
+		while (readBytes < buffer.size())
+		{
+			const auto ret = m_Stream->ReadBytes(buffer.data() + readBytes, buffer.size() - readBytes);
+			if (!ret)
+			{
+				nat_Throw(InvalidData, "Cannot read central directory."_nv);
+			}
+			readBytes += ret;
+		}
+		data = buffer.data();
+	}
+
+	natBinaryViewReader view{ data, sizeOfCentralDirectory, Environment::Endianness::LittleEndian };
+
+	// 中央目录文件头最少为46字节，避免以损坏的入口数预留过多的内存
+	constexpr nuLong minimumSizeOfHeader = 46;
+	m_IndexRecords.reserve(static_cast<size_t>(std::min(expectedEntriesCount, sizeOfCentralDirectory / minimumSizeOfHeader)));
+
+	while (view.GetRemainedSize() >= sizeof(nuInt) && view.PeekPod<nuInt>(view.GetPosition()) == CentralDirectoryFileHeader::Signature)
+	{
+		IndexRecord record;
+
+		view.Skip(sizeof(nuInt) + 2);
+		record.VersionNeededToExtract = view.ReadPod<nuShort>();
+		record.GeneralPurposeBitFlag = view.ReadPod<nuShort>();
+		record.CompressionMethod = view.ReadPod<nuShort>();
+		record.LastModified = view.ReadPod<nuInt>();
+		record.Crc32 = view.ReadPod<nuInt>();
+		const auto compressedSizeSmall = view.ReadPod<nuInt>();
+		const auto uncompressedSizeSmall = view.ReadPod<nuInt>();
+		const auto filenameLength = view.ReadPod<nuShort>();
+		const auto extraFieldLength = view.ReadPod<nuShort>();
+		const auto fileCommentLength = view.ReadPod<nuShort>();
+		const auto diskNumberStartSmall = view.ReadPod<nuShort>();
+		view.Skip(6);
+		const auto relativeOffsetOfLocalHeaderSmall = view.ReadPod<nuInt>();
+		const auto filename = view.ReadBytes(filenameLength);
+		auto extraFields = view.ReadView(extraFieldLength);
+		view.Skip(fileCommentLength);
+
+		record.CompressedSize = compressedSizeSmall;
+		record.UncompressedSize = uncompressedSizeSmall;
+		record.RelativeOffsetOfLocalHeader = relativeOffsetOfLocalHeaderSmall;
+
+		const auto uncompressedSizeInZip64 = uncompressedSizeSmall == Mask32Bit;
+		const auto compressedSizeInZip64 = compressedSizeSmall == Mask32Bit;
+		const auto relativeOffsetInZip64 = relativeOffsetOfLocalHeaderSmall == Mask32Bit;
+		const auto diskNumberStartInZip64 = diskNumberStartSmall == Mask16Bit;
+
+		// 与Zip64ExtraField::ReadFromExtraField相同，仅接受大小与需要读取的字段相符的Zip64附加字段
+		const nuShort expectedZip64FieldSize = (uncompressedSizeInZip64 ? 8 : 0) + (compressedSizeInZip64 ? 8 : 0) + (relativeOffsetInZip64 ? 8 : 0) + (diskNumberStartInZip64 ? 4 : 0);
+		while (expectedZip64FieldSize && extraFields.GetRemainedSize() >= ExtraField::HeaderSize)
+		{
+			const auto tag = extraFields.ReadPod<nuShort>();
+			const auto fieldSize = extraFields.ReadPod<nuShort>();
+			if (fieldSize > extraFields.GetRemainedSize())
+			{
+				break;
+			}
+
+			auto field = extraFields.ReadView(fieldSize);
+			if (tag == Zip64ExtraField::Tag && fieldSize == expectedZip64FieldSize)
+			{
+				if (uncompressedSizeInZip64)
+				{
+					record.UncompressedSize = field.ReadPod<nuLong>();
+				}
+				if (compressedSizeInZip64)
+				{
+					record.CompressedSize = field.ReadPod<nuLong>();
+				}
+				if (relativeOffsetInZip64)
+				{
+					record.RelativeOffsetOfLocalHeader = field.ReadPod<nuLong>();
+				}
+				break;
+			}
+		}
+
+		if (record.UncompressedSize > static_cast<nuLong>(std::numeric_limits<nLong>::max())
+			|| record.CompressedSize > static_cast<nuLong>(std::numeric_limits<nLong>::max())
+			|| record.RelativeOffsetOfLocalHeader > static_cast<nuLong>(std::numeric_limits<nLong>::max()))
+		{
+			nat_Throw(InvalidData, "Size or offset of entry is too big."_nv);
+		}
+
+		record.NameOffset = m_IndexNames.size();
+		if (m_Encoding == nString::UsingStringType)
+		{
+			const auto name = reinterpret_cast<const nString::CharType*>(filename);
+			m_IndexNames.insert(m_IndexNames.end(), name, name + filenameLength);
+		}
+		else
+		{
+			const auto name = CurrentUsingRuntimeEncoding::Encode(filename, filenameLength, m_Encoding);
+			m_IndexNames.insert(m_IndexNames.end(), name.data(), name.data() + name.size());
+		}
+		record.NameLength = static_cast<nuInt>(m_IndexNames.size() - record.NameOffset);
+
+		m_IndexRecords.emplace_back(record);
+	}
+
+	if (m_IndexRecords.size() != expectedEntriesCount || m_IndexRecords.size() > std::numeric_limits<nuInt>::max())
+	{
+		nat_Throw(InvalidData, "Number of entries is wrong."_nv);
+	}
+
+	m_SortedIndex.resize(m_IndexRecords.size());
+	for (size_t i = 0; i < m_SortedIndex.size(); ++i)
+	{
+		m_SortedIndex[i] = static_cast<nuInt>(i);
+	}
+	// 名称相同时保持中央目录中的顺序
+	std::sort(m_SortedIndex.begin(), m_SortedIndex.end(), [this](nuInt a, nuInt b)
+	{
+		const auto result = getIndexedName(a).Compare(getIndexedName(b));
+		return result < 0 || (result == 0 && a < b);
+	});
+
+	m_IndexedEntries.resize(m_IndexRecords.size());
+}
+
 void natZipArchive::readEndOfCentralDirectory()
 {
-	m_Stream->SetPosition(NatSeek::End, -static_cast<nLong>(ZipEndOfCentralDirectory::SizeOfBlockWithoutSignature));
-	if (!findSignatureBackward(m_Stream, ZipEndOfCentralDirectory::Signature))
+	constexpr nLen sizeOfEndOfCentralDirectory = sizeof(nuInt) + ZipEndOfCentralDirectory::SizeOfBlockWithoutSignature;
+	constexpr nLen sizeOfLocator = sizeof(nuInt) + Zip64EndOfCentralDirectoryLocator::SizeOfBlockWithoutSignature;
+	constexpr nLen sizeOfZip64EndOfCentralDirectory = sizeof(nuInt) + sizeof(nuLong) + Zip64EndOfCentralDirectory::SizeWithoutExtraData;
+
+	const auto streamSize = m_Stream->GetSize();
+	if (streamSize < sizeOfEndOfCentralDirectory)
 	{
 		nat_Throw(InvalidData, "Cannot find EOCD signature."_nv);
 	}
 
-	const auto eocdPosition = m_Stream->GetPosition();
+	// 一次读入可能包含EOCD（含最长的注释）、Zip64 EOCD定位符及Zip64 EOCD的尾部
+	const auto tailSize = std::min(streamSize, sizeOfZip64EndOfCentralDirectory + sizeOfLocator + sizeOfEndOfCentralDirectory + Mask16Bit);
+	const auto tailStart = streamSize - tailSize;
+
+	ncData tail;
+	nLen memorySize;
+	std::vector<nByte> tailBuffer;
+	if (natBinaryViewReader::TryGetMemory(m_Stream, tail, memorySize) && memorySize == streamSize)
+	{
+		tail += tailStart;
+	}
+	else
+	{
+		tailBuffer.resize(static_cast<size_t>(tailSize));
+		m_Stream->SetPosition(NatSeek::Beg, static_cast<nLong>(tailStart));
+		nLen readBytes = 0;
+		while (readBytes < tailSize)
+		{
+			const auto currentReadBytes = m_Stream->ReadBytes(tailBuffer.data() + readBytes, tailSize - readBytes);
+			if (!currentReadBytes)
+			{
+				nat_Throw(InvalidData, "Unexpected end of stream."_nv);
+			}
+			readBytes += currentReadBytes;
+		}
+		tail = tailBuffer.data();
+	}
+
+	const auto eocdPositionInTail = findEndOfCentralDirectory(tail, tailSize, tailStart);
+	if (!eocdPositionInTail)
+	{
+		nat_Throw(InvalidData, "Cannot find EOCD signature."_nv);
+	}
 
-	m_ZipEndOfCentralDirectory.Read(m_Reader, m_Encoding);
+	const auto eocdPosition = eocdPositionInTail.value();
+	const auto tailStream = make_ref<natExternMemoryStream>(tail, tailSize, true);
+	const auto tailReader = make_ref<natBinaryReader>(tailStream, Environment::Endianness::LittleEndian);
+	tailStream->SetPosition(NatSeek::Beg, static_cast<nLong>(eocdPosition));
+	m_ZipEndOfCentralDirectory.Read(tailReader, m_Encoding);
 
 	if (m_ZipEndOfCentralDirectory.NumberOfThisDisk == Mask16Bit
 		|| m_ZipEndOfCentralDirectory.OffsetOfStartOfCentralDirectoryWithRespectToTheStartingDiskNumber == Mask32Bit
 		|| m_ZipEndOfCentralDirectory.NumberOfEntriesInTheCentralDirectory == Mask16Bit)
 	{
-		m_Stream->SetPosition(NatSeek::Beg, eocdPosition - Zip64EndOfCentralDirectoryLocator::SizeOfBlockWithoutSignature);
-
-		if (findSignatureBackward(m_Stream, Zip64EndOfCentralDirectoryLocator::Signature))
+		// Zip64 EOCD定位符紧邻EOCD，由于读入了足够的数据，定位符若存在必然在tail中
+		if (eocdPosition < sizeOfLocator || natBinaryViewReader{ tail, tailSize, Environment::Endianness::LittleEndian }.PeekPod<nuInt>(eocdPosition - sizeOfLocator) != Zip64EndOfCentralDirectoryLocator::Signature)
 		{
-			m_Zip64EndOfCentralDirectoryLocator.Read(m_Reader);
+			return;
+		}
 
-			if (m_Zip64EndOfCentralDirectoryLocator.OffsetOfZip64EOCD > static_cast<nuLong>(std::numeric_limits<nLong>::max()))
-			{
-				nat_Throw(InvalidData, "OffsetOfZip64EOCD is too big."_nv);
-			}
+		tailStream->SetPosition(NatSeek::Beg, static_cast<nLong>(eocdPosition - sizeOfLocator));
+		m_Zip64EndOfCentralDirectoryLocator.Read(tailReader);
 
-			m_Stream->SetPosition(NatSeek::Beg, static_cast<nLong>(m_Zip64EndOfCentralDirectoryLocator.OffsetOfZip64EOCD));
+		const auto zip64EOCDOffset = m_Zip64EndOfCentralDirectoryLocator.OffsetOfZip64EOCD;
+		if (zip64EOCDOffset > tailStart + eocdPosition - sizeOfLocator || tailStart + eocdPosition - sizeOfLocator - zip64EOCDOffset < sizeOfZip64EndOfCentralDirectory)
+		{
+			nat_Throw(InvalidData, "OffsetOfZip64EOCD is invalid."_nv);
+		}
 
+		// 通常Zip64 EOCD紧邻定位符，已在tail中，否则需要再次读取
+		if (zip64EOCDOffset >= tailStart)
+		{
+			tailStream->SetPosition(NatSeek::Beg, static_cast<nLong>(zip64EOCDOffset - tailStart));
+			m_Zip64EndOfCentralDirectory.Read(tailReader);
+		}
+		else
+		{
+			m_Stream->SetPosition(NatSeek::Beg, static_cast<nLong>(zip64EOCDOffset));
 			m_Zip64EndOfCentralDirectory.Read(m_Reader);
 		}
 	}
 }
 
+nStrView natZipArchive::getIndexedName(nuInt index) const noexcept
+{
+	const auto& record = m_IndexRecords[index];
+	return { m_IndexNames.data() + record.NameOffset, static_cast<size_t>(record.NameLength) };
+}
+
+natRefPointer<natZipArchive::ZipEntry> const& natZipArchive::getIndexedEntry(nuInt index) const
+{
+	auto& entry = m_IndexedEntries[index];
+	if (!entry)
+	{
+		const auto& record = m_IndexRecords[index];
+
+		CentralDirectoryFileHeader header{};
+		header.VersionNeededToExtract = record.VersionNeededToExtract;
+		header.GeneralPurposeBitFlag = record.GeneralPurposeBitFlag;
+		header.CompressionMethod = record.CompressionMethod;
+		header.LastModified = record.LastModified;
+		header.Crc32 = record.Crc32;
+		header.CompressedSize = record.CompressedSize;
+		header.UncompressedSize = record.UncompressedSize;
+		header.RelativeOffsetOfLocalHeader = record.RelativeOffsetOfLocalHeader;
+		header.Filename = getIndexedName(index);
+
+		// 入口仅能读取，不会通过m_Archive修改文档
+		auto pEntry = new ZipEntry(const_cast<natZipArchive*>(this), header);
+		pEntry->SetDeleter();
+		entry = natRefPointer<ZipEntry>{ pEntry };
+		SafeRelease(pEntry);
+	}
+
+	return entry;
+}
+
 void natZipArchive::removeEntry(ZipEntry* entry)
 {
 	m_EntriesMap.erase(entry->m_CentralDirectoryFileHeader.Filename);
 }
 
-nBool natZipArchive::findSignatureBackward(natRefPointer<natStream> stream, nuInt signature)
+Optional<nLen> natZipArchive::findEndOfCentralDirectory(ncData tail, nLen tailSize, nLen tailStart)
 {
-	const auto pStream = stream;
-	const auto signatureToFind = signature;
-	nuInt currentSignature{};
+	constexpr nLen sizeOfEndOfCentralDirectory = sizeof(nuInt) + ZipEndOfCentralDirectory::SizeOfBlockWithoutSignature;
+	constexpr nLen offsetToSizeOfCentralDirectory = 12;
+	constexpr nLen offsetToCommentLength = 20;
 
-	nByte findingBuffer[FindingBufferSize];
-	size_t bufferIndex;
+	if (tailSize < sizeOfEndOfCentralDirectory)
+	{
+		return {};
+	}
 
-	auto signatureFound = false, streamReachBegin = false;
+	const natBinaryViewReader view{ tail, tailSize, Environment::Endianness::LittleEndian };
+	const auto lastPosition = tailSize - sizeOfEndOfCentralDirectory;
 
-	while (!signatureFound && !streamReachBegin)
+	// 注释需恰好位于tail内，且中央目录需位于EOCD之前，用于排除注释或数据中偶然出现的签名
+	const auto isValidEndOfCentralDirectory = [&](nLen position)
 	{
-		std::tie(streamReachBegin, bufferIndex) = readStreamBackward(pStream, findingBuffer, sizeof findingBuffer);
-		assert(bufferIndex < sizeof findingBuffer);
-		while (!signatureFound)
+		if (view.PeekPod<nuInt>(position) != ZipEndOfCentralDirectory::Signature)
 		{
-			currentSignature = (currentSignature << 8) | static_cast<nuInt>(findingBuffer[bufferIndex]);
-			if (currentSignature == signatureToFind)
-			{
-				signatureFound = true;
-			}
-			else
-			{
-				if (bufferIndex > 0)
-				{
-					--bufferIndex;
-				}
-				else
-				{
-					break;
-				}
-			}
+			return false;
 		}
-	}
 
-	if (signatureFound)
-	{
-		pStream->SetPosition(NatSeek::Cur, bufferIndex);
-		return true;
-	}
+		if (view.PeekPod<nuShort>(position + offsetToCommentLength) > lastPosition - position)
+		{
+			return false;
+		}
 
-	return false;
-}
+		const auto sizeOfCentralDirectory = view.PeekPod<nuInt>(position + offsetToSizeOfCentralDirectory);
+		const auto offsetOfCentralDirectory = view.PeekPod<nuInt>(position + offsetToSizeOfCentralDirectory + sizeof(nuInt));
+		return sizeOfCentralDirectory == Mask32Bit || offsetOfCentralDirectory == Mask32Bit ||
+			static_cast<nuLong>(sizeOfCentralDirectory) + offsetOfCentralDirectory <= tailStart + position;
+	};
 
-std::pair<nBool, size_t> natZipArchive::readStreamBackward(natRefPointer<natStream> stream, nData buffer, size_t bufferSize)
-{
-	const auto pStream = stream;
-	const auto bufSize = static_cast<nLong>(bufferSize);
+	// 没有注释时EOCD位于末尾
+	if (isValidEndOfCentralDirectory(lastPosition))
+	{
+		return lastPosition;
+	}
 
-	if (pStream->GetPosition() >= static_cast<nLen>(bufSize))
+	// 使用memchr查找签名的首字节，保留最后一个合法的EOCD
+	Optional<nLen> result;
+	constexpr auto firstByteOfSignature = static_cast<nByte>(ZipEndOfCentralDirectory::Signature & 0xFF);
+	auto current = tail;
+	const auto end = tail + lastPosition;
+	while (current < end)
 	{
-		pStream->SetPosition(NatSeek::Cur, -bufSize);
-		pStream->ReadBytes(buffer, bufSize);
-		pStream->SetPosition(NatSeek::Cur, -bufSize);
-		return { false, static_cast<size_t>(bufSize - 1) };
+		const auto found = static_cast<ncData>(std::memchr(current, firstByteOfSignature, static_cast<size_t>(end - current)));
+		if (!found)
+		{
+			break;
+		}
+
+		const auto position = static_cast<nLen>(found - tail);
+		if (isValidEndOfCentralDirectory(position))
+		{
+			result = position;
+		}
+		current = found + 1;
 	}
 
-	const auto readBytes = pStream->GetPosition();
-	pStream->SetPosition(NatSeek::Beg, 0);
-	pStream->ReadBytes(buffer, readBytes);
-	pStream->SetPosition(NatSeek::Beg, 0);
-	return { true, static_cast<size_t>(bufSize - 1) };
+	return result;
 }
@@ -20,7 +20,9 @@ namespace NatsuLib
 
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	Zip压缩文档
-	///	@note	不会进行缓存，如果提供的流不符合条件请自行进行缓存
+	///	@note	不会进行缓存，如果提供的流不符合条件请自行进行缓存\n
+	///			创建模式下可以使用不可定位的流（如管道），此时入口的Crc32及大小写入到数据之后的数据描述符中，
+	///			加密的入口由于需要先缓存全部数据，仍会在本地文件头中写入Crc32及大小
 	////////////////////////////////////////////////////////////////////////////////
 	class natZipArchive
 		: public natRefObjImpl<natZipArchive, natRefObj>
@@ -35,24 +37,67 @@ namespace NatsuLib
 			Update
 		};
 
-		explicit natZipArchive(natRefPointer<natStream> stream, ZipArchiveMode mode = ZipArchiveMode::Read);
-		natZipArchive(natRefPointer<natStream> stream, StringType encoding, ZipArchiveMode mode = ZipArchiveMode::Read);
+		///	@brief	更新模式下关闭文档时的更新策略
+		enum class UpdateStrategy
+		{
+			///	@brief	重写整个文档，会读取所有入口的数据，同时移除已删除及被修改的入口所占用的空间
+			Rewrite,
+			///	@brief	仅将新增及被修改的入口追加到最后一个未修改的入口之后并写入新的中央目录\n
+			///			未修改的入口不会被读取或复制，已删除及被修改的入口原先占用的空间不会被回收
+			Append,
+		};
+
+		///	@param	compactIndex	是否以紧凑索引读取中央目录，仅可用于ZipArchiveMode::Read，适用于入口数量巨大的文档
+		///	@note	紧凑索引以定长记录及连续的名称区保存中央目录，入口对象仅在被访问时创建并缓存，不保存入口的附加字段及注释
+		explicit natZipArchive(natRefPointer<natStream> stream, ZipArchiveMode mode = ZipArchiveMode::Read, nBool compactIndex = false);
+		natZipArchive(natRefPointer<natStream> stream, StringType encoding, ZipArchiveMode mode = ZipArchiveMode::Read, nBool compactIndex = false);
 		~natZipArchive();
 
 		ZipArchiveMode GetOpenMode() const noexcept;
 
+		///	@brief	设置更新模式下关闭文档时的更新策略，默认为UpdateStrategy::Rewrite
+		void SetUpdateStrategy(UpdateStrategy strategy) noexcept;
+		UpdateStrategy GetUpdateStrategy() const noexcept;
+
 		///	@brief	以特定的入口名创建入口
 		natRefPointer<ZipEntry> CreateEntry(nStrView entryName);
+		///	@brief	获得入口数
+		nLen GetEntryCount() const noexcept;
 		///	@brief	获得所有入口
+		///	@note	使用紧凑索引时将按中央目录中的顺序枚举，枚举到的入口才会被创建
 		Linq<const natRefPointer<ZipEntry>> GetEntries() const;
+		///	@brief	获得名称以prefix开头的所有入口
+		///	@remark	可用于列出目录（如"dir/"）下的所有入口
+		///	@note	使用紧凑索引时在有序的名称中查找，不需要遍历所有入口，结果按名称排序
+		Linq<const natRefPointer<ZipEntry>> GetEntriesWithPrefix(nStrView prefix) const;
 		///	@brief	以特定的入口名查找入口
 		///	@note	若未找到会返回nullptr，请务必对返回值进行检查
 		natRefPointer<ZipEntry> GetEntry(nStrView entryName) const;
 
+		///	@brief	入口筛选函数，返回true时解压该入口
+		typedef std::function<nBool(ZipEntry const&)> EntryPredicate;
+		///	@brief	为入口创建输出流，返回nullptr时跳过该入口
+		typedef std::function<natRefPointer<natStream>(ZipEntry const&)> SinkFactory;
+
+		///	@brief	并行解压所有入口
+		///	@see	ExtractTo
+		nLen ExtractAll(SinkFactory const& sinkFactory, nuInt threadCount = 0);
+		///	@brief	并行解压满足条件的入口
+		///	@param	predicate	筛选入口，为空时解压所有入口
+		///	@param	sinkFactory	为入口创建输出流，在调用者线程中按入口数据的位置依次调用
+		///	@param	threadCount	解压使用的线程数，为0时使用硬件线程数
+		///	@return	解压的入口数
+		///	@note	仅可在读取模式下使用，加密的入口需事先设置密码\n
+		///			解压前会一次性解析所有入口的数据位置并按位置顺序读取，\n
+		///			若文档的流为natFileStream将使用按位置读取，否则各线程对流的访问将被串行化\n
+		///			输出流在线程池中写入，不同入口的输出流可能被同时写入
+		nLen ExtractTo(EntryPredicate const& predicate, SinkFactory const& sinkFactory, nuInt threadCount = 0);
+
 	private:
-		enum
+		enum : nLen
 		{
-			FindingBufferSize = 32,
+			///	@brief	写入时并行压缩的入口的未压缩数据总量上限
+			ParallelCompressionMemoryLimit = 64 * 1024 * 1024,
 		};
 
 		enum class ZipVersionNeeded : nuShort
@@ -81,6 +126,32 @@ namespace NatsuLib
 
 		const StringType m_Encoding;
 		const ZipArchiveMode m_Mode;
+		UpdateStrategy m_UpdateStrategy;
+		// 输出流不可定位，需使用数据描述符而非回写本地文件头
+		nBool m_UseDataDescriptor;
+
+		// 紧凑索引中的定长记录，名称保存在m_IndexNames中
+		struct IndexRecord
+		{
+			nuLong RelativeOffsetOfLocalHeader;
+			nuLong CompressedSize;
+			nuLong UncompressedSize;
+			nuLong NameOffset;
+			nuInt NameLength;
+			nuInt Crc32;
+			nuInt LastModified;
+			nuShort VersionNeededToExtract;
+			nuShort GeneralPurposeBitFlag;
+			nuShort CompressionMethod;
+		};
+
+		const nBool m_CompactIndex;
+		std::vector<IndexRecord> m_IndexRecords;
+		std::vector<nString::CharType> m_IndexNames;
+		// 按名称排序的记录下标
+		std::vector<nuInt> m_SortedIndex;
+		// 已创建的入口，与m_IndexRecords一一对应
+		mutable std::vector<natRefPointer<ZipEntry>> m_IndexedEntries;
 
 		void addEntry(natRefPointer<ZipEntry> entry);
 		void close();
@@ -116,6 +187,9 @@ namespace NatsuLib
 
 			nBool ReadFromExtraField(ExtraField const& extraField, nBool readUncompressedSize, nBool readCompressedSize, nBool readLocalHeaderOffset, nBool readStartDiskNumber);
 			void Write(natRefPointer<natBinaryWriter> writer);
+
+			///	@brief	获得写入时的总大小（包含Tag及Size）
+			size_t GetSize() const noexcept;
 		};
 
 		struct CentralDirectoryFileHeader
@@ -160,6 +234,8 @@ namespace NatsuLib
 			// 实现提示：会修改header中的FilenameLength为实际写入的文件名长度
 			static nBool Write(natRefPointer<natBinaryWriter> writer, CentralDirectoryFileHeader& header, Optional<std::deque<ExtraField>> const& localFileHeaderFields, StringType encoding);
 			static void WriteCrcAndSizes(natRefPointer<natBinaryWriter> writer, CentralDirectoryFileHeader const& header, nBool usedZip64);
+			// 在当前位置写入数据描述符，大小超过32位时写入Zip64格式的数据描述符
+			static void WriteDataDescriptor(natRefPointer<natBinaryWriter> writer, CentralDirectoryFileHeader const& header);
 		};
 
 		struct ZipEndOfCentralDirectory
@@ -219,12 +295,16 @@ namespace NatsuLib
 
 		void internalOpen();
 		void readCentralDirectory();
+		void readCentralDirectoryIndex();
 		void readEndOfCentralDirectory();
 
+		nStrView getIndexedName(nuInt index) const noexcept;
+		natRefPointer<ZipEntry> const& getIndexedEntry(nuInt index) const;
+
 		void removeEntry(ZipEntry* entry);
 
-		static nBool findSignatureBackward(natRefPointer<natStream> stream, nuInt signature);
-		static std::pair<nBool, size_t> readStreamBackward(natRefPointer<natStream> stream, nData buffer, size_t bufferSize);
+		// 在文档尾部tail（位于文档的tailStart处）中查找最后一个合法的EOCD，返回其在tail中的位置
+		static Optional<nLen> findEndOfCentralDirectory(ncData tail, nLen tailSize, nLen tailStart);
 
 	public:
 		////////////////////////////////////////////////////////////////////////////////
@@ -254,6 +334,15 @@ namespace NatsuLib
 			void Delete();
 			///	@brief	打开入口并返回流
 			natRefPointer<natStream> Open();
+			///	@brief	尝试直接获得未压缩入口的数据
+			///	@param	data	成功时为指向入口数据的指针
+			///	@param	size	成功时为入口数据的大小
+			///	@return	是否成功
+			///	@note	仅当入口以Stored方式存储、未加密、未被修改，且文档的流以内存为存储（参见natBinaryViewReader::TryGetMemory）时成功，\n
+			///			对于文件可以使用natFileStream::MapToMemoryStream的结果打开文档\n
+			///			不会复制数据、访问文档的流或修改入口的状态，因此可以在多个线程中同时调用
+			///	@warning	返回的指针仅在文档及其流存活期间有效，更新模式下关闭文档后将失效
+			nBool TryGetStoredData(ncData& data, nLen& size) const;
 
 			void SetPassword();
 			void SetPassword(ncData password, size_t passwordLength);
@@ -317,17 +406,26 @@ namespace NatsuLib
 			natRefPointer<natStream> m_UncompressedData;
 			// 在更新模式且入口未由于写入而加载时缓存原文件内容，在写入模式无作用
 			Optional<std::vector<nByte>> m_CachedCompressedData;
+			// 写入前在线程池中压缩（及加密）m_UncompressedData得到的数据
+			natRefPointer<natStream> m_CompressedData;
 
 			natRefPointer<natCryptoStream> m_CryptoStream;
 
 			ZipEntry(natZipArchive* archive, nStrView const& entryName);
 			ZipEntry(natZipArchive* archive, CentralDirectoryFileHeader const& centralDirectoryFileHeader);
 
-			natRefPointer<natStream> openForRead();
+			///	@param	prefetch	是否预读压缩数据，仅当读取期间不会有其他入口访问归档流时可以使用
+			natRefPointer<natStream> openForRead(nBool prefetch = false);
+			// 以compressedStream为压缩数据（可能已加密）创建解压流
+			natRefPointer<natStream> createDecompressor(natRefPointer<natStream> compressedStream);
 			natRefPointer<natStream> openForCreate();
 			natRefPointer<natStream> openForUpdate();
 
 			nLen getOffsetOfCompressedData();
+			// 获得原压缩数据（包括数据描述符）的结束位置
+			nLen getEndOfCompressedData();
+			// 原本地文件头是否包含Zip64附加字段，此时数据描述符中的大小为8字节
+			nBool localHeaderHasZip64ExtraField();
 
 			// 获得未压缩数据，仅在更新模式使用
 			natRefPointer<natStream> const& getUncompressedData();
@@ -335,6 +433,8 @@ namespace NatsuLib
 			natRefPointer<natStream> createCompressor(natRefPointer<natStream> stream);
 
 			void loadExtraFieldAndCompressedData();
+			// 将m_UncompressedData压缩到m_CompressedData并更新Crc32及大小，不访问归档流，可对不同的入口并行调用
+			void compressUncompressedData();
 			void writeLocalFileHeaderAndData();
 
 			// 假设此时已经设置了m_CentralDirectoryFileHeader的Crc32为正确的值
@@ -370,6 +470,8 @@ namespace NatsuLib
 				nBool m_WroteData, m_UseZip64;
 				std::function<void(ZipEntryWriteStream&)> m_FinishCallback;
 
+				natRefPointer<natStream> getOutputStream() const;
+				void writeLocalFileHeader();
 				void finish();
 			};
 		};
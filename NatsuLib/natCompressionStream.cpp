@@ -1,9 +1,15 @@
 ﻿#include "stdafx.h"
 #include "natCompressionStream.h"
+#include "natMisc.h"
+#include "natCrc.h"
+#include "natBinary.h"
 #include <zlib.h>
 #include <zutil.h>
+#include <algorithm>
+#include <thread>
 
 #undef max
+#undef min
 
 using namespace NatsuLib;
 
@@ -22,24 +28,35 @@ namespace NatsuLib
 				DefaultWindowBitsWithoutHeader = -15,	// 使用负数以略过头部
 			};
 
-			DeflateStreamImpl(int level, int method, int windowBits, int memLevel, int strategy)
-				: ZStream{}, Compress{ true }, InputBufferLeft{}, OutputBufferLeft{}
+			DeflateStreamImpl(int level, int method, int windowBits, int memLevel, int strategy, ncData dictionary = nullptr, nLen dictionaryLength = 0)
+				: ZStream{}, Compress{ true }, InputBufferLeft{}, OutputBufferLeft{}, Dictionary{ dictionary }, DictionaryLength{ dictionaryLength }
 			{
 				const auto ret = deflateInit2(&ZStream, level, method, windowBits, memLevel, strategy);
 				if (ret != Z_OK)
 				{
 					nat_Throw(natErrException, NatErr_InternalErr, "deflateInit2 failed with code {0}(description: {1})."_nv, ret, U8StringView{ ZStream.msg });
 				}
+
+				if (Dictionary && DictionaryLength)
+				{
+					SetDictionary();
+				}
 			}
 
-			explicit DeflateStreamImpl(int windowBits)
-				: ZStream{}, Compress{ false }, InputBufferLeft{}, OutputBufferLeft{}
+			explicit DeflateStreamImpl(int windowBits, ncData dictionary = nullptr, nLen dictionaryLength = 0)
+				: ZStream{}, Compress{ false }, InputBufferLeft{}, OutputBufferLeft{}, Dictionary{ dictionary }, DictionaryLength{ dictionaryLength }
 			{
 				const auto ret = inflateInit2(&ZStream, windowBits);
 				if (ret != Z_OK)
 				{
 					nat_Throw(natErrException, NatErr_InternalErr, "inflateInit2 failed with code {0}(description: {1})."_nv, ret, U8StringView{ ZStream.msg });
 				}
+
+				// 有头部时需要等到inflate返回Z_NEED_DICT再设置字典
+				if (windowBits < 0 && Dictionary && DictionaryLength)
+				{
+					SetDictionary();
+				}
 			}
 
 			~DeflateStreamImpl()
@@ -90,6 +107,25 @@ namespace NatsuLib
 				}
 			}
 
+			void SetDictionary()
+			{
+				if (!Dictionary || !DictionaryLength)
+				{
+					nat_Throw(InvalidData, "Data requires a preset dictionary but none is provided."_nv);
+				}
+
+				// 必须传入完整的字典，zlib头部中的字典标识为完整字典的Adler-32，zlib会自行忽略超过窗口大小的部分
+				const auto ret = Compress ? deflateSetDictionary(&ZStream, Dictionary, static_cast<uInt>(DictionaryLength)) : inflateSetDictionary(&ZStream, Dictionary, static_cast<uInt>(DictionaryLength));
+				if (ret == Z_DATA_ERROR)
+				{
+					nat_Throw(InvalidData, "Preset dictionary does not match the data."_nv);
+				}
+				if (ret != Z_OK)
+				{
+					nat_Throw(natErrException, NatErr_InternalErr, "Setting dictionary failed with code {0}."_nv, ret);
+				}
+			}
+
 			int DoNext(nBool finish = false, nBool flush = false) noexcept
 			{
 				constexpr auto max = std::numeric_limits<uInt>::max();
@@ -111,12 +147,222 @@ namespace NatsuLib
 			z_stream ZStream;
 			const nBool Compress;
 			size_t InputBufferLeft, OutputBufferLeft;
+			const ncData Dictionary;
+			const nLen DictionaryLength;
 		};
+
+		int GetZlibCompressionLevel(natDeflateStream::CompressionLevel compressionLevel) noexcept
+		{
+			switch (compressionLevel)
+			{
+			case natDeflateStream::CompressionLevel::Optimal:
+				return Z_BEST_COMPRESSION;
+			case natDeflateStream::CompressionLevel::Fastest:
+				return Z_BEST_SPEED;
+			default:
+				assert(!"Invalid compressionLevel.");
+				[[fallthrough]];
+			case natDeflateStream::CompressionLevel::NoCompression:
+				return Z_NO_COMPRESSION;
+			}
+		}
+
+		int GetZlibStrategy(natDeflateStream::Strategy strategy) noexcept
+		{
+			switch (strategy)
+			{
+			default:
+				assert(!"Invalid strategy.");
+				[[fallthrough]];
+			case natDeflateStream::Strategy::Default:
+				return Z_DEFAULT_STRATEGY;
+			case natDeflateStream::Strategy::Filtered:
+				return Z_FILTERED;
+			case natDeflateStream::Strategy::HuffmanOnly:
+				return Z_HUFFMAN_ONLY;
+			case natDeflateStream::Strategy::Rle:
+				return Z_RLE;
+			case natDeflateStream::Strategy::Fixed:
+				return Z_FIXED;
+			}
+		}
+
+		// 将一块数据独立压缩为无头部的deflate数据，返回输入数据的Crc32
+		// 非最后一块以同步刷新结束，使输出按字节对齐且可以直接拼接
+		nuInt CompressDeflateBlock(int level, std::vector<nByte> const& input, std::vector<nByte> const& dictionary, nBool last, std::vector<nByte>& output)
+		{
+			z_stream zStream{};
+			auto ret = deflateInit2(&zStream, level, Z_DEFLATED, DeflateStreamImpl::DefaultWindowBitsWithoutHeader, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+			if (ret != Z_OK)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "deflateInit2 failed with code {0}(description: {1})."_nv, ret, U8StringView{ zStream.msg });
+			}
+			const auto scope = make_scope([&zStream]
+			{
+				deflateEnd(&zStream);
+			});
+
+			if (!dictionary.empty())
+			{
+				ret = deflateSetDictionary(&zStream, dictionary.data(), static_cast<uInt>(dictionary.size()));
+				if (ret != Z_OK)
+				{
+					nat_Throw(natErrException, NatErr_InternalErr, "deflateSetDictionary failed with code {0}."_nv, ret);
+				}
+			}
+
+			// 同步刷新会额外产生一个空的存储块
+			output.resize(static_cast<size_t>(deflateBound(&zStream, static_cast<uLong>(input.size()))) + 16);
+			zStream.next_in = const_cast<z_const Bytef*>(input.data());
+			zStream.avail_in = static_cast<uInt>(input.size());
+			zStream.next_out = output.data();
+			zStream.avail_out = static_cast<uInt>(output.size());
+
+			while (true)
+			{
+				ret = deflate(&zStream, last ? Z_FINISH : Z_SYNC_FLUSH);
+				if (ret == Z_STREAM_ERROR)
+				{
+					nat_Throw(natErrException, NatErr_InternalErr, "deflate failed with code {0}."_nv, ret);
+				}
+				if (last ? ret == Z_STREAM_END : !zStream.avail_in && zStream.avail_out)
+				{
+					break;
+				}
+
+				// 输出空间不足，扩大后继续
+				const auto usedSize = static_cast<size_t>(zStream.total_out);
+				output.resize(output.size() * 2);
+				zStream.next_out = output.data() + usedSize;
+				zStream.avail_out = static_cast<uInt>(output.size() - usedSize);
+			}
+
+			output.resize(static_cast<size_t>(zStream.total_out));
+			return natCrc::Update(natCrc::Polynomial::Crc32, 0, input.data(), input.size());
+		}
+	}
+}
+
+natDeflateIndex::natDeflateIndex(nLen span)
+	: m_Span{ span }, m_Complete{ false }, m_UncompressedSize{}
+{
+	if (!m_Span)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "span should not be zero."_nv);
 	}
 }
 
+natDeflateIndex::~natDeflateIndex()
+{
+}
+
+nLen natDeflateIndex::GetSpan() const noexcept
+{
+	return m_Span;
+}
+
+nBool natDeflateIndex::IsComplete() const noexcept
+{
+	return m_Complete;
+}
+
+nLen natDeflateIndex::GetUncompressedSize() const noexcept
+{
+	return m_UncompressedSize;
+}
+
+std::vector<natDeflateIndex::AccessPoint> const& natDeflateIndex::GetAccessPoints() const noexcept
+{
+	return m_AccessPoints;
+}
+
+natDeflateIndex::AccessPoint const* natDeflateIndex::FindAccessPoint(nLen uncompressedOffset) const noexcept
+{
+	const auto iter = std::upper_bound(m_AccessPoints.cbegin(), m_AccessPoints.cend(), uncompressedOffset, [](nLen offset, AccessPoint const& accessPoint)
+	{
+		return offset < accessPoint.UncompressedOffset;
+	});
+	return iter == m_AccessPoints.cbegin() ? nullptr : &*std::prev(iter);
+}
+
+void natDeflateIndex::Save(natRefPointer<natStream> const& stream) const
+{
+	const auto writer = make_ref<natBinaryWriter>(stream, Environment::Endianness::LittleEndian);
+	writer->WritePod(static_cast<nuInt>(Signature));
+	writer->WritePod(static_cast<nuInt>(Version));
+	writer->WritePod(m_Span);
+	writer->WritePod(static_cast<nByte>(m_Complete));
+	writer->WritePod(m_UncompressedSize);
+	writer->WritePod(static_cast<nLen>(m_AccessPoints.size()));
+	for (const auto& accessPoint : m_AccessPoints)
+	{
+		writer->WritePod(accessPoint.UncompressedOffset);
+		writer->WritePod(accessPoint.CompressedOffset);
+		writer->WritePod(accessPoint.Bits);
+		writer->WritePod(static_cast<nuInt>(accessPoint.Window.size()));
+		stream->WriteBytes(accessPoint.Window.data(), accessPoint.Window.size());
+	}
+}
+
+natRefPointer<natDeflateIndex> natDeflateIndex::Load(natRefPointer<natStream> const& stream)
+{
+	const auto reader = make_ref<natBinaryReader>(stream, Environment::Endianness::LittleEndian);
+	if (reader->ReadPod<nuInt>() != Signature)
+	{
+		nat_Throw(InvalidData, "Not a deflate index."_nv);
+	}
+	const auto version = reader->ReadPod<nuInt>();
+	if (version != Version)
+	{
+		nat_Throw(InvalidData, "Unsupported deflate index version {0}."_nv, version);
+	}
+
+	const auto span = reader->ReadPod<nLen>();
+	if (!span)
+	{
+		nat_Throw(InvalidData, "Invalid span."_nv);
+	}
+
+	auto index = make_ref<natDeflateIndex>(span);
+	index->m_Complete = reader->ReadPod<nByte>() != 0;
+	index->m_UncompressedSize = reader->ReadPod<nLen>();
+
+	const auto accessPointCount = reader->ReadPod<nLen>();
+	nLen lastUncompressedOffset = 0;
+	for (nLen i = 0; i < accessPointCount; ++i)
+	{
+		AccessPoint accessPoint;
+		accessPoint.UncompressedOffset = reader->ReadPod<nLen>();
+		accessPoint.CompressedOffset = reader->ReadPod<nLen>();
+		accessPoint.Bits = reader->ReadPod<nByte>();
+		const auto windowSize = reader->ReadPod<nuInt>();
+		// 访问点必须按顺序排列且位于数据之内，前一个字节中剩余的位数必须小于8
+		if (accessPoint.UncompressedOffset <= lastUncompressedOffset || (index->m_Complete && accessPoint.UncompressedOffset >= index->m_UncompressedSize) ||
+			accessPoint.Bits >= 8 || (accessPoint.Bits && !accessPoint.CompressedOffset) || windowSize > WindowSize)
+		{
+			nat_Throw(InvalidData, "Invalid access point."_nv);
+		}
+
+		accessPoint.Window.resize(windowSize);
+		if (stream->ReadBytes(accessPoint.Window.data(), windowSize) < windowSize)
+		{
+			nat_Throw(natErrException, NatErr_OutOfRange, "Reached end of stream while reading access point."_nv);
+		}
+
+		lastUncompressedOffset = accessPoint.UncompressedOffset;
+		index->m_AccessPoints.emplace_back(std::move(accessPoint));
+	}
+
+	return index;
+}
+
 natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, nBool useHeader)
-	: natRefObjImpl{ std::move(stream) }, m_Buffer{}, m_Impl{ std::make_unique<detail_::DeflateStreamImpl>(useHeader ? detail_::DeflateStreamImpl::DefaultWindowBitsWithHeader : detail_::DeflateStreamImpl::DefaultWindowBitsWithoutHeader) }, m_WroteData{ false }
+	: natDeflateStream{ std::move(stream), DecompressOptions{}, useHeader }
+{
+}
+
+natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, DecompressOptions const& options, nBool useHeader)
+	: natRefObjImpl{ std::move(stream) }, m_WroteData{ false }, m_Finished{ false }, m_WindowBits{ useHeader ? options.WindowBits : -options.WindowBits }, m_CompressedStart{}, m_CompressedPosition{}, m_Position{}
 {
 	if (!m_InternalStream)
 	{
@@ -127,10 +373,60 @@ natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, nBool useHea
 	{
 		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be readable."_nv);
 	}
+
+	if (options.WindowBits < MinWindowBits || options.WindowBits > MaxWindowBits)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "WindowBits should be in range [{0}, {1}]."_nv, static_cast<int>(MinWindowBits), static_cast<int>(MaxWindowBits));
+	}
+
+	if (options.DictionaryLength > std::numeric_limits<uInt>::max())
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "DictionaryLength is too large."_nv);
+	}
+
+	if (!options.BufferSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "BufferSize should not be zero."_nv);
+	}
+
+	m_Buffer.resize(options.BufferSize);
+	m_Impl = std::make_unique<detail_::DeflateStreamImpl>(m_WindowBits, options.Dictionary, options.DictionaryLength);
+}
+
+natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, natRefPointer<natDeflateIndex> index, nBool useHeader)
+	: natDeflateStream{ std::move(stream), std::move(index), DecompressOptions{}, useHeader }
+{
+}
+
+natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, natRefPointer<natDeflateIndex> index, DecompressOptions const& options, nBool useHeader)
+	: natDeflateStream{ std::move(stream), options, useHeader }
+{
+	if (!index)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "index should not be nullptr."_nv);
+	}
+
+	if (!m_InternalStream->CanSeek())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be seekable."_nv);
+	}
+
+	m_Index = std::move(index);
+	m_CompressedStart = m_InternalStream->GetPosition();
 }
 
 natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, CompressionLevel compressionLevel, nBool useHeader)
-	: natRefObjImpl{ std::move(stream) }, m_Buffer{}, m_WroteData{ false }
+	: natDeflateStream{ std::move(stream), [compressionLevel]
+	{
+		CompressOptions options;
+		options.Level = detail_::GetZlibCompressionLevel(compressionLevel);
+		return options;
+	}(), useHeader }
+{
+}
+
+natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, CompressOptions const& options, nBool useHeader)
+	: natRefObjImpl{ std::move(stream) }, m_WroteData{ false }, m_Finished{ false }, m_WindowBits{ useHeader ? options.WindowBits : -options.WindowBits }, m_CompressedStart{}, m_CompressedPosition{}, m_Position{}
 {
 	if (!m_InternalStream)
 	{
@@ -142,27 +438,36 @@ natDeflateStream::natDeflateStream(natRefPointer<natStream> stream, CompressionL
 		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable."_nv);
 	}
 
-	int compressionLevelNum;
-	switch (compressionLevel)
+	if (options.Level < MinLevel || options.Level > MaxLevel)
 	{
-	case CompressionLevel::Optimal:
-		compressionLevelNum = Z_BEST_COMPRESSION;
-		break;
-	case CompressionLevel::Fastest:
-		compressionLevelNum = Z_BEST_SPEED;
-		break;
-	default:
-		assert(!"Invalid compressionLevel.");
-		[[fallthrough]];
-	case CompressionLevel::NoCompression:
-		compressionLevelNum = Z_NO_COMPRESSION;
-		break;
+		nat_Throw(natErrException, NatErr_OutOfRange, "Level should be in range [{0}, {1}]."_nv, static_cast<int>(MinLevel), static_cast<int>(MaxLevel));
+	}
+
+	// zlib不支持无头部时使用8作为窗口大小
+	if (options.WindowBits <= MinWindowBits || options.WindowBits > MaxWindowBits)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "WindowBits should be in range [{0}, {1}]."_nv, static_cast<int>(MinWindowBits) + 1, static_cast<int>(MaxWindowBits));
+	}
+
+	if (options.MemLevel < MinMemLevel || options.MemLevel > MaxMemLevel)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "MemLevel should be in range [{0}, {1}]."_nv, static_cast<int>(MinMemLevel), static_cast<int>(MaxMemLevel));
 	}
 
-	const auto windowBits = useHeader ? detail_::DeflateStreamImpl::DefaultWindowBitsWithHeader : detail_::DeflateStreamImpl::DefaultWindowBitsWithoutHeader;
+	if (options.DictionaryLength > std::numeric_limits<uInt>::max())
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "DictionaryLength is too large."_nv);
+	}
 
-	m_Impl = std::make_unique<detail_::DeflateStreamImpl>(compressionLevelNum, Z_DEFLATED, windowBits, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
-	m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
+	if (!options.BufferSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "BufferSize should not be zero."_nv);
+	}
+
+	m_Buffer.resize(options.BufferSize);
+	m_Impl = std::make_unique<detail_::DeflateStreamImpl>(options.Level, Z_DEFLATED, m_WindowBits, options.MemLevel,
+		detail_::GetZlibStrategy(options.CompressionStrategy), options.Dictionary, options.DictionaryLength);
+	m_Impl->SetOutput(m_Buffer.data(), m_Buffer.size());
 }
 
 natDeflateStream::~natDeflateStream()
@@ -172,7 +477,7 @@ natDeflateStream::~natDeflateStream()
 
 nBool natDeflateStream::CanWrite() const
 {
-	return m_Impl->Compress && m_InternalStream->CanWrite();
+	return m_Impl->Compress && !m_Finished && m_InternalStream->CanWrite();
 }
 
 nBool natDeflateStream::CanRead() const
@@ -187,11 +492,16 @@ nBool natDeflateStream::CanResize() const
 
 nBool natDeflateStream::CanSeek() const
 {
-	return false;
+	return m_Index && m_InternalStream->CanSeek();
 }
 
 nBool natDeflateStream::IsEndOfStream() const
 {
+	if (m_Index)
+	{
+		return m_Index->IsComplete() && m_Position >= m_Index->GetUncompressedSize();
+	}
+
 	auto ret = m_InternalStream->IsEndOfStream();
 	if (CanRead())
 	{
@@ -202,7 +512,35 @@ nBool natDeflateStream::IsEndOfStream() const
 
 nLen natDeflateStream::GetSize() const
 {
-	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetSize."_nv);
+	if (!m_Index)
+	{
+		nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetSize."_nv);
+	}
+
+	if (!m_Index->IsComplete())
+	{
+		// 使用独立的解压状态从最后一个访问点解压到末尾，之后恢复内部流的位置，不影响当前的解压状态
+		const auto scope = make_scope([this]
+		{
+			m_InternalStream->SetPosition(NatSeek::Beg, static_cast<nLong>(m_CompressedStart + m_CompressedPosition));
+		});
+
+		detail_::DeflateStreamImpl impl{ m_WindowBits, m_Impl->Dictionary, m_Impl->DictionaryLength };
+		std::vector<nByte> input(m_Buffer.size()), output(natDeflateIndex::WindowSize);
+		nLen compressedPosition, position;
+		const auto& accessPoints = m_Index->GetAccessPoints();
+		restoreAccessPoint(impl, accessPoints.empty() ? nullptr : &accessPoints.back(), compressedPosition, position);
+		while (!m_Index->IsComplete())
+		{
+			// 最后一次调用可能只读到结束标记而没有输出
+			if (!inflateIndexed(impl, input, compressedPosition, position, output.data(), output.size()) && !m_Index->IsComplete())
+			{
+				nat_Throw(InvalidData, "Unexpected end of compressed data."_nv);
+			}
+		}
+	}
+
+	return m_Index->GetUncompressedSize();
 }
 
 void natDeflateStream::SetSize(nLen)
@@ -212,12 +550,62 @@ void natDeflateStream::SetSize(nLen)
 
 nLen natDeflateStream::GetPosition() const
 {
-	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetPosition."_nv);
+	if (!m_Index)
+	{
+		nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetPosition."_nv);
+	}
+
+	return m_Position;
 }
 
-void natDeflateStream::SetPosition(NatSeek, nLong)
+void natDeflateStream::SetPosition(NatSeek Origin, nLong Offset)
 {
-	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+	if (!m_Index)
+	{
+		nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+	}
+
+	nLen base;
+	switch (Origin)
+	{
+	case NatSeek::Beg:
+		base = 0;
+		break;
+	case NatSeek::Cur:
+		base = m_Position;
+		break;
+	case NatSeek::End:
+		base = GetSize();
+		break;
+	default:
+		nat_Throw(natErrException, NatErr_InvalidArg, "Invalid Origin."_nv);
+	}
+
+	if (Offset < 0 && static_cast<nLen>(-Offset) > base)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "Position is before the beginning of the stream."_nv);
+	}
+	const auto target = base + Offset;
+
+	// 目标在当前位置之前，或目标与当前位置之间有更近的访问点时才需要恢复
+	const auto accessPoint = m_Index->FindAccessPoint(target);
+	if (target < m_Position || (accessPoint && accessPoint->UncompressedOffset > m_Position))
+	{
+		restoreAccessPoint(*m_Impl, accessPoint, m_CompressedPosition, m_Position);
+	}
+
+	if (m_Position < target)
+	{
+		m_SkipBuffer.resize(natDeflateIndex::WindowSize);
+		while (m_Position < target)
+		{
+			const auto skipLength = std::min(target - m_Position, static_cast<nLen>(m_SkipBuffer.size()));
+			if (!inflateIndexed(*m_Impl, m_Buffer, m_CompressedPosition, m_Position, m_SkipBuffer.data(), skipLength))
+			{
+				nat_Throw(natErrException, NatErr_OutOfRange, "Position is beyond the end of the stream."_nv);
+			}
+		}
+	}
 }
 
 nLen natDeflateStream::ReadBytes(nData pData, nLen Length)
@@ -227,6 +615,11 @@ nLen natDeflateStream::ReadBytes(nData pData, nLen Length)
 		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
 	}
 
+	if (m_Index)
+	{
+		return inflateIndexed(*m_Impl, m_Buffer, m_CompressedPosition, m_Position, pData, Length);
+	}
+
 	auto pWrite = pData;
 	auto dataRemain = Length;
 
@@ -234,12 +627,17 @@ nLen natDeflateStream::ReadBytes(nData pData, nLen Length)
 	{
 		// 输出之前可能未输出的内容
 		m_Impl->SetOutput(pWrite, static_cast<size_t>(dataRemain));
-		const auto ret = m_Impl->DoNext(true);	// 实现提示：忽略此处可能的部分错误
+		auto ret = m_Impl->DoNext(true);	// 实现提示：忽略此处可能的部分错误
+		if (ret == Z_NEED_DICT)
+		{
+			m_Impl->SetDictionary();
+			ret = m_Impl->DoNext(true);
+		}
 		if (ret == Z_DATA_ERROR)
 		{
 			nat_Throw(InvalidData, "Invalid data with zlib message ({0})."_nv, U8StringView{ m_Impl->ZStream.msg });
 		}
-		const auto currentReadBytes = Length - m_Impl->OutputBufferLeft - m_Impl->ZStream.avail_out;
+		const auto currentReadBytes = dataRemain - m_Impl->OutputBufferLeft - m_Impl->ZStream.avail_out;
 		assert(dataRemain >= currentReadBytes);
 		pWrite += currentReadBytes;
 		dataRemain -= currentReadBytes;
@@ -258,16 +656,16 @@ nLen natDeflateStream::ReadBytes(nData pData, nLen Length)
 		{
 			break;
 		}
-		const auto readBytes = m_InternalStream->ReadBytes(m_Buffer, sizeof m_Buffer);
+		const auto readBytes = m_InternalStream->ReadBytes(m_Buffer.data(), m_Buffer.size());
 		if (readBytes == 0)
 		{
 			break;
 		}
 
-		assert(readBytes <= sizeof m_Buffer);
+		assert(readBytes <= m_Buffer.size());
 
 		// 实现提示：检查了输入已经全部处理完毕了吗？
-		m_Impl->SetInput(m_Buffer, static_cast<size_t>(readBytes));
+		m_Impl->SetInput(m_Buffer.data(), static_cast<size_t>(readBytes));
 	}
 
 	return Length - dataRemain;
@@ -280,11 +678,15 @@ nLen natDeflateStream::WriteBytes(ncData pData, nLen Length)
 		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
 	}
 
-	auto writtenBytes = writeAll();
+	if (!Length)
+	{
+		return 0;
+	}
+
 	m_Impl->SetInput(pData, static_cast<size_t>(Length));
-	writtenBytes += writeAll();
+	compressInput(Z_NO_FLUSH);
 	m_WroteData = true;
-	return writtenBytes;
+	return Length;
 }
 
 void natDeflateStream::ForceWriteBytes(ncData /*pData*/, nLen /*Length*/)
@@ -300,23 +702,11 @@ void natDeflateStream::Flush()
 
 void natDeflateStream::Flush(nLen& flushLength)
 {
-	if (m_Impl->Compress && m_WroteData)
+	flushLength = 0;
+	if (m_Impl->Compress && m_WroteData && !m_Finished)
 	{
-		flushLength = writeAll();
-
-		while (true)
-		{
-			m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
-			const auto ret = m_Impl->DoNext();
-			if (ret == Z_OK)
-			{
-				flushLength += m_InternalStream->WriteBytes(m_Buffer, sizeof m_Buffer - m_Impl->OutputBufferLeft - m_Impl->ZStream.avail_out);
-			}
-			else
-			{
-				break; // 实现提示：忽略错误
-			}
-		}
+		flushLength = compressInput(Z_SYNC_FLUSH);
+		flushLength += writeBufferedOutput();
 	}
 
 	m_InternalStream->Flush();
@@ -324,26 +714,18 @@ void natDeflateStream::Flush(nLen& flushLength)
 
 nLen natDeflateStream::Finish()
 {
-	if (!m_Impl->Compress)
+	if (!m_Impl->Compress || m_Finished)
 	{
 		return 0;
 	}
 
+	m_Finished = true;
 	nLen wroteBytes = 0;
 
 	if (m_WroteData)
 	{
-		wroteBytes += writeAll();
-
-		int ret;
-		do
-		{
-			m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
-			const auto totalOutBefore = m_Impl->ZStream.total_out;
-			ret = m_Impl->DoNext(true);
-			const auto availableDataSize = m_Impl->ZStream.total_out - totalOutBefore;
-			wroteBytes += m_InternalStream->WriteBytes(m_Buffer, availableDataSize);
-		} while (ret != Z_STREAM_END);
+		wroteBytes += compressInput(Z_FINISH);
+		wroteBytes += writeBufferedOutput();
 	}
 	else
 	{
@@ -351,7 +733,7 @@ nLen natDeflateStream::Finish()
 		int ret;
 		do
 		{
-			m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
+			m_Impl->SetOutput(m_Buffer.data(), m_Buffer.size());
 			ret = m_Impl->DoNext(true);
 		} while (ret != Z_STREAM_END);
 	}
@@ -359,46 +741,186 @@ nLen natDeflateStream::Finish()
 	return wroteBytes;
 }
 
-nLen natDeflateStream::writeAll(nBool finish)
+nLen natDeflateStream::compressInput(int flush)
 {
-	assert(CanWrite());
+	assert(m_Impl->Compress);
 
 	nLen totalWrittenBytes{};
-	int ret;
-	m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
-	while (m_Impl->ZStream.avail_in != 0)
+	while (true)
 	{
-		do
+		// 仅在缓冲区已满时写出，避免向内部流写入大量很小的数据
+		if (!m_Impl->ZStream.avail_out && !m_Impl->OutputBufferLeft)
 		{
-			const auto totalOutBefore = m_Impl->ZStream.total_out;
-			ret = m_Impl->DoNext(finish);
+			totalWrittenBytes += writeBufferedOutput();
+		}
 
-			if (ret == Z_DATA_ERROR)
-			{
-				nat_Throw(InvalidData, "Invalid data with zlib message ({0})."_nv, U8StringView{ m_Impl->ZStream.msg });
-			}
+		const auto ret = m_Impl->DoNext(flush == Z_FINISH, flush == Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END)
+		{
+			break;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "deflate failed with code {0}."_nv, ret);
+		}
 
-			const auto availableDataSize = m_Impl->ZStream.total_out - totalOutBefore;
-			const auto currentWrittenBytes = m_InternalStream->WriteBytes(m_Buffer, availableDataSize);
-			// 实现提示：是否需要检查？
-			if (currentWrittenBytes < availableDataSize)
-			{
-				nat_Throw(natErrException, NatErr_InternalErr, "Partial data written({0}/{1} requested)."_nv, currentWrittenBytes, availableDataSize);
-			}
-			totalWrittenBytes += currentWrittenBytes;
+		// 输出空间未用尽说明输入已全部处理，刷新时说明刷新已完成
+		if (flush != Z_FINISH && m_Impl->ZStream.avail_out && !m_Impl->ZStream.avail_in && !m_Impl->InputBufferLeft)
+		{
+			break;
+		}
+	}
 
-			if (ret == Z_BUF_ERROR)
+	return totalWrittenBytes;
+}
+
+void natDeflateStream::restoreAccessPoint(detail_::DeflateStreamImpl& impl, natDeflateIndex::AccessPoint const* accessPoint, nLen& compressedPosition, nLen& position) const
+{
+	auto& zStream = impl.ZStream;
+	zStream.avail_in = 0;
+	impl.InputBufferLeft = 0;
+
+	if (!accessPoint)
+	{
+		// 从头开始解压
+		inflateReset2(&zStream, m_WindowBits);
+		if (m_WindowBits < 0 && impl.Dictionary && impl.DictionaryLength)
+		{
+			impl.SetDictionary();
+		}
+		m_InternalStream->SetPosition(NatSeek::Beg, static_cast<nLong>(m_CompressedStart));
+		compressedPosition = 0;
+		position = 0;
+		return;
+	}
+
+	// 访问点处于数据中间，不再有头部
+	inflateReset2(&zStream, m_WindowBits < 0 ? m_WindowBits : -m_WindowBits);
+	compressedPosition = accessPoint->CompressedOffset - (accessPoint->Bits ? 1 : 0);
+	m_InternalStream->SetPosition(NatSeek::Beg, static_cast<nLong>(m_CompressedStart + compressedPosition));
+	if (accessPoint->Bits)
+	{
+		nByte byte;
+		if (m_InternalStream->ReadBytes(&byte, 1) < 1)
+		{
+			nat_Throw(InvalidData, "Unexpected end of compressed data."_nv);
+		}
+		++compressedPosition;
+		inflatePrime(&zStream, accessPoint->Bits, byte >> (8 - accessPoint->Bits));
+	}
+	if (!accessPoint->Window.empty())
+	{
+		inflateSetDictionary(&zStream, accessPoint->Window.data(), static_cast<uInt>(accessPoint->Window.size()));
+	}
+	position = accessPoint->UncompressedOffset;
+}
+
+// 以Z_BLOCK逐块解压，在块边界处按需记录访问点
+nLen natDeflateStream::inflateIndexed(detail_::DeflateStreamImpl& impl, std::vector<nByte>& input, nLen& compressedPosition, nLen& position, nData pData, nLen length) const
+{
+	constexpr auto max = std::numeric_limits<uInt>::max();
+	auto& zStream = impl.ZStream;
+	nLen readBytes = 0;
+
+	while (readBytes < length)
+	{
+		if (m_Index->m_Complete && position >= m_Index->m_UncompressedSize)
+		{
+			break;
+		}
+
+		// 输入耗尽时仍需再调用一次inflate，Z_BLOCK模式下最后一块结束后才会单独报告Z_STREAM_END
+		nBool endOfInput = false;
+		if (!zStream.avail_in)
+		{
+			const auto inputBytes = m_InternalStream->ReadBytes(input.data(), std::min(static_cast<nLen>(input.size()), static_cast<nLen>(max)));
+			endOfInput = !inputBytes;
+			zStream.next_in = input.data();
+			zStream.avail_in = static_cast<uInt>(inputBytes);
+			compressedPosition += inputBytes;
+		}
+
+		zStream.next_out = pData + readBytes;
+		zStream.avail_out = static_cast<uInt>(std::min(length - readBytes, static_cast<nLen>(max)));
+		const auto availOutBefore = zStream.avail_out;
+		const auto ret = inflate(&zStream, Z_BLOCK);
+		if (ret == Z_NEED_DICT)
+		{
+			impl.SetDictionary();
+			continue;
+		}
+		if (ret == Z_DATA_ERROR)
+		{
+			nat_Throw(InvalidData, "Invalid data with zlib message ({0})."_nv, U8StringView{ zStream.msg });
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "inflate failed with code {0}."_nv, ret);
+		}
+
+		const auto producedBytes = availOutBefore - zStream.avail_out;
+		readBytes += producedBytes;
+		position += producedBytes;
+
+		if (ret == Z_STREAM_END)
+		{
+			// Flush后的块边界可能位于数据末尾，之后没有输出的访问点没有意义，且不能被Load接受
+			auto& accessPoints = m_Index->m_AccessPoints;
+			while (!accessPoints.empty() && accessPoints.back().UncompressedOffset >= position)
 			{
-				m_Impl->SetOutput(m_Buffer, sizeof m_Buffer);
+				accessPoints.pop_back();
 			}
-		} while (ret != Z_OK && ret != Z_STREAM_END);
+
+			m_Index->m_Complete = true;
+			m_Index->m_UncompressedSize = position;
+			break;
+		}
+		if (endOfInput && ret == Z_BUF_ERROR)
+		{
+			break;
+		}
+
+		// data_type的第7位表示位于块边界，第6位表示刚结束的是最后一块
+		auto& accessPoints = m_Index->m_AccessPoints;
+		if ((zStream.data_type & 128) && !(zStream.data_type & 64) &&
+			position >= (accessPoints.empty() ? 0 : accessPoints.back().UncompressedOffset) + m_Index->m_Span)
+		{
+			natDeflateIndex::AccessPoint accessPoint;
+			accessPoint.UncompressedOffset = position;
+			accessPoint.CompressedOffset = compressedPosition - zStream.avail_in;
+			accessPoint.Bits = static_cast<nByte>(zStream.data_type & 7);
+			accessPoint.Window.resize(natDeflateIndex::WindowSize);
+			uInt windowSize = 0;
+			inflateGetDictionary(&zStream, accessPoint.Window.data(), &windowSize);
+			accessPoint.Window.resize(windowSize);
+			accessPoints.emplace_back(std::move(accessPoint));
+		}
 	}
 
-	return totalWrittenBytes;
+	return readBytes;
+}
+
+nLen natDeflateStream::writeBufferedOutput()
+{
+	const auto bufferedSize = static_cast<nLen>(m_Impl->ZStream.next_out - m_Buffer.data());
+	if (!bufferedSize)
+	{
+		return 0;
+	}
+
+	const auto writtenBytes = m_InternalStream->WriteBytes(m_Buffer.data(), bufferedSize);
+	// 实现提示：是否需要检查？
+	if (writtenBytes < bufferedSize)
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "Partial data written({0}/{1} requested)."_nv, writtenBytes, bufferedSize);
+	}
+
+	m_Impl->SetOutput(m_Buffer.data(), m_Buffer.size());
+	return writtenBytes;
 }
 
-natCrc32Stream::natCrc32Stream(natRefPointer<natStream> stream)
-	: natRefObjImpl{ std::move(stream) }, m_Crc32{}, m_CurrentPosition{}
+natCrc32Stream::natCrc32Stream(natRefPointer<natStream> stream, natCrc::Polynomial polynomial)
+	: natRefObjImpl{ std::move(stream) }, m_Polynomial{ polynomial }, m_Crc32{}, m_CurrentPosition{}
 {
 	if (!m_InternalStream)
 	{
@@ -472,8 +994,319 @@ nLen natCrc32Stream::WriteBytes(ncData pData, nLen Length)
 	}
 
 	const auto writtenBytes = m_InternalStream->WriteBytes(pData, Length);
-	m_Crc32 = static_cast<nuInt>(crc32_z(m_Crc32, pData, static_cast<z_size_t>(Length)));
+	m_Crc32 = natCrc::Update(m_Polynomial, m_Crc32, pData, Length);
 	m_CurrentPosition += Length;
 
 	return writtenBytes;
 }
+
+natParallelDeflateStream::natParallelDeflateStream(natRefPointer<natStream> stream, natDeflateStream::CompressionLevel compressionLevel, nLen blockSize, nuInt maxPendingBlocks)
+	: natRefObjImpl{ std::move(stream) }, m_OwnedThreadPool{ std::make_unique<natThreadPool>(0, std::max(std::thread::hardware_concurrency(), 1u)) }, m_ThreadPool{ *m_OwnedThreadPool },
+	  m_Level{ detail_::GetZlibCompressionLevel(compressionLevel) }, m_BlockSize{ blockSize }, m_MaxPendingBlocks{ maxPendingBlocks }
+{
+	init(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+natParallelDeflateStream::natParallelDeflateStream(natRefPointer<natStream> stream, natThreadPool& threadPool, natDeflateStream::CompressionLevel compressionLevel, nLen blockSize, nuInt maxPendingBlocks)
+	: natRefObjImpl{ std::move(stream) }, m_ThreadPool{ threadPool },
+	  m_Level{ detail_::GetZlibCompressionLevel(compressionLevel) }, m_BlockSize{ blockSize }, m_MaxPendingBlocks{ maxPendingBlocks }
+{
+	init(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+natParallelDeflateStream::~natParallelDeflateStream()
+{
+	try
+	{
+		Finish();
+	}
+	catch (...)
+	{
+	}
+
+	// 压缩任务引用了本对象，必须等待其完成
+	waitAllBlocks();
+}
+
+nLen natParallelDeflateStream::GetBlockSize() const noexcept
+{
+	return m_BlockSize;
+}
+
+nuInt natParallelDeflateStream::GetCrc32() const noexcept
+{
+	return m_Crc32;
+}
+
+nLen natParallelDeflateStream::GetTotalIn() const noexcept
+{
+	return m_TotalIn;
+}
+
+nLen natParallelDeflateStream::GetTotalOut() const noexcept
+{
+	return m_TotalOut;
+}
+
+nBool natParallelDeflateStream::CanWrite() const
+{
+	return !m_Finished;
+}
+
+nBool natParallelDeflateStream::CanRead() const
+{
+	return false;
+}
+
+nBool natParallelDeflateStream::CanResize() const
+{
+	return false;
+}
+
+nBool natParallelDeflateStream::CanSeek() const
+{
+	return false;
+}
+
+nBool natParallelDeflateStream::IsEndOfStream() const
+{
+	return m_InternalStream->IsEndOfStream();
+}
+
+nLen natParallelDeflateStream::GetSize() const
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetSize."_nv);
+}
+
+void natParallelDeflateStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetSize."_nv);
+}
+
+nLen natParallelDeflateStream::GetPosition() const
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetPosition."_nv);
+}
+
+void natParallelDeflateStream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+}
+
+nLen natParallelDeflateStream::ReadBytes(nData, nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natParallelDeflateStream::WriteBytes(ncData pData, nLen Length)
+{
+	if (m_Finished)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+	}
+
+	nLen writtenBytes = 0;
+	while (writtenBytes < Length)
+	{
+		const auto copyBytes = std::min(Length - writtenBytes, m_BlockSize - m_CurrentInput.size());
+		m_CurrentInput.insert(m_CurrentInput.end(), pData + writtenBytes, pData + writtenBytes + copyBytes);
+		writtenBytes += copyBytes;
+		m_TotalIn += copyBytes;
+
+		if (m_CurrentInput.size() == m_BlockSize)
+		{
+			submitCurrentBlock(false);
+		}
+	}
+
+	return writtenBytes;
+}
+
+void natParallelDeflateStream::Flush()
+{
+	if (!m_Finished)
+	{
+		if (!m_CurrentInput.empty())
+		{
+			submitCurrentBlock(false);
+		}
+		retireAllBlocks();
+	}
+
+	m_InternalStream->Flush();
+}
+
+nLen natParallelDeflateStream::Finish()
+{
+	if (m_Finished)
+	{
+		return m_TotalOut;
+	}
+
+	m_Finished = true;
+	// 最后一块可能为空，此时仅输出一个结束块
+	submitCurrentBlock(true);
+	retireAllBlocks();
+
+	return m_TotalOut;
+}
+
+void natParallelDeflateStream::init(nuInt threadCount)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should not be nullptr."_nv);
+	}
+	if (!m_InternalStream->CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable."_nv);
+	}
+	if (!m_BlockSize || m_BlockSize > std::numeric_limits<uInt>::max() / 2)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "blockSize is out of range."_nv);
+	}
+
+	if (!m_MaxPendingBlocks)
+	{
+		m_MaxPendingBlocks = threadCount * 2;
+	}
+
+	m_CurrentInput.reserve(static_cast<size_t>(m_BlockSize));
+	m_Crc32 = 0;
+	m_TotalIn = 0;
+	m_TotalOut = 0;
+	m_Finished = false;
+}
+
+void natParallelDeflateStream::submitCurrentBlock(nBool last)
+{
+	auto block = std::make_unique<Block>();
+	block->Input.swap(m_CurrentInput);
+	block->Dictionary = m_Window;
+	block->Crc32 = 0;
+	block->Last = last;
+	block->Ready = false;
+
+	m_CurrentInput.reserve(static_cast<size_t>(m_BlockSize));
+
+	// 更新字典为到此为止的输入的最后DictionarySize字节
+	const auto& input = block->Input;
+	if (input.size() >= DictionarySize)
+	{
+		m_Window.assign(input.end() - DictionarySize, input.end());
+	}
+	else
+	{
+		m_Window.insert(m_Window.end(), input.begin(), input.end());
+		if (m_Window.size() > DictionarySize)
+		{
+			m_Window.erase(m_Window.begin(), m_Window.end() - DictionarySize);
+		}
+	}
+
+	const auto pBlock = block.get();
+	size_t pendingCount;
+	{
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		m_PendingBlocks.emplace_back(std::move(block));
+		pendingCount = m_PendingBlocks.size();
+	}
+
+	m_ThreadPool.QueueWork([this, pBlock](void*)
+	{
+		try
+		{
+			pBlock->Crc32 = detail_::CompressDeflateBlock(m_Level, pBlock->Input, pBlock->Dictionary, pBlock->Last, pBlock->Output);
+		}
+		catch (...)
+		{
+			pBlock->Exception = std::current_exception();
+		}
+
+		// 必须在持有锁时通知，否则等待者可能在通知前析构本对象
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		pBlock->Ready = true;
+		m_BlockReady.notify_all();
+
+		return NatErr_OK;
+	});
+
+	// 限制同时压缩的块的数量及占用的内存
+	while (pendingCount > m_MaxPendingBlocks)
+	{
+		retireFrontBlock();
+		--pendingCount;
+	}
+}
+
+void natParallelDeflateStream::retireFrontBlock()
+{
+	std::unique_ptr<Block> block;
+	{
+		std::unique_lock<std::mutex> lock{ m_Mutex };
+		assert(!m_PendingBlocks.empty());
+		m_BlockReady.wait(lock, [this]
+		{
+			return m_PendingBlocks.front()->Ready;
+		});
+		block = std::move(m_PendingBlocks.front());
+		m_PendingBlocks.pop_front();
+	}
+
+	try
+	{
+		if (block->Exception)
+		{
+			std::rethrow_exception(block->Exception);
+		}
+
+		// 管道等流可能只写入一部分
+		nLen writtenBytes = 0;
+		while (writtenBytes < block->Output.size())
+		{
+			const auto currentWrittenBytes = m_InternalStream->WriteBytes(block->Output.data() + writtenBytes, block->Output.size() - writtenBytes);
+			if (!currentWrittenBytes)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "Underlying stream cannot write any more data."_nv);
+			}
+			writtenBytes += currentWrittenBytes;
+		}
+	}
+	catch (...)
+	{
+		// 之后的输出已经无法拼接为合法的数据
+		m_Finished = true;
+		throw;
+	}
+
+	m_TotalOut += block->Output.size();
+	m_Crc32 = natCrc::Combine(natCrc::Polynomial::Crc32, m_Crc32, block->Crc32, block->Input.size());
+}
+
+void natParallelDeflateStream::retireAllBlocks()
+{
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			if (m_PendingBlocks.empty())
+			{
+				break;
+			}
+		}
+
+		retireFrontBlock();
+	}
+}
+
+void natParallelDeflateStream::waitAllBlocks()
+{
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_BlockReady.wait(lock, [this]
+	{
+		return std::all_of(m_PendingBlocks.begin(), m_PendingBlocks.end(), [](std::unique_ptr<Block> const& block)
+		{
+			return block->Ready;
+		});
+	});
+}
@@ -1,6 +1,12 @@
 ﻿#pragma once
 #include "natConfig.h"
 #include "natStream.h"
+#include "natMultiThread.h"
+#include "natCrc.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <vector>
 
 namespace NatsuLib
 {
@@ -9,19 +15,97 @@ namespace NatsuLib
 		struct DeflateStreamImpl;
 	}
 
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	deflate数据的随机访问索引
+	///	@remark	解压时每隔span字节的解压数据在块边界处记录一个访问点，包括此处在压缩数据中的位置及之前最多32KiB的解压数据，\n
+	///			之后可以从最近的访问点恢复解压状态，而不需要从头开始解压
+	///	@note	span越小定位越快，但每个访问点需要额外最多32KiB的空间\n
+	///			索引仅对建立时使用的数据有效，加载时无法验证是否与数据对应
+	////////////////////////////////////////////////////////////////////////////////
+	class natDeflateIndex
+		: public natRefObjImpl<natDeflateIndex, natRefObj>
+	{
+		friend class natDeflateStream;
+
+	public:
+		enum : nLen
+		{
+			DefaultSpan = 1024 * 1024,
+			WindowSize = 32 * 1024,
+		};
+
+		struct AccessPoint
+		{
+			///	@brief	访问点在解压数据中的位置
+			nLen UncompressedOffset;
+			///	@brief	访问点之后第一个完整字节在压缩数据中的位置
+			nLen CompressedOffset;
+			///	@brief	访问点之前的字节中尚未使用的位数，为0时访问点位于字节边界
+			nByte Bits;
+			///	@brief	访问点之前最多32KiB的解压数据
+			std::vector<nByte> Window;
+		};
+
+		///	@param	span	访问点之间的最小距离，以解压数据的字节数计
+		explicit natDeflateIndex(nLen span = DefaultSpan);
+		~natDeflateIndex();
+
+		nLen GetSpan() const noexcept;
+		///	@brief	是否已经解压到数据的末尾
+		nBool IsComplete() const noexcept;
+		///	@brief	获得解压数据的总长度
+		///	@note	仅在IsComplete时有效
+		nLen GetUncompressedSize() const noexcept;
+		std::vector<AccessPoint> const& GetAccessPoints() const noexcept;
+		///	@brief	查找不晚于uncompressedOffset的最后一个访问点，不存在时返回nullptr
+		AccessPoint const* FindAccessPoint(nLen uncompressedOffset) const noexcept;
+
+		///	@brief	将索引保存到流
+		void Save(natRefPointer<natStream> const& stream) const;
+		///	@brief	从流中加载由Save保存的索引
+		///	@note	数据无效时抛出InvalidData异常
+		static natRefPointer<natDeflateIndex> Load(natRefPointer<natStream> const& stream);
+
+	private:
+		enum : nuInt
+		{
+			Signature = 0x58444E4E,	// "NNDX"
+			Version = 1,
+		};
+
+		nLen m_Span;
+		nBool m_Complete;
+		nLen m_UncompressedSize;
+		std::vector<AccessPoint> m_AccessPoints;
+	};
+
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	压缩流
 	///	@remark	使用deflate算法对数据进行压缩
+	///	@note	写入模式下压缩后的数据先保存在内部缓冲区中，缓冲区满或Flush、Finish时才写出到内部流\n
+	///			读取模式下提供natDeflateIndex时可以定位，见natDeflateIndex
 	////////////////////////////////////////////////////////////////////////////////
 	class natDeflateStream
 		: public natRefObjImpl<natDeflateStream, natWrappedStream>, public nonmovable
 	{
+	public:
 		enum : size_t
 		{
 			DefaultBufferSize = 8192,
 		};
 
-	public:
+		enum : int
+		{
+			MinLevel = 0,
+			DefaultLevel = 6,
+			MaxLevel = 9,
+			MinWindowBits = 8,
+			MaxWindowBits = 15,
+			MinMemLevel = 1,
+			DefaultMemLevel = 8,
+			MaxMemLevel = 9,
+		};
+
 		enum class CompressionLevel
 		{
 			Optimal = 0,
@@ -29,8 +113,62 @@ namespace NatsuLib
 			NoCompression = 2
 		};
 
+		///	@brief	压缩策略
+		enum class Strategy
+		{
+			Default,
+			///	@brief	适合由滤波器产生的数据（值较小且分布较随机），减少匹配，更多依赖霍夫曼编码
+			Filtered,
+			///	@brief	仅使用霍夫曼编码，不查找匹配
+			HuffmanOnly,
+			///	@brief	仅查找距离为1的匹配，速度接近HuffmanOnly，适合图像等数据
+			Rle,
+			///	@brief	不使用动态霍夫曼编码
+			Fixed,
+		};
+
+		///	@brief	压缩参数
+		struct CompressOptions
+		{
+			///	@brief	压缩等级，0为不压缩，1最快，9压缩率最高
+			int Level = DefaultLevel;
+			///	@brief	窗口大小以2为底的对数，9至15，越小占用内存越少但压缩率越低
+			int WindowBits = MaxWindowBits;
+			///	@brief	内部状态占用内存的等级，1至9，越大占用内存越多，压缩越快且压缩率越高
+			int MemLevel = DefaultMemLevel;
+			Strategy CompressionStrategy = Strategy::Default;
+			///	@brief	预设字典，为空时不使用，解压时必须提供相同的字典
+			///	@note	仅保存指针，流析构前字典必须保持有效\n
+			///			字典中越常出现的内容应放在越靠后的位置，超过窗口大小的部分将被忽略
+			ncData Dictionary = nullptr;
+			nLen DictionaryLength = 0;
+			///	@brief	压缩后的数据在写出到内部流之前使用的缓冲区的大小
+			size_t BufferSize = DefaultBufferSize;
+		};
+
+		///	@brief	解压参数
+		struct DecompressOptions
+		{
+			///	@brief	窗口大小以2为底的对数，8至15，不能小于压缩时使用的值
+			int WindowBits = MaxWindowBits;
+			///	@brief	预设字典，必须与压缩时使用的字典相同
+			///	@note	仅保存指针，流析构前字典必须保持有效
+			ncData Dictionary = nullptr;
+			nLen DictionaryLength = 0;
+			///	@brief	从内部流读取压缩数据时使用的缓冲区的大小
+			size_t BufferSize = DefaultBufferSize;
+		};
+
 		explicit natDeflateStream(natRefPointer<natStream> stream, nBool useHeader = false);
+		natDeflateStream(natRefPointer<natStream> stream, DecompressOptions const& options, nBool useHeader = false);
+		///	@brief	以读取模式创建可定位的流
+		///	@param	index	使用的索引，解压时将在其中记录新的访问点，可以由之后的流继续使用
+		///	@note	内部流必须可定位，压缩数据从创建时内部流的当前位置开始，之后不能由其他人改变内部流的位置\n
+		///			定位时从不晚于目标位置的最近访问点开始解压，GetSize在索引未完成时需要解压之后的全部数据
+		natDeflateStream(natRefPointer<natStream> stream, natRefPointer<natDeflateIndex> index, nBool useHeader = false);
+		natDeflateStream(natRefPointer<natStream> stream, natRefPointer<natDeflateIndex> index, DecompressOptions const& options, nBool useHeader = false);
 		natDeflateStream(natRefPointer<natStream> stream, CompressionLevel compressionLevel, nBool useHeader = false);
+		natDeflateStream(natRefPointer<natStream> stream, CompressOptions const& options, nBool useHeader = false);
 		~natDeflateStream();
 
 		nBool CanWrite() const override;
@@ -45,27 +183,47 @@ namespace NatsuLib
 		nLen ReadBytes(nData pData, nLen Length) override;
 		nLen WriteBytes(ncData pData, nLen Length) override;
 		void ForceWriteBytes(ncData pData, nLen Length) override;
+		///	@brief	写入模式下以同步刷新结束当前的块，并将缓冲区中的数据写出到内部流
 		void Flush() override;
 
+		///	@brief	同Flush
+		///	@param	flushLength	本次写出到内部流的字节数
 		void Flush(nLen& flushLength);
+		///	@brief	结束压缩并写出剩余的数据，之后不能再写入
+		///	@return	本次写出到内部流的字节数
 		nLen Finish();
 
 	private:
-		nByte m_Buffer[DefaultBufferSize];
+		std::vector<nByte> m_Buffer;
 		std::unique_ptr<detail_::DeflateStreamImpl> m_Impl;
 		nBool m_WroteData;
+		nBool m_Finished;
+
+		// 以下成员仅在可定位的读取模式下使用
+		natRefPointer<natDeflateIndex> m_Index;
+		int m_WindowBits;
+		nLen m_CompressedStart;
+		nLen m_CompressedPosition;
+		nLen m_Position;
+		std::vector<nByte> m_SkipBuffer;
 
-		nLen writeAll(nBool finish = false);
+		nLen compressInput(int flush);
+		nLen writeBufferedOutput();
+
+		void restoreAccessPoint(detail_::DeflateStreamImpl& impl, natDeflateIndex::AccessPoint const* accessPoint, nLen& compressedPosition, nLen& position) const;
+		nLen inflateIndexed(detail_::DeflateStreamImpl& impl, std::vector<nByte>& input, nLen& compressedPosition, nLen& position, nData pData, nLen length) const;
 	};
 
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	Crc32流
+	///	@remark	计算写入的数据的校验值后写入到内部流，校验值的计算见natCrc
 	////////////////////////////////////////////////////////////////////////////////
 	class natCrc32Stream
 		: public natRefObjImpl<natCrc32Stream, natWrappedStream>
 	{
 	public:
-		explicit natCrc32Stream(natRefPointer<natStream> stream);
+		///	@param	polynomial	使用的多项式，zip及gzip均使用Crc32
+		explicit natCrc32Stream(natRefPointer<natStream> stream, natCrc::Polynomial polynomial = natCrc::Polynomial::Crc32);
 		~natCrc32Stream();
 
 		///	@brief	获得已输入数据的Crc32
@@ -83,7 +241,103 @@ namespace NatsuLib
 		nLen WriteBytes(ncData pData, nLen Length) override;
 
 	private:
+		const natCrc::Polynomial m_Polynomial;
 		nuInt m_Crc32;
 		nLen m_CurrentPosition;
 	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	并行压缩流
+	///	@remark	将输入分为固定大小的块，在线程池中并行压缩，每块以之前32KiB的输入作为字典，\n
+	///			除最后一块外均以同步刷新结束以按字节对齐，顺序拼接后即为合法的无头部deflate数据
+	///	@note	仅支持写入，压缩率略低于natDeflateStream\n
+	///			输出顺序与输入顺序一致，后台压缩发生的异常会在之后的调用中抛出
+	////////////////////////////////////////////////////////////////////////////////
+	class natParallelDeflateStream
+		: public natRefObjImpl<natParallelDeflateStream, natWrappedStream>, public nonmovable
+	{
+	public:
+		enum : nLen
+		{
+			DefaultBlockSize = 128 * 1024,
+			DictionarySize = 32 * 1024,
+		};
+
+		///	@brief	使用内部创建的线程池进行压缩
+		///	@param	stream				输出流，必须可写
+		///	@param	compressionLevel	压缩等级
+		///	@param	blockSize			每块的大小
+		///	@param	maxPendingBlocks	最多同时压缩的块的数量，为0时使用线程数的两倍
+		explicit natParallelDeflateStream(natRefPointer<natStream> stream, natDeflateStream::CompressionLevel compressionLevel = natDeflateStream::CompressionLevel::Optimal, nLen blockSize = DefaultBlockSize, nuInt maxPendingBlocks = 0);
+		///	@brief	使用外部的线程池进行压缩
+		///	@note	必须保证线程池在本流析构之后才析构
+		natParallelDeflateStream(natRefPointer<natStream> stream, natThreadPool& threadPool, natDeflateStream::CompressionLevel compressionLevel = natDeflateStream::CompressionLevel::Optimal, nLen blockSize = DefaultBlockSize, nuInt maxPendingBlocks = 0);
+		///	@brief	调用Finish结束压缩
+		///	@note	此时发生的异常将被忽略，需要得知写入是否成功时请在析构前调用Finish
+		~natParallelDeflateStream();
+
+		nLen GetBlockSize() const noexcept;
+		///	@brief	获得已写出到内部流的块对应的输入数据的Crc32
+		///	@note	Flush或Finish后即为全部输入数据的Crc32
+		nuInt GetCrc32() const noexcept;
+		///	@brief	获得已输入的总字节数
+		nLen GetTotalIn() const noexcept;
+		///	@brief	获得已写出到内部流的总字节数
+		nLen GetTotalOut() const noexcept;
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+		void SetSize(nLen /*Size*/) override;
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek /*Origin*/, nLong /*Offset*/) override;
+		nLen ReadBytes(nData /*pData*/, nLen /*Length*/) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		///	@brief	以同步刷新提交当前块，等待所有块压缩完成并写出后刷新内部流
+		void Flush() override;
+
+		///	@brief	提交最后一块并等待所有块写出，之后不能再写入
+		///	@return	写出到内部流的总字节数
+		nLen Finish();
+
+	private:
+		struct Block
+		{
+			std::vector<nByte> Input;
+			std::vector<nByte> Dictionary;
+			std::vector<nByte> Output;
+			nuInt Crc32;
+			nBool Last;
+			nBool Ready;
+			std::exception_ptr Exception;
+		};
+
+		std::unique_ptr<natThreadPool> m_OwnedThreadPool;
+		natThreadPool& m_ThreadPool;
+		const int m_Level;
+		const nLen m_BlockSize;
+		nuInt m_MaxPendingBlocks;
+
+		// 以下成员仅由使用者访问
+		std::vector<nByte> m_CurrentInput;
+		std::vector<nByte> m_Window;
+		nuInt m_Crc32;
+		nLen m_TotalIn;
+		nLen m_TotalOut;
+		nBool m_Finished;
+
+		// 以下成员由m_Mutex保护
+		std::mutex m_Mutex;
+		std::condition_variable m_BlockReady;
+		std::deque<std::unique_ptr<Block>> m_PendingBlocks;
+
+		void init(nuInt threadCount);
+		void submitCurrentBlock(nBool last);
+		void retireFrontBlock();
+		void retireAllBlocks();
+		void waitAllBlocks();
+	};
 }
@@ -12,6 +12,10 @@
 #	define NATSULIB_USE_FAST_INVERSE_SQRT 1
 #endif
 
+#ifndef NATSULIB_ENABLE_HARDWARE_CRC
+#	define NATSULIB_ENABLE_HARDWARE_CRC 1
+#endif
+
 #ifndef NATSULIB_USE_TAGGED_POINTER
 #	define NATSULIB_USE_TAGGED_POINTER 0
 #endif
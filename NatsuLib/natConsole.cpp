@@ -62,6 +62,22 @@ natConsole::natConsole()
 {
 }
 
+natStdStream& natConsole::GetStdOut() noexcept
+{
+	return m_StdOut;
+}
+
+natStdStream& natConsole::GetStdErr() noexcept
+{
+	return m_StdErr;
+}
+
+void natConsole::Flush()
+{
+	m_StdOut.Flush();
+	m_StdErr.Flush();
+}
+
 nString natConsole::GetTitle() const
 {
 #ifdef _WIN32
@@ -1,4 +1,4 @@
-#pragma once
+﻿#pragma once
 #include "natConfig.h"
 #include "natStreamHelper.h"
 #include "natMisc.h"
@@ -43,6 +43,14 @@ namespace NatsuLib
 
 		natConsole();
 
+		///	@brief	获得标准输出流
+		///	@note	可通过natStdStream::SetBufferMode调整控制台输出的缓冲方式
+		natStdStream& GetStdOut() noexcept;
+		///	@brief	获得标准错误流
+		natStdStream& GetStdErr() noexcept;
+		///	@brief	写出标准输出及标准错误中缓冲的数据
+		void Flush();
+
 		nString GetTitle() const;
 		void SetTitle(nStrView title);
 
@@ -157,6 +165,8 @@ namespace NatsuLib
 		template <StringType stringType = Encoding>
 		String<stringType> ReadLine()
 		{
+			// 保证读取前提示信息已经输出
+			m_StdOut.Flush();
 			return m_StdInReader.ReadLine();
 		}
 
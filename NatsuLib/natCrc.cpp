@@ -0,0 +1,479 @@
+﻿#include "stdafx.h"
+#include "natCrc.h"
+#include "natException.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#if NATSULIB_ENABLE_HARDWARE_CRC && (defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__))
+#	define NATSULIB_CRC_X86 1
+#	if defined(_M_X64) || defined(__x86_64__)
+#		define NATSULIB_CRC_X64 1
+#	endif
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define NATSULIB_CRC_TARGET(features)
+#	else
+#		include <cpuid.h>
+#		define NATSULIB_CRC_TARGET(features) __attribute__((target(features)))
+#	endif
+#	include <nmmintrin.h>
+#	include <wmmintrin.h>
+#elif NATSULIB_ENABLE_HARDWARE_CRC && ((defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)) || defined(_M_ARM64))
+#	define NATSULIB_CRC_ARM 1
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	else
+#		include <arm_acle.h>
+#	endif
+#endif
+
+#undef max
+#undef min
+
+using namespace NatsuLib;
+
+namespace
+{
+	// 反射形式的多项式
+	constexpr nuInt Crc32ReflectedPolynomial = 0xEDB88320u;
+	constexpr nuInt Crc32CReflectedPolynomial = 0x82F63B78u;
+
+	// 计算a * b mod P，其中a、b均为反射形式，最高位表示x^0
+	constexpr nuInt multModP(nuInt a, nuInt b, nuInt polynomial) noexcept
+	{
+		nuInt mask = 1u << 31, product = 0;
+		while (true)
+		{
+			if (a & mask)
+			{
+				product ^= b;
+				if ((a & (mask - 1)) == 0)
+				{
+					break;
+				}
+			}
+			mask >>= 1;
+			b = b & 1 ? (b >> 1) ^ polynomial : b >> 1;
+		}
+		return product;
+	}
+
+	struct CrcTable
+	{
+		// Slice[k][i]为字节i之后跟随k个零字节的校验状态
+		nuInt Slice[8][256];
+		// X2n[k]为x^(2^k) mod P，长度以nLen表示时指数最多为2^66
+		nuInt X2n[67];
+		nuInt Polynomial;
+	};
+
+	constexpr CrcTable makeCrcTable(nuInt polynomial) noexcept
+	{
+		CrcTable table{};
+		table.Polynomial = polynomial;
+		for (nuInt i = 0; i < 256; ++i)
+		{
+			auto value = i;
+			for (nuInt bit = 0; bit < 8; ++bit)
+			{
+				value = value & 1 ? (value >> 1) ^ polynomial : value >> 1;
+			}
+			table.Slice[0][i] = value;
+		}
+		for (nuInt slice = 1; slice < 8; ++slice)
+		{
+			for (nuInt i = 0; i < 256; ++i)
+			{
+				const auto previous = table.Slice[slice - 1][i];
+				table.Slice[slice][i] = (previous >> 8) ^ table.Slice[0][previous & 0xFF];
+			}
+		}
+		table.X2n[0] = 1u << 30;
+		for (nuInt i = 1; i < 67; ++i)
+		{
+			table.X2n[i] = multModP(table.X2n[i - 1], table.X2n[i - 1], polynomial);
+		}
+		return table;
+	}
+
+	constexpr CrcTable Crc32Table = makeCrcTable(Crc32ReflectedPolynomial);
+	constexpr CrcTable Crc32CTable = makeCrcTable(Crc32CReflectedPolynomial);
+
+	// 计算x^(n * 2^k) mod P
+	constexpr nuInt x2nModP(const CrcTable& table, nuLong n, nuInt k) noexcept
+	{
+		nuInt power = 1u << 31;
+		while (n)
+		{
+			if (n & 1)
+			{
+				power = multModP(table.X2n[k], power, table.Polynomial);
+			}
+			n >>= 1;
+			++k;
+		}
+		return power;
+	}
+
+	constexpr nuInt readLittleEndian32(const nByte* pData) noexcept
+	{
+		return static_cast<nuInt>(pData[0]) | static_cast<nuInt>(pData[1]) << 8 | static_cast<nuInt>(pData[2]) << 16 | static_cast<nuInt>(pData[3]) << 24;
+	}
+
+	// 以下函数的state均为内部状态，即取反后的校验值
+	nuInt updateSoftware(const CrcTable& table, nuInt state, const nByte* pData, nLen length) noexcept
+	{
+		while (length >= 8)
+		{
+			const auto low = state ^ readLittleEndian32(pData);
+			const auto high = readLittleEndian32(pData + 4);
+			state = table.Slice[7][low & 0xFF] ^ table.Slice[6][(low >> 8) & 0xFF] ^ table.Slice[5][(low >> 16) & 0xFF] ^ table.Slice[4][low >> 24] ^
+				table.Slice[3][high & 0xFF] ^ table.Slice[2][(high >> 8) & 0xFF] ^ table.Slice[1][(high >> 16) & 0xFF] ^ table.Slice[0][high >> 24];
+			pData += 8;
+			length -= 8;
+		}
+		while (length--)
+		{
+			state = (state >> 8) ^ table.Slice[0][(state ^ *pData++) & 0xFF];
+		}
+		return state;
+	}
+
+#if NATSULIB_CRC_X86
+	struct CpuFeatures
+	{
+		nBool Sse42;
+		nBool Pclmul;
+	};
+
+	const CpuFeatures& getCpuFeatures() noexcept
+	{
+		static const CpuFeatures features = []
+		{
+			nuInt ecx = 0;
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			ecx = static_cast<nuInt>(info[2]);
+#else
+			unsigned eax, ebx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			{
+				ecx = 0;
+			}
+#endif
+			CpuFeatures result{};
+			result.Sse42 = (ecx >> 20) & 1;
+			// 折叠时还需要SSE4.1的pextrd
+			result.Pclmul = ((ecx >> 1) & 1) && ((ecx >> 19) & 1);
+			return result;
+		}();
+		return features;
+	}
+
+	// 使用PCLMULQDQ每次折叠64字节，见Intel的"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+	// length不小于64且为16的倍数
+	NATSULIB_CRC_TARGET("sse4.1,pclmul")
+	nuInt updateCrc32Pclmul(nuInt state, const nByte* pData, nLen length) noexcept
+	{
+		alignas(16) static const nuLong k1k2[] = { 0x0154442BD4, 0x01C6E41596 };
+		alignas(16) static const nuLong k3k4[] = { 0x01751997D0, 0x00CCAA009E };
+		alignas(16) static const nuLong k5k0[] = { 0x0163CD6124, 0x0000000000 };
+		alignas(16) static const nuLong poly[] = { 0x01DB710641, 0x01F7011641 };
+
+		auto x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData));
+		auto x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 16));
+		auto x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 32));
+		auto x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 48));
+		x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(state)));
+		auto x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+		pData += 64;
+		length -= 64;
+
+		// 同时折叠4个128位的累加值
+		while (length >= 64)
+		{
+			const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			const auto x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+			const auto x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+			const auto x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+			x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+			x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData)));
+			x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 16)));
+			x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 32)));
+			x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData + 48)));
+			pData += 64;
+			length -= 64;
+		}
+
+		// 合并为1个128位的值
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+		for (const auto next : { x2, x3, x4 })
+		{
+			const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+		}
+
+		while (length >= 16)
+		{
+			const auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData))), x5);
+			pData += 16;
+			length -= 16;
+		}
+
+		// 128位折叠为64位
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+		x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+		x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_and_si128(x1, x3);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+
+		// Barrett约减为32位
+		x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+		x2 = _mm_and_si128(x1, x3);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+		x2 = _mm_and_si128(x2, x3);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		return static_cast<nuInt>(_mm_extract_epi32(x1, 1));
+	}
+
+	nuInt updateCrc32X86(nuInt state, const nByte* pData, nLen length) noexcept
+	{
+		if (getCpuFeatures().Pclmul && length >= 64)
+		{
+			const auto foldLength = length & ~nLen{ 15 };
+			state = updateCrc32Pclmul(state, pData, foldLength);
+			pData += foldLength;
+			length -= foldLength;
+		}
+		return updateSoftware(Crc32Table, state, pData, length);
+	}
+
+#if NATSULIB_CRC_X64
+	// crc32指令的延迟为3个周期而吞吐量为每周期1条，将数据分为3段交错计算，再用PCLMULQDQ将前两段的结果移动到末尾后合并
+	// 将状态移过n个零字节即乘以x^(8n)，由于clmul及crc32指令各引入x^1及x^32，常数取x^(8n-33)
+	template <nLen StripeSize>
+	struct Crc32CStripe
+	{
+		static constexpr nuInt Shift1 = x2nModP(Crc32CTable, StripeSize * 8 - 33, 0);
+		static constexpr nuInt Shift2 = x2nModP(Crc32CTable, StripeSize * 16 - 33, 0);
+	};
+
+	NATSULIB_CRC_TARGET("sse4.2,pclmul")
+	nuLong shiftCrc32C(nuLong state, nuInt shift) noexcept
+	{
+		const auto product = _mm_clmulepi64_si128(_mm_cvtsi64_si128(static_cast<long long>(state)), _mm_cvtsi32_si128(static_cast<int>(shift)), 0x00);
+		return _mm_crc32_u64(0, static_cast<nuLong>(_mm_cvtsi128_si64(product)));
+	}
+
+	template <nLen StripeSize>
+	NATSULIB_CRC_TARGET("sse4.2,pclmul")
+	nuInt updateCrc32CInterleaved(nuInt state, const nByte*& pData, nLen& length) noexcept
+	{
+		while (length >= StripeSize * 3)
+		{
+			nuLong crc0 = state, crc1 = 0, crc2 = 0;
+			for (nLen i = 0; i < StripeSize; i += 8)
+			{
+				nuLong value0, value1, value2;
+				std::memcpy(&value0, pData + i, 8);
+				std::memcpy(&value1, pData + StripeSize + i, 8);
+				std::memcpy(&value2, pData + StripeSize * 2 + i, 8);
+				crc0 = _mm_crc32_u64(crc0, value0);
+				crc1 = _mm_crc32_u64(crc1, value1);
+				crc2 = _mm_crc32_u64(crc2, value2);
+			}
+			state = static_cast<nuInt>(shiftCrc32C(crc0, Crc32CStripe<StripeSize>::Shift2) ^ shiftCrc32C(crc1, Crc32CStripe<StripeSize>::Shift1) ^ crc2);
+			pData += StripeSize * 3;
+			length -= StripeSize * 3;
+		}
+		return state;
+	}
+#endif
+
+	NATSULIB_CRC_TARGET("sse4.2,pclmul")
+	nuInt updateCrc32CSse42(nuInt state, const nByte* pData, nLen length) noexcept
+	{
+#if NATSULIB_CRC_X64
+		if (getCpuFeatures().Pclmul)
+		{
+			state = updateCrc32CInterleaved<8192>(state, pData, length);
+			state = updateCrc32CInterleaved<256>(state, pData, length);
+		}
+
+		nuLong state64 = state;
+		while (length >= 8)
+		{
+			nuLong value;
+			std::memcpy(&value, pData, 8);
+			state64 = _mm_crc32_u64(state64, value);
+			pData += 8;
+			length -= 8;
+		}
+		state = static_cast<nuInt>(state64);
+#else
+		while (length >= 4)
+		{
+			nuInt value;
+			std::memcpy(&value, pData, 4);
+			state = _mm_crc32_u32(state, value);
+			pData += 4;
+			length -= 4;
+		}
+#endif
+		while (length--)
+		{
+			state = _mm_crc32_u8(state, *pData++);
+		}
+		return state;
+	}
+#elif NATSULIB_CRC_ARM
+	template <nBool Castagnoli>
+	nuInt updateArm(nuInt state, const nByte* pData, nLen length) noexcept
+	{
+		while (length >= 8)
+		{
+			uint64_t value;
+			std::memcpy(&value, pData, 8);
+			state = Castagnoli ? __crc32cd(state, value) : __crc32d(state, value);
+			pData += 8;
+			length -= 8;
+		}
+		while (length--)
+		{
+			state = Castagnoli ? __crc32cb(state, *pData) : __crc32b(state, *pData);
+			++pData;
+		}
+		return state;
+	}
+#endif
+
+	const CrcTable& getTable(natCrc::Polynomial polynomial) noexcept
+	{
+		return polynomial == natCrc::Polynomial::Crc32C ? Crc32CTable : Crc32Table;
+	}
+}
+
+nuInt natCrc::Update(Polynomial polynomial, nuInt crc, ncData pData, nLen length) noexcept
+{
+	if (!pData || !length)
+	{
+		return crc;
+	}
+
+	const auto state = ~crc;
+	switch (polynomial)
+	{
+	default:
+		assert(!"Invalid polynomial.");
+	case Polynomial::Crc32:
+#if NATSULIB_CRC_X86
+		return ~updateCrc32X86(state, pData, length);
+#elif NATSULIB_CRC_ARM
+		return ~updateArm<false>(state, pData, length);
+#else
+		return ~updateSoftware(Crc32Table, state, pData, length);
+#endif
+	case Polynomial::Crc32C:
+#if NATSULIB_CRC_X86
+		if (getCpuFeatures().Sse42)
+		{
+			return ~updateCrc32CSse42(state, pData, length);
+		}
+		return ~updateSoftware(Crc32CTable, state, pData, length);
+#elif NATSULIB_CRC_ARM
+		return ~updateArm<true>(state, pData, length);
+#else
+		return ~updateSoftware(Crc32CTable, state, pData, length);
+#endif
+	}
+}
+
+nuInt natCrc::Combine(Polynomial polynomial, nuInt crc1, nuInt crc2, nLen length2) noexcept
+{
+	const auto& table = getTable(polynomial);
+	return multModP(x2nModP(table, length2, 3), crc1, table.Polynomial) ^ crc2;
+}
+
+nuInt natCrc::ParallelUpdate(natThreadPool& threadPool, Polynomial polynomial, nuInt crc, ncData pData, nLen length, nLen chunkSize)
+{
+	if (!chunkSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "chunkSize should not be zero."_nv);
+	}
+
+	if (length <= chunkSize)
+	{
+		return Update(polynomial, crc, pData, length);
+	}
+
+	std::vector<std::future<natThreadPool::WorkToken>> works;
+	works.reserve(static_cast<size_t>((length - 1) / chunkSize));
+	try
+	{
+		for (auto offset = chunkSize; offset < length; offset += chunkSize)
+		{
+			const auto chunk = pData + offset;
+			const auto chunkLength = std::min(chunkSize, length - offset);
+			works.emplace_back(threadPool.QueueWork([polynomial, chunk, chunkLength](void*)
+			{
+				return Update(polynomial, 0, chunk, chunkLength);
+			}));
+		}
+	}
+	catch (...)
+	{
+		// 已提交的任务仍在访问pData，必须等待其结束
+		for (auto& work : works)
+		{
+			work.get().GetResult().wait();
+		}
+		throw;
+	}
+
+	auto result = Update(polynomial, crc, pData, chunkSize);
+	auto offset = chunkSize;
+	for (auto& work : works)
+	{
+		const auto chunkLength = std::min(chunkSize, length - offset);
+		result = Combine(polynomial, result, work.get().GetResult().get(), chunkLength);
+		offset += chunkLength;
+	}
+
+	return result;
+}
+
+nStrView natCrc::GetImplementationName(Polynomial polynomial) noexcept
+{
+#if NATSULIB_CRC_X86
+	const auto& features = getCpuFeatures();
+	if (polynomial == Polynomial::Crc32C)
+	{
+#if NATSULIB_CRC_X64
+		return features.Sse42 ? features.Pclmul ? "sse4.2+pclmul"_nv : "sse4.2"_nv : "slicing-by-8"_nv;
+#else
+		return features.Sse42 ? "sse4.2"_nv : "slicing-by-8"_nv;
+#endif
+	}
+	return features.Pclmul ? "pclmul"_nv : "slicing-by-8"_nv;
+#elif NATSULIB_CRC_ARM
+	static_cast<void>(polynomial);
+	return "armv8-crc"_nv;
+#else
+	static_cast<void>(polynomial);
+	return "slicing-by-8"_nv;
+#endif
+}
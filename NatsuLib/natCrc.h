@@ -0,0 +1,47 @@
+﻿#pragma once
+#include "natConfig.h"
+#include "natType.h"
+#include "natString.h"
+#include "natMultiThread.h"
+
+namespace NatsuLib
+{
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	CRC校验
+	///	@remark	运行时根据处理器特性选择实现：\n
+	///			x86下Crc32使用PCLMULQDQ折叠计算，Crc32C使用SSE4.2的crc32指令\n
+	///			ARMv8下若编译器启用了CRC扩展则使用CRC32指令\n
+	///			其余情况使用8路查表法
+	///	@note	crc参数及返回值均为完整的校验值而非内部状态，空数据的校验值为0，与zlib的crc32相同\n
+	///			定义NATSULIB_ENABLE_HARDWARE_CRC为0可以禁用硬件实现
+	////////////////////////////////////////////////////////////////////////////////
+	namespace natCrc
+	{
+		enum class Polynomial
+		{
+			///	@brief	0x04C11DB7，zip、gzip及png等使用
+			Crc32,
+			///	@brief	0x1EDC6F41（Castagnoli），iSCSI、ext4及SSE4.2的crc32指令等使用
+			Crc32C,
+		};
+
+		enum : nLen
+		{
+			DefaultParallelChunkSize = 4 * 1024 * 1024,
+		};
+
+		///	@brief	以crc为之前数据的校验值，计算追加pData之后的校验值
+		nuInt Update(Polynomial polynomial, nuInt crc, ncData pData, nLen length) noexcept;
+		///	@brief	已知两段数据各自的校验值，计算连接后的数据的校验值
+		///	@param	crc1	第一段数据的校验值
+		///	@param	crc2	第二段数据的校验值
+		///	@param	length2	第二段数据的长度
+		nuInt Combine(Polynomial polynomial, nuInt crc1, nuInt crc2, nLen length2) noexcept;
+		///	@brief	将数据按chunkSize分块，在threadPool中并行计算后合并校验值
+		///	@note	第一块在调用者线程中计算，数据不超过chunkSize时不使用线程池
+		nuInt ParallelUpdate(natThreadPool& threadPool, Polynomial polynomial, nuInt crc, ncData pData, nLen length, nLen chunkSize = DefaultParallelChunkSize);
+
+		///	@brief	获得当前处理器上使用的实现的名称
+		nStrView GetImplementationName(Polynomial polynomial) noexcept;
+	}
+}
@@ -101,14 +101,14 @@ namespace NatsuLib
 			template <typename... RestChar_t>
 			static void Impl(nStrView str, std::basic_ostream<nChar>& currentOStream, std::basic_ostream<RestChar_t>&... _ostreams)
 			{
-				currentOStream << str << std::endl;
+				currentOStream << str << '\n';
 				Impl(str, _ostreams...);
 			}
 
 			template <typename... RestChar_t>
 			static void Impl(nStrView str, std::basic_ostream<nWChar>& currentOStream, std::basic_ostream<RestChar_t>&... _ostreams)
 			{
-				currentOStream << str << std::endl;
+				currentOStream << str << '\n';
 				Impl(str, _ostreams...);
 			}
 
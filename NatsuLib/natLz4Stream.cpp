@@ -0,0 +1,1251 @@
+﻿#include "stdafx.h"
+#include "natLz4Stream.h"
+#include "natException.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#undef max
+#undef min
+
+using namespace NatsuLib;
+
+namespace NatsuLib
+{
+	namespace detail_
+	{
+		// XXH32的增量计算，用于LZ4帧格式中的各种校验和
+		struct Xxh32State
+		{
+			static constexpr nuInt Prime1 = 2654435761u;
+			static constexpr nuInt Prime2 = 2246822519u;
+			static constexpr nuInt Prime3 = 3266489917u;
+			static constexpr nuInt Prime4 = 668265263u;
+			static constexpr nuInt Prime5 = 374761393u;
+
+			explicit Xxh32State(nuInt seed = 0) noexcept
+			{
+				Reset(seed);
+			}
+
+			static nuInt RotateLeft(nuInt value, int bits) noexcept
+			{
+				return (value << bits) | (value >> (32 - bits));
+			}
+
+			static nuInt Read32(ncData data) noexcept
+			{
+				return static_cast<nuInt>(data[0]) | static_cast<nuInt>(data[1]) << 8 | static_cast<nuInt>(data[2]) << 16 | static_cast<nuInt>(data[3]) << 24;
+			}
+
+			static nuInt Round(nuInt accumulator, nuInt input) noexcept
+			{
+				accumulator += input * Prime2;
+				accumulator = RotateLeft(accumulator, 13);
+				return accumulator * Prime1;
+			}
+
+			static nuInt Compute(ncData data, nLen length, nuInt seed = 0) noexcept
+			{
+				Xxh32State state{ seed };
+				state.Update(data, length);
+				return state.Digest();
+			}
+
+			void Reset(nuInt seed = 0) noexcept
+			{
+				Seed = seed;
+				Accumulators[0] = seed + Prime1 + Prime2;
+				Accumulators[1] = seed + Prime2;
+				Accumulators[2] = seed;
+				Accumulators[3] = seed - Prime1;
+				TotalLength = 0;
+				BufferedSize = 0;
+			}
+
+			void Update(ncData data, nLen length) noexcept
+			{
+				TotalLength += length;
+
+				if (BufferedSize + length < sizeof Buffer)
+				{
+					std::memcpy(Buffer + BufferedSize, data, static_cast<size_t>(length));
+					BufferedSize += static_cast<size_t>(length);
+					return;
+				}
+
+				const auto end = data + length;
+				if (BufferedSize)
+				{
+					const auto fillSize = sizeof Buffer - BufferedSize;
+					std::memcpy(Buffer + BufferedSize, data, fillSize);
+					processStripe(Buffer);
+					data += fillSize;
+					BufferedSize = 0;
+				}
+
+				while (end - data >= static_cast<std::ptrdiff_t>(sizeof Buffer))
+				{
+					processStripe(data);
+					data += sizeof Buffer;
+				}
+
+				BufferedSize = static_cast<size_t>(end - data);
+				std::memcpy(Buffer, data, BufferedSize);
+			}
+
+			nuInt Digest() const noexcept
+			{
+				nuInt hash;
+				if (TotalLength >= sizeof Buffer)
+				{
+					hash = RotateLeft(Accumulators[0], 1) + RotateLeft(Accumulators[1], 7) + RotateLeft(Accumulators[2], 12) + RotateLeft(Accumulators[3], 18);
+				}
+				else
+				{
+					hash = Seed + Prime5;
+				}
+
+				hash += static_cast<nuInt>(TotalLength);
+
+				size_t i = 0;
+				for (; i + 4 <= BufferedSize; i += 4)
+				{
+					hash += Read32(Buffer + i) * Prime3;
+					hash = RotateLeft(hash, 17) * Prime4;
+				}
+				for (; i < BufferedSize; ++i)
+				{
+					hash += Buffer[i] * Prime5;
+					hash = RotateLeft(hash, 11) * Prime1;
+				}
+
+				hash ^= hash >> 15;
+				hash *= Prime2;
+				hash ^= hash >> 13;
+				hash *= Prime3;
+				hash ^= hash >> 16;
+				return hash;
+			}
+
+			nuInt Seed;
+			nuInt Accumulators[4];
+			nuLong TotalLength;
+			nByte Buffer[16];
+			size_t BufferedSize;
+
+		private:
+			void processStripe(ncData data) noexcept
+			{
+				Accumulators[0] = Round(Accumulators[0], Read32(data));
+				Accumulators[1] = Round(Accumulators[1], Read32(data + 4));
+				Accumulators[2] = Round(Accumulators[2], Read32(data + 8));
+				Accumulators[3] = Round(Accumulators[3], Read32(data + 12));
+			}
+		};
+	}
+}
+
+namespace
+{
+	constexpr nuInt FrameMagic = 0x184D2204;
+	constexpr nuInt SkippableFrameMagic = 0x184D2A50;
+	constexpr nuInt SkippableFrameMagicMask = 0xFFFFFFF0;
+	constexpr nuInt LegacyFrameMagic = 0x184C2102;
+	constexpr nuInt UncompressedBlockFlag = 0x80000000;
+
+	constexpr nByte FrameVersion = 0x40;
+	constexpr nByte FrameVersionMask = 0xC0;
+	constexpr nByte BlockIndependenceFlag = 0x20;
+	constexpr nByte BlockChecksumFlag = 0x10;
+	constexpr nByte ContentSizeFlag = 0x08;
+	constexpr nByte ContentChecksumFlag = 0x04;
+	constexpr nByte ReservedFlag = 0x02;
+	constexpr nByte DictionaryIdFlag = 0x01;
+
+	// 块格式的限制：匹配最短为4字节，最后5字节必须为字面量，最后一个匹配必须在结尾12字节之前开始
+	constexpr nLen MinMatch = 4;
+	constexpr nLen LastLiterals = 5;
+	constexpr nLen MatchFindLimit = 12;
+	constexpr nLen MaxDistance = 65535;
+	constexpr nLen MaxInputSize = 4 * 1024 * 1024;
+	// 解压时在空间充足时以此大小为单位复制
+	constexpr nLen WildCopySize = 16;
+
+	constexpr int FastHashLog = 13;
+	constexpr int HighCompressionHashLog = 15;
+	constexpr nuInt HighCompressionMaxAttempts = 256;
+	// 连续未找到匹配时逐渐增大查找的步长
+	constexpr int SkipTrigger = 6;
+
+	nuInt read32(ncData data) noexcept
+	{
+		nuInt value;
+		std::memcpy(&value, data, sizeof value);
+		return value;
+	}
+
+	void writeLE32(nData data, nuInt value) noexcept
+	{
+		data[0] = static_cast<nByte>(value);
+		data[1] = static_cast<nByte>(value >> 8);
+		data[2] = static_cast<nByte>(value >> 16);
+		data[3] = static_cast<nByte>(value >> 24);
+	}
+
+	nuInt readLE32(ncData data) noexcept
+	{
+		return detail_::Xxh32State::Read32(data);
+	}
+
+	template <int HashLog>
+	nuInt hashPosition(ncData data) noexcept
+	{
+		return (read32(data) * detail_::Xxh32State::Prime1) >> (32 - HashLog);
+	}
+
+	nLen countMatch(ncData input, nLen position, nLen reference, nLen limit) noexcept
+	{
+		const auto start = position;
+
+		// 每次比较8字节，找到不同的8字节后再逐字节比较
+		while (position + sizeof(nuLong) <= limit)
+		{
+			nuLong current, referenced;
+			std::memcpy(&current, input + position, sizeof current);
+			std::memcpy(&referenced, input + reference, sizeof referenced);
+			if (current != referenced)
+			{
+				break;
+			}
+			position += sizeof(nuLong);
+			reference += sizeof(nuLong);
+		}
+
+		while (position < limit && input[position] == input[reference])
+		{
+			++position;
+			++reference;
+		}
+		return position - start;
+	}
+
+	nLen blockMaxSizeFromId(nByte id) noexcept
+	{
+		return nLen{ 1 } << (8 + 2 * id);
+	}
+
+	// 输出LZ4块格式的序列，空间不足时返回false
+	class SequenceWriter
+	{
+	public:
+		SequenceWriter(ncData inputEnd, nData output, nLen capacity) noexcept
+			: m_InputEnd{ inputEnd }, m_Output{ output }, m_Position{}, m_Capacity{ capacity }
+		{
+		}
+
+		nBool WriteSequence(ncData literals, nLen literalLength, nLen offset, nLen matchLength) noexcept
+		{
+			assert(offset > 0 && offset <= MaxDistance && matchLength >= MinMatch);
+
+			const auto extraMatchLength = matchLength - MinMatch;
+			const auto required = 1 + literalLength / 255 + 1 + literalLength + 2 + extraMatchLength / 255 + 1;
+			if (m_Capacity - m_Position < required)
+			{
+				return false;
+			}
+
+			auto& token = m_Output[m_Position++];
+			token = static_cast<nByte>(std::min<nLen>(literalLength, 15) << 4);
+			writeLength(literalLength);
+			// 输入及输出的剩余空间都足够时较短的字面量可以定长复制
+			if (literalLength <= WildCopySize && static_cast<nLen>(m_InputEnd - literals) >= WildCopySize && m_Capacity - m_Position >= WildCopySize)
+			{
+				std::memcpy(m_Output + m_Position, literals, WildCopySize);
+			}
+			else
+			{
+				std::memcpy(m_Output + m_Position, literals, static_cast<size_t>(literalLength));
+			}
+			m_Position += literalLength;
+
+			m_Output[m_Position++] = static_cast<nByte>(offset);
+			m_Output[m_Position++] = static_cast<nByte>(offset >> 8);
+
+			token |= static_cast<nByte>(std::min<nLen>(extraMatchLength, 15));
+			writeLength(extraMatchLength);
+
+			return true;
+		}
+
+		nBool WriteLastLiterals(ncData literals, nLen literalLength) noexcept
+		{
+			const auto required = 1 + literalLength / 255 + 1 + literalLength;
+			if (m_Capacity - m_Position < required)
+			{
+				return false;
+			}
+
+			m_Output[m_Position++] = static_cast<nByte>(std::min<nLen>(literalLength, 15) << 4);
+			writeLength(literalLength);
+			std::memcpy(m_Output + m_Position, literals, static_cast<size_t>(literalLength));
+			m_Position += literalLength;
+
+			return true;
+		}
+
+		nLen GetPosition() const noexcept
+		{
+			return m_Position;
+		}
+
+	private:
+		const ncData m_InputEnd;
+		nData m_Output;
+		nLen m_Position;
+		const nLen m_Capacity;
+
+		void writeLength(nLen length) noexcept
+		{
+			if (length < 15)
+			{
+				return;
+			}
+
+			length -= 15;
+			while (length >= 255)
+			{
+				m_Output[m_Position++] = 255;
+				length -= 255;
+			}
+			m_Output[m_Position++] = static_cast<nByte>(length);
+		}
+	};
+
+	nLen compressFast(ncData input, nLen inputSize, nData output, nLen outputCapacity)
+	{
+		SequenceWriter writer{ input + inputSize, output, outputCapacity };
+		nLen anchor = 0;
+
+		if (inputSize > MatchFindLimit)
+		{
+			std::vector<nuInt> hashTable(size_t{ 1 } << FastHashLog);
+			const auto matchFindLimit = inputSize - MatchFindLimit;
+			const auto matchLimit = inputSize - LastLiterals;
+
+			hashTable[hashPosition<FastHashLog>(input)] = 0;
+			nLen position = 1;
+
+			while (true)
+			{
+				nLen reference;
+				nuInt searchCount = 1u << SkipTrigger;
+				nLen step = 1;
+				while (true)
+				{
+					if (position > matchFindLimit)
+					{
+						goto lastLiterals;
+					}
+
+					auto& entry = hashTable[hashPosition<FastHashLog>(input + position)];
+					reference = entry;
+					entry = static_cast<nuInt>(position);
+					if (position - reference <= MaxDistance && read32(input + reference) == read32(input + position))
+					{
+						break;
+					}
+
+					position += step;
+					step = searchCount++ >> SkipTrigger;
+				}
+
+				// 向前扩展匹配
+				while (position > anchor && reference > 0 && input[position - 1] == input[reference - 1])
+				{
+					--position;
+					--reference;
+				}
+
+				const auto matchLength = MinMatch + countMatch(input, position + MinMatch, reference + MinMatch, matchLimit);
+				if (!writer.WriteSequence(input + anchor, position - anchor, position - reference, matchLength))
+				{
+					return 0;
+				}
+
+				position += matchLength;
+				anchor = position;
+				if (position > matchFindLimit)
+				{
+					break;
+				}
+
+				hashTable[hashPosition<FastHashLog>(input + position - 2)] = static_cast<nuInt>(position - 2);
+
+				// 匹配之后常常紧接着另一个匹配，先检查当前位置以免进入查找循环
+				auto& entry = hashTable[hashPosition<FastHashLog>(input + position)];
+				reference = entry;
+				entry = static_cast<nuInt>(position);
+				while (position - reference <= MaxDistance && read32(input + reference) == read32(input + position))
+				{
+					const auto nextMatchLength = MinMatch + countMatch(input, position + MinMatch, reference + MinMatch, matchLimit);
+					if (!writer.WriteSequence(input + anchor, 0, position - reference, nextMatchLength))
+					{
+						return 0;
+					}
+
+					position += nextMatchLength;
+					anchor = position;
+					if (position > matchFindLimit)
+					{
+						goto lastLiterals;
+					}
+
+					hashTable[hashPosition<FastHashLog>(input + position - 2)] = static_cast<nuInt>(position - 2);
+					auto& nextEntry = hashTable[hashPosition<FastHashLog>(input + position)];
+					reference = nextEntry;
+					nextEntry = static_cast<nuInt>(position);
+				}
+
+				++position;
+			}
+		}
+
+	lastLiterals:
+		if (!writer.WriteLastLiterals(input + anchor, inputSize - anchor))
+		{
+			return 0;
+		}
+
+		return writer.GetPosition();
+	}
+
+	class HashChain
+	{
+	public:
+		static constexpr nuInt NoPosition = std::numeric_limits<nuInt>::max();
+
+		explicit HashChain(ncData input) noexcept
+			: m_Input{ input }, m_Head(size_t{ 1 } << HighCompressionHashLog, NoPosition), m_Chain(MaxDistance + 1), m_NextToInsert{}
+		{
+		}
+
+		// 查找position处的最长匹配，返回匹配长度，不足MinMatch时返回0
+		nLen FindLongestMatch(nLen position, nLen matchLimit, nLen& reference)
+		{
+			insertUntil(position);
+
+			nLen bestLength = 0;
+			auto candidate = m_Head[hashPosition<HighCompressionHashLog>(m_Input + position)];
+			for (nuInt attempts = 0; candidate != NoPosition && position - candidate <= MaxDistance && attempts < HighCompressionMaxAttempts; ++attempts)
+			{
+				// 先比较当前最长匹配之后的字节以快速排除较短的匹配
+				if (m_Input[candidate + bestLength] == m_Input[position + bestLength] && read32(m_Input + candidate) == read32(m_Input + position))
+				{
+					const auto length = MinMatch + countMatch(m_Input, position + MinMatch, candidate + MinMatch, matchLimit);
+					if (length > bestLength)
+					{
+						bestLength = length;
+						reference = candidate;
+						if (position + length >= matchLimit)
+						{
+							break;
+						}
+					}
+				}
+
+				const auto delta = m_Chain[candidate & MaxDistance];
+				if (!delta)
+				{
+					break;
+				}
+				candidate -= delta;
+			}
+
+			return bestLength >= MinMatch ? bestLength : 0;
+		}
+
+	private:
+		ncData m_Input;
+		std::vector<nuInt> m_Head;
+		std::vector<nuShort> m_Chain;
+		nLen m_NextToInsert;
+
+		void insertUntil(nLen position)
+		{
+			for (; m_NextToInsert < position; ++m_NextToInsert)
+			{
+				auto& head = m_Head[hashPosition<HighCompressionHashLog>(m_Input + m_NextToInsert)];
+				const auto delta = head == NoPosition ? 0 : m_NextToInsert - head;
+				m_Chain[m_NextToInsert & MaxDistance] = static_cast<nuShort>(delta > MaxDistance ? 0 : delta);
+				head = static_cast<nuInt>(m_NextToInsert);
+			}
+		}
+	};
+
+	nLen compressHighCompression(ncData input, nLen inputSize, nData output, nLen outputCapacity)
+	{
+		SequenceWriter writer{ input + inputSize, output, outputCapacity };
+		nLen anchor = 0;
+
+		if (inputSize > MatchFindLimit)
+		{
+			HashChain hashChain{ input };
+			const auto matchFindLimit = inputSize - MatchFindLimit;
+			const auto matchLimit = inputSize - LastLiterals;
+
+			nLen position = 0;
+			while (position <= matchFindLimit)
+			{
+				nLen reference;
+				const auto matchLength = hashChain.FindLongestMatch(position, matchLimit, reference);
+				if (!matchLength)
+				{
+					++position;
+					continue;
+				}
+
+				// 若下一位置有更长的匹配则将当前字节作为字面量
+				auto bestPosition = position, bestLength = matchLength, bestReference = reference;
+				while (bestPosition + 1 <= matchFindLimit)
+				{
+					nLen nextReference;
+					const auto nextLength = hashChain.FindLongestMatch(bestPosition + 1, matchLimit, nextReference);
+					if (nextLength <= bestLength)
+					{
+						break;
+					}
+					++bestPosition;
+					bestLength = nextLength;
+					bestReference = nextReference;
+				}
+
+				if (!writer.WriteSequence(input + anchor, bestPosition - anchor, bestPosition - bestReference, bestLength))
+				{
+					return 0;
+				}
+
+				position = bestPosition + bestLength;
+				anchor = position;
+			}
+		}
+
+		if (!writer.WriteLastLiterals(input + anchor, inputSize - anchor))
+		{
+			return 0;
+		}
+
+		return writer.GetPosition();
+	}
+
+	// 解压块格式的数据，output之前的prefixSize字节为之前的块的数据，可以被匹配引用
+	nLen decompressBlock(ncData input, nLen inputSize, nData output, nLen outputCapacity, nLen prefixSize)
+	{
+		auto ip = input;
+		const auto inputEnd = input + inputSize;
+		auto op = output;
+		const auto outputEnd = output + outputCapacity;
+		const auto lowest = output - prefixSize;
+
+		const auto readLength = [&ip, inputEnd](nLen length)
+		{
+			if (length == 15)
+			{
+				nByte value;
+				do
+				{
+					if (ip == inputEnd)
+					{
+						nat_Throw(InvalidData, "Truncated LZ4 block."_nv);
+					}
+					value = *ip++;
+					length += value;
+				} while (value == 255);
+			}
+			return length;
+		};
+
+		while (true)
+		{
+			if (ip == inputEnd)
+			{
+				nat_Throw(InvalidData, "Truncated LZ4 block."_nv);
+			}
+
+			const auto token = *ip++;
+			const auto literalLength = readLength(token >> 4);
+			if (static_cast<nLen>(inputEnd - ip) < literalLength || static_cast<nLen>(outputEnd - op) < literalLength)
+			{
+				nat_Throw(InvalidData, "Invalid LZ4 block."_nv);
+			}
+			// 较短的字面量以定长复制，多复制的部分会被之后的数据覆盖
+			if (literalLength <= WildCopySize && static_cast<nLen>(inputEnd - ip) >= WildCopySize && static_cast<nLen>(outputEnd - op) >= WildCopySize)
+			{
+				std::memcpy(op, ip, WildCopySize);
+			}
+			else
+			{
+				std::memcpy(op, ip, static_cast<size_t>(literalLength));
+			}
+			ip += literalLength;
+			op += literalLength;
+
+			// 最后一个序列仅包含字面量
+			if (ip == inputEnd)
+			{
+				break;
+			}
+
+			if (inputEnd - ip < 2)
+			{
+				nat_Throw(InvalidData, "Truncated LZ4 block."_nv);
+			}
+			const nLen offset = ip[0] | static_cast<nLen>(ip[1]) << 8;
+			ip += 2;
+			if (!offset || static_cast<nLen>(op - lowest) < offset)
+			{
+				nat_Throw(InvalidData, "Invalid LZ4 match offset."_nv);
+			}
+
+			const auto matchLength = readLength(token & 15) + MinMatch;
+			if (static_cast<nLen>(outputEnd - op) < matchLength)
+			{
+				nat_Throw(InvalidData, "Invalid LZ4 block."_nv);
+			}
+
+			auto match = op - offset;
+			const auto matchEnd = op + matchLength;
+			if (offset >= WildCopySize && static_cast<nLen>(outputEnd - op) >= matchLength + WildCopySize)
+			{
+				// 每次复制的源与目标不重叠，多复制的部分会被之后的数据覆盖
+				do
+				{
+					std::memcpy(op, match, WildCopySize);
+					op += WildCopySize;
+					match += WildCopySize;
+				} while (op < matchEnd);
+				op = matchEnd;
+			}
+			else if (offset >= sizeof(nuLong) && static_cast<nLen>(outputEnd - op) >= matchLength + sizeof(nuLong))
+			{
+				do
+				{
+					std::memcpy(op, match, sizeof(nuLong));
+					op += sizeof(nuLong);
+					match += sizeof(nuLong);
+				} while (op < matchEnd);
+				op = matchEnd;
+			}
+			else
+			{
+				// 重叠的匹配需要逐字节复制以重复之前的数据
+				while (op < matchEnd)
+				{
+					*op++ = *match++;
+				}
+			}
+		}
+
+		return static_cast<nLen>(op - output);
+	}
+}
+
+natLz4Stream::natLz4Stream(natRefPointer<natStream> stream)
+	: natRefObjImpl{ std::move(stream) }, m_Compress{ false }, m_ThreadPool{}, m_MaxPendingBlocks{}
+{
+	initRead();
+}
+
+natLz4Stream::natLz4Stream(natRefPointer<natStream> stream, natThreadPool& threadPool, nuInt maxPendingBlocks)
+	: natRefObjImpl{ std::move(stream) }, m_Compress{ false }, m_ThreadPool{ &threadPool }, m_MaxPendingBlocks{ maxPendingBlocks }
+{
+	if (!m_MaxPendingBlocks)
+	{
+		m_MaxPendingBlocks = std::max(std::thread::hardware_concurrency(), 1u) * 2;
+	}
+
+	initRead();
+}
+
+natLz4Stream::natLz4Stream(natRefPointer<natStream> stream, CompressionLevel compressionLevel, nBool contentChecksum, BlockSize blockSize)
+	: natRefObjImpl{ std::move(stream) }, m_Compress{ true }, m_ThreadPool{}, m_MaxPendingBlocks{},
+	  m_CompressionLevel{ compressionLevel }, m_WriteContentChecksum{ contentChecksum }, m_WriteBlockSize{ blockSize }, m_WroteHeader{ false }, m_Finished{ false },
+	  m_InFrame{}, m_BlockIndependent{}, m_BlockChecksum{}, m_ContentChecksum{}, m_BlockMaxSize{ blockMaxSizeFromId(static_cast<nByte>(blockSize)) }, m_FrameEnded{}, m_EndOfStream{}, m_OutputPosition{}, m_OutputEnd{},
+	  m_Checksum{ std::make_unique<detail_::Xxh32State>() }
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be a valid pointer."_nv);
+	}
+
+	if (!m_InternalStream->CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be writable."_nv);
+	}
+
+	if (blockSize < BlockSize::Max64KB || blockSize > BlockSize::Max4MB)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "blockSize is invalid."_nv);
+	}
+
+	m_Buffer.reserve(static_cast<size_t>(m_BlockMaxSize));
+}
+
+natLz4Stream::~natLz4Stream()
+{
+	try
+	{
+		Finish();
+	}
+	catch (...)
+	{
+	}
+
+	// 解压任务引用了本对象，必须等待其完成
+	waitAllBlocks();
+}
+
+nBool natLz4Stream::CanWrite() const
+{
+	return m_Compress && !m_Finished;
+}
+
+nBool natLz4Stream::CanRead() const
+{
+	return !m_Compress;
+}
+
+nBool natLz4Stream::CanResize() const
+{
+	return false;
+}
+
+nBool natLz4Stream::CanSeek() const
+{
+	return false;
+}
+
+nBool natLz4Stream::IsEndOfStream() const
+{
+	if (m_Compress)
+	{
+		return m_InternalStream->IsEndOfStream();
+	}
+
+	return m_EndOfStream || (m_OutputPosition == m_OutputEnd && !m_InFrame && m_InternalStream->IsEndOfStream());
+}
+
+nLen natLz4Stream::GetSize() const
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetSize."_nv);
+}
+
+void natLz4Stream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetSize."_nv);
+}
+
+nLen natLz4Stream::GetPosition() const
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support GetPosition."_nv);
+}
+
+void natLz4Stream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+}
+
+nLen natLz4Stream::ReadBytes(nData pData, nLen Length)
+{
+	if (!CanRead())
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	nLen readBytes = 0;
+	while (readBytes < Length)
+	{
+		if (m_OutputPosition == m_OutputEnd && !fillOutput())
+		{
+			break;
+		}
+
+		const auto copyBytes = std::min(Length - readBytes, m_OutputEnd - m_OutputPosition);
+		std::memcpy(pData + readBytes, m_Output.data() + m_OutputPosition, static_cast<size_t>(copyBytes));
+		m_OutputPosition += copyBytes;
+		readBytes += copyBytes;
+	}
+
+	return readBytes;
+}
+
+nLen natLz4Stream::WriteBytes(ncData pData, nLen Length)
+{
+	if (!CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+	}
+
+	if (!m_WroteHeader)
+	{
+		writeHeader();
+	}
+
+	if (m_WriteContentChecksum)
+	{
+		m_Checksum->Update(pData, Length);
+	}
+
+	nLen writtenBytes = 0;
+	while (writtenBytes < Length)
+	{
+		const auto copyBytes = std::min(Length - writtenBytes, m_BlockMaxSize - m_Buffer.size());
+		m_Buffer.insert(m_Buffer.end(), pData + writtenBytes, pData + writtenBytes + copyBytes);
+		writtenBytes += copyBytes;
+
+		if (m_Buffer.size() == m_BlockMaxSize)
+		{
+			writeCurrentBlock();
+		}
+	}
+
+	return writtenBytes;
+}
+
+void natLz4Stream::Flush()
+{
+	if (CanWrite() && !m_Buffer.empty())
+	{
+		writeCurrentBlock();
+	}
+
+	m_InternalStream->Flush();
+}
+
+nLen natLz4Stream::Finish()
+{
+	if (!m_Compress || m_Finished)
+	{
+		return 0;
+	}
+
+	m_Finished = true;
+
+	nLen wroteBytes = 0;
+	if (!m_WroteHeader)
+	{
+		wroteBytes += writeHeader();
+	}
+	wroteBytes += writeCurrentBlock();
+
+	nByte end[8];
+	nLen endSize = 4;
+	writeLE32(end, 0);
+	if (m_WriteContentChecksum)
+	{
+		writeLE32(end + 4, m_Checksum->Digest());
+		endSize += 4;
+	}
+	m_InternalStream->WriteBytes(end, endSize);
+
+	return wroteBytes + endSize;
+}
+
+nLen natLz4Stream::CompressBound(nLen inputSize) noexcept
+{
+	return inputSize + inputSize / 255 + 16;
+}
+
+nLen natLz4Stream::CompressBlock(ncData input, nLen inputSize, nData output, nLen outputCapacity, CompressionLevel compressionLevel)
+{
+	if (inputSize > MaxInputSize)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "inputSize is too big."_nv);
+	}
+
+	switch (compressionLevel)
+	{
+	case CompressionLevel::HighCompression:
+		return compressHighCompression(input, inputSize, output, outputCapacity);
+	default:
+		assert(!"Invalid compressionLevel.");
+		[[fallthrough]];
+	case CompressionLevel::Fast:
+		return compressFast(input, inputSize, output, outputCapacity);
+	}
+}
+
+nLen natLz4Stream::DecompressBlock(ncData input, nLen inputSize, nData output, nLen outputCapacity)
+{
+	return decompressBlock(input, inputSize, output, outputCapacity, 0);
+}
+
+void natLz4Stream::initRead()
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be a valid pointer."_nv);
+	}
+
+	if (!m_InternalStream->CanRead())
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should be readable."_nv);
+	}
+
+	m_CompressionLevel = CompressionLevel::Fast;
+	m_WriteContentChecksum = false;
+	m_WriteBlockSize = BlockSize::Max64KB;
+	m_WroteHeader = false;
+	m_Finished = false;
+	m_InFrame = false;
+	m_BlockIndependent = false;
+	m_BlockChecksum = false;
+	m_ContentChecksum = false;
+	m_BlockMaxSize = 0;
+	m_FrameEnded = false;
+	m_EndOfStream = false;
+	m_OutputPosition = 0;
+	m_OutputEnd = 0;
+	m_Checksum = std::make_unique<detail_::Xxh32State>();
+}
+
+nLen natLz4Stream::writeHeader()
+{
+	nByte header[7];
+	writeLE32(header, FrameMagic);
+	header[4] = FrameVersion | BlockIndependenceFlag | (m_WriteContentChecksum ? ContentChecksumFlag : 0);
+	header[5] = static_cast<nByte>(static_cast<nByte>(m_WriteBlockSize) << 4);
+	header[6] = static_cast<nByte>(detail_::Xxh32State::Compute(header + 4, 2) >> 8);
+
+	m_InternalStream->WriteBytes(header, sizeof header);
+	m_WroteHeader = true;
+
+	return sizeof header;
+}
+
+nLen natLz4Stream::writeCurrentBlock()
+{
+	if (m_Buffer.empty())
+	{
+		return 0;
+	}
+
+	m_Output.resize(static_cast<size_t>(CompressBound(m_Buffer.size()) + sizeof(nuInt)));
+	auto compressedSize = CompressBlock(m_Buffer.data(), m_Buffer.size(), m_Output.data() + sizeof(nuInt), m_Output.size() - sizeof(nuInt), m_CompressionLevel);
+
+	// 无法压缩的块直接保存
+	if (!compressedSize || compressedSize >= m_Buffer.size())
+	{
+		compressedSize = m_Buffer.size();
+		std::memcpy(m_Output.data() + sizeof(nuInt), m_Buffer.data(), m_Buffer.size());
+		writeLE32(m_Output.data(), static_cast<nuInt>(compressedSize) | UncompressedBlockFlag);
+	}
+	else
+	{
+		writeLE32(m_Output.data(), static_cast<nuInt>(compressedSize));
+	}
+
+	m_Buffer.clear();
+
+	const auto blockSize = compressedSize + sizeof(nuInt);
+	m_InternalStream->WriteBytes(m_Output.data(), blockSize);
+
+	return blockSize;
+}
+
+void natLz4Stream::readExactly(nData buffer, nLen length)
+{
+	nLen readBytes = 0;
+	while (readBytes < length)
+	{
+		const auto currentReadBytes = m_InternalStream->ReadBytes(buffer + readBytes, length - readBytes);
+		if (!currentReadBytes)
+		{
+			nat_Throw(InvalidData, "Unexpected end of LZ4 stream."_nv);
+		}
+		readBytes += currentReadBytes;
+	}
+}
+
+nBool natLz4Stream::readFrameHeader()
+{
+	while (true)
+	{
+		nByte magic[4];
+		const auto readBytes = m_InternalStream->ReadBytes(magic, sizeof magic);
+		if (!readBytes)
+		{
+			return false;
+		}
+		readExactly(magic + readBytes, sizeof magic - readBytes);
+
+		const auto magicNumber = readLE32(magic);
+		if ((magicNumber & SkippableFrameMagicMask) == SkippableFrameMagic)
+		{
+			nByte sizeBytes[4];
+			readExactly(sizeBytes, sizeof sizeBytes);
+			auto skipSize = static_cast<nLen>(readLE32(sizeBytes));
+
+			nByte buffer[4096];
+			while (skipSize)
+			{
+				const auto currentSkipSize = std::min<nLen>(skipSize, sizeof buffer);
+				readExactly(buffer, currentSkipSize);
+				skipSize -= currentSkipSize;
+			}
+			continue;
+		}
+
+		if (magicNumber == LegacyFrameMagic)
+		{
+			nat_Throw(natErrException, NatErr_NotSupport, "Legacy LZ4 frame is not supported."_nv);
+		}
+
+		if (magicNumber != FrameMagic)
+		{
+			nat_Throw(InvalidData, "Invalid LZ4 frame magic number."_nv);
+		}
+
+		// 帧描述符最长为FLG、BD、内容大小（8字节）、字典ID（4字节）及头部校验和
+		nByte descriptor[15];
+		readExactly(descriptor, 2);
+		const auto flag = descriptor[0];
+		if ((flag & FrameVersionMask) != FrameVersion || flag & ReservedFlag)
+		{
+			nat_Throw(InvalidData, "Unsupported LZ4 frame version or flags."_nv);
+		}
+		if (flag & DictionaryIdFlag)
+		{
+			nat_Throw(natErrException, NatErr_NotSupport, "LZ4 frame with dictionary is not supported."_nv);
+		}
+
+		const auto blockSizeId = static_cast<nByte>((descriptor[1] >> 4) & 7);
+		if (blockSizeId < static_cast<nByte>(BlockSize::Max64KB) || descriptor[1] & 0x8F)
+		{
+			nat_Throw(InvalidData, "Invalid LZ4 block descriptor."_nv);
+		}
+
+		const nLen descriptorSize = 2 + (flag & ContentSizeFlag ? 8 : 0);
+		readExactly(descriptor + 2, descriptorSize - 2 + 1);
+		if (descriptor[descriptorSize] != static_cast<nByte>(detail_::Xxh32State::Compute(descriptor, descriptorSize) >> 8))
+		{
+			nat_Throw(InvalidData, "LZ4 frame header checksum mismatch."_nv);
+		}
+
+		m_BlockIndependent = (flag & BlockIndependenceFlag) != 0;
+		m_BlockChecksum = (flag & BlockChecksumFlag) != 0;
+		m_ContentChecksum = (flag & ContentChecksumFlag) != 0;
+		m_BlockMaxSize = blockMaxSizeFromId(blockSizeId);
+		m_InFrame = true;
+		m_FrameEnded = false;
+		m_OutputPosition = 0;
+		m_OutputEnd = 0;
+		m_Checksum->Reset();
+
+		return true;
+	}
+}
+
+void natLz4Stream::readFrameEnd()
+{
+	if (m_ContentChecksum)
+	{
+		nByte checksum[4];
+		readExactly(checksum, sizeof checksum);
+		if (readLE32(checksum) != m_Checksum->Digest())
+		{
+			nat_Throw(InvalidData, "LZ4 content checksum mismatch."_nv);
+		}
+	}
+
+	m_InFrame = false;
+}
+
+nBool natLz4Stream::readBlock(Block& block)
+{
+	nByte sizeBytes[4];
+	readExactly(sizeBytes, sizeof sizeBytes);
+	const auto blockSize = readLE32(sizeBytes);
+	if (!blockSize)
+	{
+		return false;
+	}
+
+	const auto dataSize = static_cast<nLen>(blockSize & ~UncompressedBlockFlag);
+	if (dataSize > m_BlockMaxSize)
+	{
+		nat_Throw(InvalidData, "LZ4 block is too big."_nv);
+	}
+
+	block.Compressed = !(blockSize & UncompressedBlockFlag);
+	block.Ready = false;
+	block.Input.resize(static_cast<size_t>(dataSize));
+	readExactly(block.Input.data(), dataSize);
+
+	if (m_BlockChecksum)
+	{
+		nByte checksum[4];
+		readExactly(checksum, sizeof checksum);
+		if (readLE32(checksum) != detail_::Xxh32State::Compute(block.Input.data(), dataSize))
+		{
+			nat_Throw(InvalidData, "LZ4 block checksum mismatch."_nv);
+		}
+	}
+
+	return true;
+}
+
+nBool natLz4Stream::fillOutput()
+{
+	while (true)
+	{
+		if (!m_InFrame && !readFrameHeader())
+		{
+			m_EndOfStream = true;
+			return false;
+		}
+
+		if (m_ThreadPool && m_BlockIndependent)
+		{
+			fillPendingBlocks();
+
+			std::unique_ptr<Block> block;
+			{
+				std::unique_lock<std::mutex> lock{ m_Mutex };
+				if (!m_PendingBlocks.empty())
+				{
+					m_BlockReady.wait(lock, [this]
+					{
+						return m_PendingBlocks.front()->Ready;
+					});
+					block = std::move(m_PendingBlocks.front());
+					m_PendingBlocks.pop_front();
+				}
+			}
+
+			if (!block)
+			{
+				readFrameEnd();
+				continue;
+			}
+
+			if (block->Exception)
+			{
+				std::rethrow_exception(block->Exception);
+			}
+
+			m_Output.swap(block->Output);
+			m_OutputPosition = 0;
+			m_OutputEnd = m_Output.size();
+		}
+		else
+		{
+			Block block;
+			if (!readBlock(block))
+			{
+				readFrameEnd();
+				continue;
+			}
+
+			// 相互依赖的块需要保留之前最多64KiB的数据作为历史
+			nLen prefixSize = 0;
+			if (!m_BlockIndependent && m_OutputEnd)
+			{
+				prefixSize = std::min(m_OutputEnd, static_cast<nLen>(HistorySize));
+				std::memmove(m_Output.data(), m_Output.data() + m_OutputEnd - prefixSize, static_cast<size_t>(prefixSize));
+			}
+
+			m_Output.resize(static_cast<size_t>(prefixSize + m_BlockMaxSize));
+			nLen outputSize;
+			if (block.Compressed)
+			{
+				outputSize = decompressBlock(block.Input.data(), block.Input.size(), m_Output.data() + prefixSize, m_BlockMaxSize, prefixSize);
+			}
+			else
+			{
+				outputSize = block.Input.size();
+				std::memcpy(m_Output.data() + prefixSize, block.Input.data(), static_cast<size_t>(outputSize));
+			}
+
+			m_OutputPosition = prefixSize;
+			m_OutputEnd = prefixSize + outputSize;
+		}
+
+		if (m_ContentChecksum)
+		{
+			m_Checksum->Update(m_Output.data() + m_OutputPosition, m_OutputEnd - m_OutputPosition);
+		}
+
+		if (m_OutputPosition != m_OutputEnd)
+		{
+			return true;
+		}
+	}
+}
+
+void natLz4Stream::fillPendingBlocks()
+{
+	while (!m_FrameEnded)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			if (m_PendingBlocks.size() >= m_MaxPendingBlocks)
+			{
+				break;
+			}
+		}
+
+		auto block = std::make_unique<Block>();
+		if (!readBlock(*block))
+		{
+			m_FrameEnded = true;
+			break;
+		}
+
+		const auto pBlock = block.get();
+		const auto blockMaxSize = m_BlockMaxSize;
+		{
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			m_PendingBlocks.emplace_back(std::move(block));
+		}
+
+		m_ThreadPool->QueueWork([this, pBlock, blockMaxSize](void*)
+		{
+			try
+			{
+				if (pBlock->Compressed)
+				{
+					pBlock->Output.resize(static_cast<size_t>(blockMaxSize));
+					pBlock->Output.resize(static_cast<size_t>(decompressBlock(pBlock->Input.data(), pBlock->Input.size(), pBlock->Output.data(), blockMaxSize, 0)));
+				}
+				else
+				{
+					pBlock->Output.swap(pBlock->Input);
+				}
+			}
+			catch (...)
+			{
+				pBlock->Exception = std::current_exception();
+			}
+
+			// 必须在持有锁时通知，否则等待者可能在通知前析构本对象
+			std::lock_guard<std::mutex> lock{ m_Mutex };
+			pBlock->Ready = true;
+			m_BlockReady.notify_all();
+
+			return NatErr_OK;
+		});
+	}
+}
+
+void natLz4Stream::waitAllBlocks()
+{
+	std::unique_lock<std::mutex> lock{ m_Mutex };
+	m_BlockReady.wait(lock, [this]
+	{
+		return std::all_of(m_PendingBlocks.begin(), m_PendingBlocks.end(), [](std::unique_ptr<Block> const& block)
+		{
+			return block->Ready;
+		});
+	});
+}
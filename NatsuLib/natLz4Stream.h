@@ -0,0 +1,151 @@
+﻿#pragma once
+#include "natConfig.h"
+#include "natStream.h"
+#include "natMultiThread.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
+namespace NatsuLib
+{
+	namespace detail_
+	{
+		struct Xxh32State;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	LZ4压缩流
+	///	@remark	读写LZ4帧格式的数据，与lz4命令行工具兼容\n
+	///			压缩及解压速度远高于deflate，适合临时文件及缓存等需要频繁读写的数据
+	///	@note	写入时各块独立压缩，读取时同时支持独立及相互依赖的块\n
+	///			读取时若提供线程池且块相互独立，将在线程池中预先解压之后的块\n
+	///			读取时支持拼接的多个帧及可跳过的帧，不支持使用预设字典的帧
+	////////////////////////////////////////////////////////////////////////////////
+	class natLz4Stream
+		: public natRefObjImpl<natLz4Stream, natWrappedStream>, public nonmovable
+	{
+	public:
+		enum class CompressionLevel
+		{
+			///	@brief	使用哈希表查找匹配，速度最快
+			Fast,
+			///	@brief	使用哈希链查找最长匹配，压缩率更高但压缩速度较慢，解压速度不变
+			HighCompression,
+		};
+
+		///	@brief	块的最大大小
+		enum class BlockSize : nByte
+		{
+			Max64KB = 4,
+			Max256KB = 5,
+			Max1MB = 6,
+			Max4MB = 7,
+		};
+
+		///	@brief	以读取模式创建流，读取时解压数据
+		explicit natLz4Stream(natRefPointer<natStream> stream);
+		///	@brief	以读取模式创建流，在threadPool中预先解压之后的块
+		///	@param	maxPendingBlocks	最多同时解压的块的数量，为0时使用硬件线程数的两倍
+		///	@note	必须保证线程池在本流析构之后才析构，块相互依赖时将在调用者线程中解压
+		natLz4Stream(natRefPointer<natStream> stream, natThreadPool& threadPool, nuInt maxPendingBlocks = 0);
+		///	@brief	以写入模式创建流，写入时压缩数据
+		///	@param	contentChecksum	是否在帧的末尾写入全部数据的校验和
+		natLz4Stream(natRefPointer<natStream> stream, CompressionLevel compressionLevel, nBool contentChecksum = true, BlockSize blockSize = BlockSize::Max64KB);
+		///	@brief	写入模式下调用Finish结束帧
+		///	@note	此时发生的异常将被忽略，需要得知写入是否成功时请在析构前调用Finish
+		~natLz4Stream();
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+		void SetSize(nLen /*Size*/) override;
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek /*Origin*/, nLong /*Offset*/) override;
+		nLen ReadBytes(nData pData, nLen Length) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		///	@brief	写入模式下将当前的块压缩并写出后刷新内部流
+		void Flush() override;
+
+		///	@brief	写出剩余的块、结束标记及校验和，之后不能再写入
+		///	@return	本次写出到内部流的字节数
+		nLen Finish();
+
+		///	@brief	获得压缩inputSize字节的数据为块格式所需的最大空间
+		static nLen CompressBound(nLen inputSize) noexcept;
+		///	@brief	将数据压缩为LZ4块格式
+		///	@param	outputCapacity	输出缓冲区的大小，不小于CompressBound(inputSize)时必然成功
+		///	@return	写入output的字节数，空间不足时返回0
+		///	@note	inputSize不能超过4MiB
+		static nLen CompressBlock(ncData input, nLen inputSize, nData output, nLen outputCapacity, CompressionLevel compressionLevel = CompressionLevel::Fast);
+		///	@brief	解压LZ4块格式的数据
+		///	@return	写入output的字节数
+		///	@note	数据无效或输出缓冲区不足时抛出InvalidData异常
+		static nLen DecompressBlock(ncData input, nLen inputSize, nData output, nLen outputCapacity);
+
+	private:
+		enum : nLen
+		{
+			// 相互依赖的块可以引用之前最多64KiB的数据
+			HistorySize = 64 * 1024,
+		};
+
+		struct Block
+		{
+			std::vector<nByte> Input;
+			std::vector<nByte> Output;
+			nBool Compressed;
+			nBool Ready;
+			std::exception_ptr Exception;
+		};
+
+		const nBool m_Compress;
+		natThreadPool* m_ThreadPool;
+		nuInt m_MaxPendingBlocks;
+
+		// 写入模式使用
+		CompressionLevel m_CompressionLevel;
+		nBool m_WriteContentChecksum;
+		BlockSize m_WriteBlockSize;
+		nBool m_WroteHeader;
+		nBool m_Finished;
+
+		// 读取模式使用，当前帧的参数
+		nBool m_InFrame;
+		nBool m_BlockIndependent;
+		nBool m_BlockChecksum;
+		nBool m_ContentChecksum;
+		nLen m_BlockMaxSize;
+		nBool m_FrameEnded;
+		nBool m_EndOfStream;
+		// 解压后尚未被读取的数据为m_Output[m_OutputPosition, m_OutputEnd)，块相互依赖时之前的数据作为历史保留在其前
+		nLen m_OutputPosition;
+		nLen m_OutputEnd;
+
+		// 写入模式下为未压缩的当前块，读取模式下为解压后的数据
+		std::vector<nByte> m_Buffer;
+		std::vector<nByte> m_Output;
+		// 写入模式下为写入的数据的校验和，读取模式下为当前帧已读取的数据的校验和
+		std::unique_ptr<detail_::Xxh32State> m_Checksum;
+
+		// 以下成员由m_Mutex保护
+		std::mutex m_Mutex;
+		std::condition_variable m_BlockReady;
+		std::deque<std::unique_ptr<Block>> m_PendingBlocks;
+
+		void initRead();
+
+		nLen writeHeader();
+		nLen writeCurrentBlock();
+
+		void readExactly(nData buffer, nLen length);
+		nBool readFrameHeader();
+		void readFrameEnd();
+		nBool readBlock(Block& block);
+		nBool fillOutput();
+		void fillPendingBlocks();
+		void waitAllBlocks();
+	};
+}
@@ -7,6 +7,7 @@
 #include <functional>
 #include <cassert>
 #include <tuple>
+#include <exception>
 
 #define MAKE_ENUM_CLASS_BITMASK_TYPE(enumName) static_assert(std::is_enum<enumName>::value, #enumName " is not a enum.");\
 	constexpr enumName operator|(enumName a, enumName b) noexcept\
@@ -1,4 +1,4 @@
-#include "stdafx.h"
+﻿#include "stdafx.h"
 #include "natMultiThread.h"
 #include "natException.h"
 #include "natMisc.h"
@@ -8,18 +8,16 @@
 using namespace NatsuLib;
 
 natThread::natThread(nBool Pause)
-	: m_Paused(Pause), m_Thread([this]()
+	: m_Paused(Pause), m_Result(m_ResultPromise.get_future()), m_Thread([this]()
 {
 	m_Pause.get_future().get();
-	std::promise<ResultType> Result;
-	m_Result = Result.get_future();
 	try
 	{
-		Result.set_value(ThreadJob());
+		m_ResultPromise.set_value(ThreadJob());
 	}
 	catch (...)
 	{
-		Result.set_exception(std::current_exception());
+		m_ResultPromise.set_exception(std::current_exception());
 	}
 })
 {
@@ -127,69 +125,90 @@ natThreadPool::natThreadPool(nuInt InitialThreadCount, nuInt MaxThreadCount)
 		nat_Throw(natException, "Max thread count({0}) should be bigger than total thread count({1})."_nv, m_MaxThreadCount, InitialThreadCount);
 	}
 
+	std::lock_guard<std::mutex> lock{ m_Mutex };
 	nuInt Index;
 	while (InitialThreadCount)
 	{
 		--InitialThreadCount;
 		Index = getNextAvailableIndex();
-		m_Threads[Index] = std::make_unique<WorkerThread>(*this, Index);
+		(m_Threads[Index] = std::make_unique<WorkerThread>(*this, Index))->Resume();
 	}
 }
 
 natThreadPool::~natThreadPool()
 {
+	// 工作线程引用了线程池，必须在析构成员前全部退出
+	WaitAllJobsFinish();
+	m_Threads.clear();
 }
 
 void natThreadPool::KillIdleThreads()
 {
-	for (auto&& thread : m_Threads)
 	{
-		if (thread.second->IsIdle())
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		for (auto&& thread : m_Threads)
 		{
-			thread.second->RequestTerminate();
+			if (thread.second->IsIdle())
+			{
+				thread.second->RequestTerminate();
+			}
 		}
 	}
+	m_WorkAvailable.notify_all();
 }
 
 void natThreadPool::KillAllThreads()
 {
-	for (auto&& thread : m_Threads)
 	{
-		thread.second->RequestTerminate();
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		for (auto&& thread : m_Threads)
+		{
+			thread.second->RequestTerminate();
+		}
 	}
+	m_WorkAvailable.notify_all();
 }
 
 std::future<natThreadPool::WorkToken> natThreadPool::QueueWork(WorkFunc workFunc, void* param)
 {
-	auto Index = getIdleThreadIndex();
-	if (Index == std::numeric_limits<nuInt>::max() && m_Threads.size() < m_MaxThreadCount)
-	{
-		auto availableIndex = getNextAvailableIndex();
-		auto&& thread = m_Threads[availableIndex] = std::make_unique<WorkerThread>(*this, availableIndex);
-		auto&& result = thread->SetWork(workFunc, param);
-		std::promise<WorkToken> dummyPromise;
-		auto ret = dummyPromise.get_future();
-		dummyPromise.set_value(WorkToken(availableIndex, move(result)));
-		return ret;
-	}
+	std::future<WorkToken> ret;
 
-	if (Index != std::numeric_limits<nuInt>::max())
 	{
-		auto&& result = m_Threads[Index]->SetWork(workFunc, param);
-		std::promise<WorkToken> dummyPromise;
-		auto ret = dummyPromise.get_future();
-		dummyPromise.set_value(WorkToken(Index, move(result)));
-		return ret;
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		reapTerminatedThreads();
+
+		Work work{ std::move(workFunc), param, std::promise<WorkToken>{} };
+		ret = std::get<2>(work).get_future();
+		m_WorkQueue.emplace(std::move(work));
+
+		nuInt idleCount = 0, aliveCount = 0;
+		for (auto&& thread : m_Threads)
+		{
+			if (!thread.second->IsTerminating())
+			{
+				++aliveCount;
+				if (thread.second->IsIdle())
+				{
+					++idleCount;
+				}
+			}
+		}
+
+		if (idleCount < m_WorkQueue.size() && aliveCount < m_MaxThreadCount)
+		{
+			// 必须在构造完成后再启动，否则线程可能调用到基类的ThreadJob
+			const auto Index = getNextAvailableIndex();
+			(m_Threads[Index] = std::make_unique<WorkerThread>(*this, Index))->Resume();
+		}
 	}
 
-	auto work = make_tuple(workFunc, param, std::promise<WorkToken>());
-	auto ret = std::get<2>(work).get_future();
-	m_WorkQueue.emplace(move(work));
+	m_WorkAvailable.notify_one();
 	return ret;
 }
 
 natThread::ThreadIdType natThreadPool::GetThreadId(nuInt Index) const
 {
+	std::lock_guard<std::mutex> lock{ m_Mutex };
 	auto iter = m_Threads.find(Index);
 	if (iter == m_Threads.end())
 	{
@@ -201,100 +220,81 @@ natThread::ThreadIdType natThreadPool::GetThreadId(nuInt Index) const
 
 void natThreadPool::WaitAllJobsFinish(nuInt WaitTime)
 {
-	KillIdleThreads();
-	for (auto&& thread : m_Threads)
+	// 工作线程会先处理完队列中剩余的工作再退出
+	KillAllThreads();
+
+	std::vector<WorkerThread*> threads;
 	{
-		thread.second->RequestTerminate();
+		std::lock_guard<std::mutex> lock{ m_Mutex };
+		threads.reserve(m_Threads.size());
+		for (auto&& thread : m_Threads)
+		{
+			threads.emplace_back(thread.second.get());
+		}
 	}
-	for (auto&& thread : m_Threads)
+
+	// 等待时不能持有锁，否则工作线程无法取得剩余的工作
+	for (auto thread : threads)
 	{
-		thread.second->Wait(WaitTime);
+		thread->Wait(WaitTime);
 	}
 }
 
 natThreadPool::WorkerThread::WorkerThread(natThreadPool& pool, nuInt Index)
-	: natThread(true), m_Pool(pool), m_Index(Index), m_Arg(nullptr), m_First(true), m_Idle(true), m_ShouldTerminate(false)
+	: natThread(true), m_Pool(pool), m_Index(Index), m_Idle(true), m_ShouldTerminate(false)
 {
 }
 
-natThreadPool::WorkerThread::WorkerThread(natThreadPool& pool, nuInt Index,WorkFunc CallableObj, void* Param)
-	: WorkerThread(pool, Index)
-{
-	SetWork(CallableObj, Param);
-}
-
 nBool natThreadPool::WorkerThread::IsIdle() const
 {
-	return m_Idle;
+	return m_Idle.load(std::memory_order_acquire);
 }
 
-std::future<nuInt> natThreadPool::WorkerThread::SetWork(WorkFunc CallableObj, void* Param)
+nBool natThreadPool::WorkerThread::IsTerminating() const
 {
-	m_CallableObj = std::move(CallableObj);
-	m_Arg = Param;
-	m_Idle = false;
-	m_LastResult = std::promise<nuInt>{};
-	if (m_First)
-	{
-		Resume();
-		m_First = false;
-	}
-	else
-	{
-		m_Cond.notify_one();
-	}
-	return m_LastResult.get_future();
+	return m_ShouldTerminate.load(std::memory_order_acquire);
 }
 
 void natThreadPool::WorkerThread::RequestTerminate()
 {
-	if (m_ShouldTerminate.load(std::memory_order_acquire))
-	{
-		return;
-	}
-
 	m_ShouldTerminate.store(true, std::memory_order_release);
-
-	if (m_Idle)
-	{
-		if (m_First)
-		{
-			Resume();
-			m_First = false;
-		}
-		m_Cond.notify_one();
-	}
 }
 
 natThread::ResultType natThreadPool::WorkerThread::ThreadJob()
 {
 	while (true)
 	{
-		auto value = m_ShouldTerminate.load(std::memory_order_acquire);
-		if (value)
+		Work work;
+
 		{
-			break;
+			std::unique_lock<std::mutex> lock{ m_Pool.m_Mutex };
+			m_Pool.m_WorkAvailable.wait(lock, [this]
+			{
+				return IsTerminating() || !m_Pool.m_WorkQueue.empty();
+			});
+
+			if (m_Pool.m_WorkQueue.empty())
+			{
+				break;
+			}
+
+			work = std::move(m_Pool.m_WorkQueue.front());
+			m_Pool.m_WorkQueue.pop();
+			m_Idle.store(false, std::memory_order_release);
 		}
 
-		m_Idle = false;
+		std::promise<nuInt> result;
+		std::get<2>(work).set_value(WorkToken(m_Index, result.get_future()));
 		try
 		{
-			m_LastResult.set_value(m_CallableObj(m_Arg));
+			result.set_value(std::get<0>(work)(std::get<1>(work)));
 		}
 		catch (...)
 		{
-			m_LastResult.set_exception(std::current_exception());
+			result.set_exception(std::current_exception());
 		}
-		m_Idle = true;
-		m_Pool.onWorkerThreadIdle(m_Index, value);
 
-		{
-			std::unique_lock<std::mutex> lock{ m_Mutex };
-			if (!value && m_Idle)
-			{
-				m_Cond.wait(lock);
-			}
-		}
+		m_Idle.store(true, std::memory_order_release);
 	}
 
 	return NatErr_OK;
@@ -302,12 +302,6 @@ natThread::ResultType natThreadPool::WorkerThread::ThreadJob()
 
 nuInt natThreadPool::getNextAvailableIndex()
 {
-	m_Section.Lock();
-	auto scope = make_scope([this]()
-	{
-		m_Section.UnLock();
-	});
-
 	for (nuInt i = 0; i < std::numeric_limits<nuInt>::max(); ++i)
 	{
 		if (m_Threads.find(i) == m_Threads.end())
@@ -319,30 +313,17 @@ nuInt natThreadPool::getNextAvailableIndex()
 	nat_Throw(natException, "No available index."_nv);
 }
 
-nuInt natThreadPool::getIdleThreadIndex()
+void natThreadPool::reapTerminatedThreads()
 {
-	natRefScopeGuard<natCriticalSection> guard{ m_Section };
-
-	for (auto&& thread : m_Threads)
+	for (auto iter = m_Threads.begin(); iter != m_Threads.end();)
 	{
-		if (thread.second->IsIdle())
+		if (iter->second->IsTerminating() && iter->second->Wait(0))
 		{
-			return thread.first;
+			iter = m_Threads.erase(iter);
+		}
+		else
+		{
+			++iter;
 		}
-	}
-
-	return std::numeric_limits<nuInt>::max();
-}
-
-void natThreadPool::onWorkerThreadIdle(nuInt Index, nBool isTerminating)
-{
-	natRefScopeGuard<natCriticalSection> guard{ m_Section };
-
-	if (!isTerminating && !m_WorkQueue.empty())
-	{
-		auto&& work = m_WorkQueue.front();
-		auto&& ret = m_Threads[Index]->SetWork(std::get<0>(work), std::get<1>(work));
-		std::get<2>(work).set_value(WorkToken(Index, std::move(ret)));
-		m_WorkQueue.pop();
 	}
 }
@@ -13,6 +13,10 @@
 #include <atomic>
 #include <queue>
 #include <future>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+#include <vector>
 #include "natMisc.h"
 
 #ifdef _MSC_VER
@@ -75,6 +79,7 @@ namespace NatsuLib
 	private:
 		std::atomic_bool m_Paused;
 		std::promise<void> m_Pause;
+		std::promise<ResultType> m_ResultPromise;
 		std::future<ResultType> m_Result;
 		std::thread m_Thread;
 	};
@@ -107,6 +112,28 @@ namespace NatsuLib
 #endif
 	};
 
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	ٽ
+	///	@note	κͬnatCriticalSectionΪɵ߳ʹõĶ
+	////////////////////////////////////////////////////////////////////////////////
+	class natNullCriticalSection final
+		: public nonmovable
+	{
+	public:
+		void Lock() noexcept
+		{
+		}
+
+		nBool TryLock() noexcept
+		{
+			return true;
+		}
+
+		void UnLock() noexcept
+		{
+		}
+	};
+
 	namespace detail_
 	{
 		template <typename T, typename Enable = void>
@@ -285,11 +312,10 @@ namespace NatsuLib
 		{
 		public:
 			WorkerThread(natThreadPool& pool, nuInt Index);
-			WorkerThread(natThreadPool& pool, nuInt Index, WorkFunc CallableObj, void* Param = nullptr);
 			~WorkerThread() = default;
 
 			nBool IsIdle() const;
-			std::future<nuInt> SetWork(WorkFunc CallableObj, void* Param = nullptr);
+			nBool IsTerminating() const;
 
 			void RequestTerminate();
 
@@ -298,24 +324,20 @@ namespace NatsuLib
 
 			natThreadPool& m_Pool;
 			const nuInt m_Index;
-			WorkFunc m_CallableObj;
-			void* m_Arg;
-			bool m_First;
-			std::promise<nuInt> m_LastResult;
-			std::mutex m_Mutex;
-			std::condition_variable m_Cond;
 
 			std::atomic<nBool> m_Idle, m_ShouldTerminate;
 		};
 
+		typedef std::tuple<WorkFunc, void*, std::promise<WorkToken>> Work;
+
 		nuInt getNextAvailableIndex();
-		nuInt getIdleThreadIndex();
-		void onWorkerThreadIdle(nuInt Index, nBool isTerminating);
+		void reapTerminatedThreads();
 
 		const nuInt m_MaxThreadCount;
 		std::unordered_map<nuInt, std::unique_ptr<WorkerThread>> m_Threads;
-		std::queue<std::tuple<WorkFunc, void*, std::promise<WorkToken>>> m_WorkQueue;
-		natCriticalSection m_Section;
+		std::queue<Work> m_WorkQueue;
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_WorkAvailable;
 	};
 
 	///	@}
@@ -1,8 +1,23 @@
-#include "stdafx.h"
+﻿#include "stdafx.h"
 #include "natNamedPipe.h"
 #include "natException.h"
 #include <algorithm>
 
+#ifndef _WIN32
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 using namespace NatsuLib;
 
 #ifdef _WIN32
@@ -386,5 +401,821 @@ void natNamedPipeClientStream::Wait(nuInt timeOut)
 }
 
 #else
-// TODO
+
+namespace NatsuLib
+{
+	namespace detail_
+	{
+		////////////////////////////////////////////////////////////////////////////////
+		///	@brief	基于已连接的Unix域套接字的流
+		///	@note	消息模式下读取的缓冲区不足以容纳整个消息时，剩余部分将保留到下一次读取\n
+		///			消息模式下可以读写空消息，对端发送空消息后立即关闭时该消息与流结束无法区分
+		////////////////////////////////////////////////////////////////////////////////
+		class PipeSocketStream
+			: public natRefObjImpl<PipeSocketStream, natStream>
+		{
+		public:
+			PipeSocketStream(int socket, nBool readable, nBool writable, nBool messageMode, nBool nonBlocking)
+				: m_Socket{ socket }, m_PendingOffset{}, m_bReadable{ readable }, m_bWritable{ writable }, m_bMessageMode{ messageMode }, m_bNonBlocking{ nonBlocking }, m_bMessageComplete{ true }, m_bEndOfStream{}
+			{
+			}
+
+			~PipeSocketStream()
+			{
+				close(m_Socket);
+			}
+
+			nBool CanWrite() const override
+			{
+				return m_bWritable;
+			}
+
+			nBool CanRead() const override
+			{
+				return m_bReadable;
+			}
+
+			nBool CanResize() const override
+			{
+				return false;
+			}
+
+			nBool CanSeek() const override
+			{
+				return false;
+			}
+
+			nBool IsEndOfStream() const override
+			{
+				return m_bEndOfStream;
+			}
+
+			nLen GetSize() const override
+			{
+				return 0ul;
+			}
+
+			void SetSize(nLen) override
+			{
+				nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetSize."_nv);
+			}
+
+			nLen GetPosition() const override
+			{
+				return 0ul;
+			}
+
+			void SetPosition(NatSeek, nLong) override
+			{
+				nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+			}
+
+			nLen ReadBytes(nData pData, nLen Length) override
+			{
+				if (!m_bReadable)
+				{
+					nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+				}
+
+				if (Length == 0ul)
+				{
+					return 0;
+				}
+
+				if (pData == nullptr)
+				{
+					nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+				}
+
+				if (m_PendingOffset < m_PendingMessage.size())
+				{
+					return readPendingMessage(pData, Length);
+				}
+
+				if (m_bMessageMode)
+				{
+					// 先获得消息的完整长度，缓冲区不足时将整个消息读入m_PendingMessage
+					const auto messageSize = receive(nullptr, 0, MSG_PEEK | MSG_TRUNC);
+					if (messageSize < 0 || m_bEndOfStream)
+					{
+						return 0;
+					}
+
+					// 空消息仍在队列中，需要取出
+					if (messageSize == 0)
+					{
+						receive(nullptr, 0, 0);
+						m_bMessageComplete = true;
+						return 0;
+					}
+
+					if (static_cast<nLen>(messageSize) > Length)
+					{
+						m_PendingMessage.resize(static_cast<std::size_t>(messageSize));
+						m_PendingOffset = 0;
+						receive(m_PendingMessage.data(), m_PendingMessage.size(), 0);
+						return readPendingMessage(pData, Length);
+					}
+				}
+
+				const auto ret = receive(pData, static_cast<std::size_t>(Length), 0);
+				m_bMessageComplete = true;
+				return ret < 0 ? 0 : static_cast<nLen>(ret);
+			}
+
+			nLen WriteBytes(ncData pData, nLen Length) override
+			{
+				if (!m_bWritable)
+				{
+					nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+				}
+
+				// 消息模式下长度为0时发送空消息
+				if (Length == 0ul && !m_bMessageMode)
+				{
+					return 0;
+				}
+
+				if (pData == nullptr && Length != 0ul)
+				{
+					nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+				}
+
+				while (true)
+				{
+					const auto ret = send(m_Socket, pData, static_cast<std::size_t>(Length), MSG_NOSIGNAL);
+					if (ret >= 0)
+					{
+						return static_cast<nLen>(ret);
+					}
+
+					if (errno == EINTR)
+					{
+						continue;
+					}
+
+					if (m_bNonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK))
+					{
+						return 0;
+					}
+
+					nat_Throw(natErrException, NatErr_InternalErr, "send failed (errno = {0})."_nv, errno);
+				}
+			}
+
+			void Flush() override
+			{
+			}
+
+			nBool IsMessageComplete() const noexcept
+			{
+				return m_bMessageComplete;
+			}
+
+		private:
+			const int m_Socket;
+			std::vector<nByte> m_PendingMessage;
+			std::size_t m_PendingOffset;
+			const nBool m_bReadable, m_bWritable, m_bMessageMode, m_bNonBlocking;
+			nBool m_bMessageComplete, m_bEndOfStream;
+
+			// 返回-1表示非阻塞模式下暂无数据
+			ssize_t receive(void* buffer, std::size_t size, int flags)
+			{
+				while (true)
+				{
+					const auto ret = recv(m_Socket, buffer, size, flags);
+					if (ret > 0)
+					{
+						return ret;
+					}
+
+					// 消息模式下收到空消息时recv同样返回0，需要确认对端是否已关闭
+					if (ret == 0)
+					{
+						if (!m_bMessageMode || isPeerShutdown())
+						{
+							m_bEndOfStream = true;
+						}
+						return 0;
+					}
+
+					if (errno == EINTR)
+					{
+						continue;
+					}
+
+					if (m_bNonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK))
+					{
+						return -1;
+					}
+
+					nat_Throw(natErrException, NatErr_InternalErr, "recv failed (errno = {0})."_nv, errno);
+				}
+			}
+
+			nBool isPeerShutdown() const
+			{
+#ifdef POLLRDHUP
+				constexpr short ShutdownEvents = POLLHUP | POLLRDHUP;
+#else
+				constexpr short ShutdownEvents = POLLHUP;
+#endif
+				pollfd pollFd{ m_Socket, ShutdownEvents, 0 };
+				while (true)
+				{
+					const auto ret = poll(&pollFd, 1, 0);
+					if (ret >= 0)
+					{
+						return ret > 0 && (pollFd.revents & ShutdownEvents);
+					}
+
+					if (errno != EINTR)
+					{
+						nat_Throw(natErrException, NatErr_InternalErr, "poll failed (errno = {0})."_nv, errno);
+					}
+				}
+			}
+
+			nLen readPendingMessage(nData pData, nLen Length)
+			{
+				const auto readBytes = std::min(static_cast<std::size_t>(Length), m_PendingMessage.size() - m_PendingOffset);
+				std::memcpy(pData, m_PendingMessage.data() + m_PendingOffset, readBytes);
+				m_PendingOffset += readBytes;
+				m_bMessageComplete = m_PendingOffset == m_PendingMessage.size();
+				if (m_bMessageComplete)
+				{
+					m_PendingMessage.clear();
+					m_PendingOffset = 0;
+				}
+
+				return readBytes;
+			}
+		};
+
+		////////////////////////////////////////////////////////////////////////////////
+		///	@brief	同名的服务端实例共享的监听套接字
+		///	@note	监听套接字仅在有未连接的实例时存在，等待队列的长度等于未连接的实例数\n
+		///			持有锁文件期间本进程为管道的所有者
+		////////////////////////////////////////////////////////////////////////////////
+		struct PipeListener
+			: nonmovable
+		{
+			PipeListener(int lockFile, std::string path, std::string lockPath, PipeMode mode, nuInt maxInstances)
+				: LockFile{ lockFile }, Path{ move(path) }, LockPath{ move(lockPath) }, Mode{ mode }, MaxInstances{ maxInstances }, Socket{ -1 }, Instances{}, ConnectedInstances{}
+			{
+			}
+
+			~PipeListener()
+			{
+				if (Socket >= 0)
+				{
+					close(Socket);
+				}
+				unlink(Path.c_str());
+				// 在释放锁之前删除锁文件，之后的所有者会确认锁定的文件仍位于该路径
+				unlink(LockPath.c_str());
+				close(LockFile);
+			}
+
+			const int LockFile;
+			const std::string Path;
+			const std::string LockPath;
+			const PipeMode Mode;
+			const nuInt MaxInstances;
+
+			// 以下成员由PipeRegistry的锁保护
+			int Socket;
+			nuInt Instances;
+			nuInt ConnectedInstances;
+		};
+	}
+}
+
+namespace
+{
+	constexpr char WindowsPipePrefix[] = R"(\\.\pipe\)";
+
+	std::mutex PipeRegistryMutex;
+	std::unordered_map<std::string, std::weak_ptr<detail_::PipeListener>> PipeRegistry;
+
+	std::string GetPipePath(nStrView pipeName)
+	{
+		std::string name{ pipeName.begin(), pipeName.end() };
+		if (name.compare(0, sizeof WindowsPipePrefix - 1, WindowsPipePrefix) == 0)
+		{
+			name.erase(0, sizeof WindowsPipePrefix - 1);
+		}
+
+		auto path = name.empty() || name.front() != '/' ? "/tmp/NatsuLibPipe_" + name : move(name);
+		if (path.size() >= sizeof(sockaddr_un::sun_path))
+		{
+			nat_Throw(natErrException, NatErr_InvalidArg, "Pipe name is too long."_nv);
+		}
+
+		return path;
+	}
+
+	sockaddr_un MakeAddress(std::string const& path)
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+		return address;
+	}
+
+	// 锁文件在进程退出时自动解锁，无需连接已有的套接字即可判断其所有者是否仍然存在
+	int AcquirePipeLock(std::string const& lockPath)
+	{
+		while (true)
+		{
+			const auto lockFile = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			if (lockFile < 0)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "open failed (errno = {0})."_nv, errno);
+			}
+
+			if (flock(lockFile, LOCK_EX | LOCK_NB) < 0)
+			{
+				const auto error = errno;
+				close(lockFile);
+				if (error == EINTR)
+				{
+					continue;
+				}
+				if (error == EWOULDBLOCK)
+				{
+					nat_Throw(natErrException, NatErr_IllegalState, "Pipe is owned by another process."_nv);
+				}
+				nat_Throw(natErrException, NatErr_InternalErr, "flock failed (errno = {0})."_nv, error);
+			}
+
+			// 之前的所有者可能在本进程打开之后删除了锁文件，此时锁定的文件已无效
+			struct stat lockedFile, currentFile;
+			if (fstat(lockFile, &lockedFile) == 0 && stat(lockPath.c_str(), &currentFile) == 0 &&
+				lockedFile.st_dev == currentFile.st_dev && lockedFile.st_ino == currentFile.st_ino)
+			{
+				return lockFile;
+			}
+
+			close(lockFile);
+		}
+	}
+
+	int CreateListenSocket(std::string const& path, PipeMode mode)
+	{
+		const auto address = MakeAddress(path);
+		const auto socketType = mode == PipeMode::Message ? SOCK_SEQPACKET : SOCK_STREAM;
+		const auto listenSocket = socket(AF_UNIX, socketType | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (listenSocket < 0)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "socket failed (errno = {0})."_nv, errno);
+		}
+
+		// 已持有锁，已存在的套接字文件必然是残留的
+		unlink(path.c_str());
+		if (bind(listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof address) < 0)
+		{
+			const auto error = errno;
+			close(listenSocket);
+			nat_Throw(natErrException, NatErr_InternalErr, "bind failed (errno = {0})."_nv, error);
+		}
+
+		return listenSocket;
+	}
+
+	// 根据未连接的实例数更新监听套接字，调用者必须持有PipeRegistryMutex
+	// Linux下等待队列的长度为backlog + 1，因此客户端只能连接到未连接的实例，其余客户端在Wait中等待
+	void UpdateListenSocket(detail_::PipeListener& listener)
+	{
+		const auto availableInstances = listener.Instances - listener.ConnectedInstances;
+		if (!availableInstances)
+		{
+			if (listener.Socket >= 0)
+			{
+				close(listener.Socket);
+				listener.Socket = -1;
+			}
+			return;
+		}
+
+		if (listener.Socket < 0)
+		{
+			listener.Socket = CreateListenSocket(listener.Path, listener.Mode);
+		}
+
+		const auto backlog = static_cast<int>(std::min(availableInstances - 1, static_cast<nuInt>(SOMAXCONN)));
+		if (listen(listener.Socket, backlog) < 0)
+		{
+			const auto error = errno;
+			close(listener.Socket);
+			listener.Socket = -1;
+			nat_Throw(natErrException, NatErr_InternalErr, "listen failed (errno = {0})."_nv, error);
+		}
+	}
+}
+
+natNamedPipeServerStream::natNamedPipeServerStream(nStrView Pipename, PipeDirection Direction, nuInt MaxInstances, nuInt /*OutBuffer*/, nuInt /*InBuffer*/, nuInt /*TimeOut*/, PipeMode TransmissionMode, PipeMode /*ReadMode*/, PipeOptions Options)
+	: m_bAsync(Options == PipeOptions::Asynchronous), m_bConnected(false), m_bMessageComplete(false), m_bReadable(false), m_bWritable(false)
+{
+	switch (Direction)
+	{
+	case PipeDirection::In:
+		m_bReadable = true;
+		break;
+	case PipeDirection::Out:
+		m_bWritable = true;
+		break;
+	case PipeDirection::Inout:
+		m_bReadable = m_bWritable = true;
+		break;
+	default:
+		nat_Throw(natException, "Unknown Direction."_nv);
+	}
+
+	auto path = GetPipePath(Pipename);
+
+	std::lock_guard<std::mutex> lock{ PipeRegistryMutex };
+	auto& registeredListener = PipeRegistry[path];
+	m_Listener = registeredListener.lock();
+	if (m_Listener)
+	{
+		if (m_Listener->Mode != TransmissionMode)
+		{
+			nat_Throw(natErrException, NatErr_InvalidArg, "TransmissionMode does not match other instances of this pipe."_nv);
+		}
+
+		if (m_Listener->Instances >= m_Listener->MaxInstances)
+		{
+			nat_Throw(natErrException, NatErr_IllegalState, "All instances of this pipe are busy."_nv);
+		}
+	}
+	else
+	{
+		auto lockPath = path + ".lock";
+		const auto lockFile = AcquirePipeLock(lockPath);
+		m_Listener = std::make_shared<detail_::PipeListener>(lockFile, move(path), move(lockPath), TransmissionMode, std::max(MaxInstances, 1u));
+		registeredListener = m_Listener;
+	}
+
+	++m_Listener->Instances;
+	try
+	{
+		UpdateListenSocket(*m_Listener);
+	}
+	catch (...)
+	{
+		--m_Listener->Instances;
+		throw;
+	}
+}
+
+natNamedPipeServerStream::~natNamedPipeServerStream()
+{
+	m_Connection.Reset();
+
+	std::lock_guard<std::mutex> lock{ PipeRegistryMutex };
+	if (m_bConnected)
+	{
+		--m_Listener->ConnectedInstances;
+	}
+	if (!--m_Listener->Instances)
+	{
+		PipeRegistry.erase(m_Listener->Path);
+	}
+	else
+	{
+		// 未连接的实例数只会减少，此时不会创建新的套接字
+		try
+		{
+			UpdateListenSocket(*m_Listener);
+		}
+		catch (...)
+		{
+		}
+	}
+	m_Listener.reset();
+}
+
+nBool natNamedPipeServerStream::CanWrite() const
+{
+	return m_bWritable;
+}
+
+nBool natNamedPipeServerStream::CanRead() const
+{
+	return m_bReadable;
+}
+
+nBool natNamedPipeServerStream::CanResize() const
+{
+	return false;
+}
+
+nBool natNamedPipeServerStream::CanSeek() const
+{
+	return false;
+}
+
+nBool natNamedPipeServerStream::IsEndOfStream() const
+{
+	return m_Connection && m_Connection->IsEndOfStream();
+}
+
+nLen natNamedPipeServerStream::GetSize() const
+{
+	return 0ul;
+}
+
+void natNamedPipeServerStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetSize."_nv);
+}
+
+nLen natNamedPipeServerStream::GetPosition() const
+{
+	return 0ul;
+}
+
+void natNamedPipeServerStream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+}
+
+nLen natNamedPipeServerStream::ReadBytes(nData pData, nLen Length)
+{
+	if (!m_bReadable || !m_bConnected)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable or not connected."_nv);
+	}
+
+	const auto ret = m_Connection->ReadBytes(pData, Length);
+	m_bMessageComplete = m_Connection->IsMessageComplete();
+	return ret;
+}
+
+nLen natNamedPipeServerStream::WriteBytes(ncData pData, nLen Length)
+{
+	if (!m_bWritable || !m_bConnected)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable or not connected."_nv);
+	}
+
+	return m_Connection->WriteBytes(pData, Length);
+}
+
+void natNamedPipeServerStream::Flush()
+{
+}
+
+void natNamedPipeServerStream::WaitForConnection()
+{
+	if (m_bConnected)
+	{
+		return;
+	}
+
+	// 本实例未连接时监听套接字必然存在，监听套接字为非阻塞的，其他实例可能先接受了连接，此时继续等待
+	while (true)
+	{
+		int listenSocket;
+		{
+			std::lock_guard<std::mutex> lock{ PipeRegistryMutex };
+			listenSocket = m_Listener->Socket;
+		}
+
+		pollfd pollFd{ listenSocket, POLLIN, 0 };
+		if (poll(&pollFd, 1, -1) < 0 && errno != EINTR)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "poll failed (errno = {0})."_nv, errno);
+		}
+
+		const auto socket = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC | (m_bAsync ? SOCK_NONBLOCK : 0));
+		if (socket >= 0)
+		{
+			m_Connection = make_ref<detail_::PipeSocketStream>(socket, m_bReadable, m_bWritable, m_Listener->Mode == PipeMode::Message, m_bAsync);
+
+			std::lock_guard<std::mutex> lock{ PipeRegistryMutex };
+			++m_Listener->ConnectedInstances;
+			m_bConnected = true;
+			UpdateListenSocket(*m_Listener);
+			return;
+		}
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "accept failed (errno = {0})."_nv, errno);
+		}
+	}
+}
+
+std::future<void> natNamedPipeServerStream::WaitForConnectionAsync()
+{
+	if (m_bConnected)
+	{
+		std::promise<void> dummy;
+		dummy.set_value();
+		return dummy.get_future();
+	}
+
+	return std::async(std::launch::async, [this]
+	{
+		WaitForConnection();
+	});
+}
+
+natNamedPipeClientStream::natNamedPipeClientStream(nStrView Pipename, nBool bReadable, nBool bWritable)
+	: m_PipeName(Pipename), m_bReadable(bReadable), m_bWritable(bWritable)
+{
+}
+
+natNamedPipeClientStream::~natNamedPipeClientStream()
+{
+}
+
+nBool natNamedPipeClientStream::CanResize() const
+{
+	return false;
+}
+
+nBool natNamedPipeClientStream::CanSeek() const
+{
+	return false;
+}
+
+nLen natNamedPipeClientStream::GetSize() const
+{
+	return 0ul;
+}
+
+nBool natNamedPipeClientStream::IsEndOfStream() const
+{
+	return m_InternalStream && m_InternalStream->IsEndOfStream();
+}
+
+void natNamedPipeClientStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetSize."_nv);
+}
+
+nLen natNamedPipeClientStream::GetPosition() const
+{
+	return 0ul;
+}
+
+void natNamedPipeClientStream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "This type of stream does not support SetPosition."_nv);
+}
+
+nBool natNamedPipeClientStream::CanWrite() const
+{
+	if (!m_InternalStream)
+	{
+		return false;
+	}
+
+	return m_InternalStream->CanWrite();
+}
+
+nBool natNamedPipeClientStream::CanRead() const
+{
+	if (!m_InternalStream)
+	{
+		return false;
+	}
+
+	return m_InternalStream->CanRead();
+}
+
+nByte natNamedPipeClientStream::ReadByte()
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	return m_InternalStream->ReadByte();
+}
+
+nLen natNamedPipeClientStream::ReadBytes(nData pData, nLen Length)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	return m_InternalStream->ReadBytes(pData, Length);
+}
+
+std::future<nLen> natNamedPipeClientStream::ReadBytesAsync(nData pData, nLen Length)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	return m_InternalStream->ReadBytesAsync(pData, Length);
+}
+
+void natNamedPipeClientStream::WriteByte(nByte byte)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	m_InternalStream->WriteByte(byte);
+}
+
+nLen natNamedPipeClientStream::WriteBytes(ncData pData, nLen Length)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	return m_InternalStream->WriteBytes(pData, Length);
+}
+
+std::future<nLen> natNamedPipeClientStream::WriteBytesAsync(ncData pData, nLen Length)
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Internal stream is not ready."_nv);
+	}
+
+	return m_InternalStream->WriteBytesAsync(pData, Length);
+}
+
+void natNamedPipeClientStream::Flush()
+{
+	if (m_InternalStream)
+	{
+		m_InternalStream->Flush();
+	}
+}
+
+void natNamedPipeClientStream::Wait(nuInt timeOut)
+{
+	if (m_InternalStream)
+	{
+		return;
+	}
+
+	const auto path = GetPipePath(m_PipeName);
+	const auto address = MakeAddress(path);
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeOut);
+
+	// 服务端尚未创建或者所有实例均已被占用时重试直到超时
+	// 使用非阻塞的套接字连接，连接队列已满时立即返回EAGAIN而不是阻塞
+	while (true)
+	{
+		for (const auto socketType : { SOCK_SEQPACKET, SOCK_STREAM })
+		{
+			const auto clientSocket = socket(AF_UNIX, socketType | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+			if (clientSocket < 0)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "socket failed (errno = {0})."_nv, errno);
+			}
+
+			if (connect(clientSocket, reinterpret_cast<const sockaddr*>(&address), sizeof address) == 0)
+			{
+				const auto flags = fcntl(clientSocket, F_GETFL);
+				if (flags < 0 || fcntl(clientSocket, F_SETFL, flags & ~O_NONBLOCK) < 0)
+				{
+					const auto error = errno;
+					close(clientSocket);
+					nat_Throw(natErrException, NatErr_InternalErr, "fcntl failed (errno = {0})."_nv, error);
+				}
+
+				m_InternalStream = make_ref<detail_::PipeSocketStream>(clientSocket, m_bReadable, m_bWritable, socketType == SOCK_SEQPACKET, false);
+				return;
+			}
+
+			const auto error = errno;
+			close(clientSocket);
+			// 套接字类型与服务端不符时尝试另一种类型
+			if (error == EPROTOTYPE)
+			{
+				continue;
+			}
+
+			if (error != ENOENT && error != ECONNREFUSED && error != EAGAIN && error != EINTR)
+			{
+				nat_Throw(natErrException, NatErr_InternalErr, "connect failed (errno = {0})."_nv, error);
+			}
+
+			break;
+		}
+
+		if (timeOut != Infinity && std::chrono::steady_clock::now() >= deadline)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "Timed out waiting for pipe."_nv);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
 #endif
@@ -1,6 +1,7 @@
-#pragma once
+﻿#pragma once
 #include "natStream.h"
 #include <future>
+#include <memory>
 
 #ifdef _MSC_VER
 #	pragma push_macro("max")
@@ -30,6 +31,22 @@ namespace NatsuLib
 		WriteThrough = 2,
 	};
 
+#ifndef _WIN32
+	namespace detail_
+	{
+		class PipeSocketStream;
+		struct PipeListener;
+	}
+#endif
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	命名管道服务端
+	///	@note	非Windows平台下使用Unix域套接字实现，PipeMode::Message使用SOCK_SEQPACKET，PipeMode::Byte使用SOCK_STREAM\n
+	///			管道名称可使用Windows形式（\\.\pipe\name），将被映射到/tmp/NatsuLibPipe_name，以'/'开头的名称直接作为套接字路径\n
+	///			同名的多个服务端实例共享同一个监听套接字，每个实例接受一个连接\n
+	///			同一管道只能由一个进程创建，所有权通过对套接字路径加上".lock"后缀的锁文件加锁来确定\n
+	///			客户端只能连接到尚未连接的实例，所有实例均已连接时客户端在Wait中等待
+	////////////////////////////////////////////////////////////////////////////////
 	class natNamedPipeServerStream
 		: public natRefObjImpl<natNamedPipeServerStream, natStream>
 	{
@@ -80,10 +97,19 @@ namespace NatsuLib
 		}
 
 	private:
+#ifdef _WIN32
 		UnsafeHandle m_hPipe;
+#else
+		std::shared_ptr<detail_::PipeListener> m_Listener;
+		natRefPointer<detail_::PipeSocketStream> m_Connection;
+#endif
 		nBool m_bAsync, m_bConnected, m_bMessageComplete, m_bReadable, m_bWritable;
 	};
 
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	命名管道客户端
+	///	@note	在调用Wait连接到服务端之后才能读写
+	////////////////////////////////////////////////////////////////////////////////
 	class natNamedPipeClientStream
 		: public natRefObjImpl<natNamedPipeClientStream, natStream>
 	{
@@ -116,7 +142,7 @@ namespace NatsuLib
 		void Wait(nuInt timeOut = Infinity);
 
 	private:
-		natRefPointer<natFileStream> m_InternalStream;
+		natRefPointer<natStream> m_InternalStream;
 		nString m_PipeName;
 		nBool m_bReadable, m_bWritable;
 	};
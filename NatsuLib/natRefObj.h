@@ -9,6 +9,7 @@
 #include <atomic>
 
 #include <memory>
+#include <utility>
 #include <functional>
 
 #ifdef TraceRefObj
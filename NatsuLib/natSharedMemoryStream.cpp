@@ -0,0 +1,503 @@
+﻿#include "stdafx.h"
+#include "natSharedMemoryStream.h"
+#include "natException.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#undef max
+#undef min
+
+using namespace NatsuLib;
+
+namespace NatsuLib
+{
+	namespace detail_
+	{
+		////////////////////////////////////////////////////////////////////////////////
+		///	@brief	位于共享内存起始处的环形缓冲区状态
+		///	@note	读写位置单调递增，对容量取模后得到实际偏移
+		////////////////////////////////////////////////////////////////////////////////
+		struct SharedRingHeader
+		{
+			enum : nuInt
+			{
+				MagicValue = 0x524d534e, // "NSMR"
+			};
+
+			std::atomic<nuInt> Magic;
+			nLen Capacity;
+
+			// 以下成员由写入端修改
+			alignas(64) std::atomic<nuLong> WritePosition;
+			std::atomic<nuInt> DataSequence;
+			std::atomic<nuInt> WriterWaiting;
+			std::atomic<nuInt> WriterClosed;
+
+			// 以下成员由读取端修改
+			alignas(64) std::atomic<nuLong> ReadPosition;
+			std::atomic<nuInt> SpaceSequence;
+			std::atomic<nuInt> ReaderWaiting;
+			std::atomic<nuInt> ReaderClosed;
+		};
+
+		static_assert(std::is_standard_layout<SharedRingHeader>::value, "SharedRingHeader should be standard layout.");
+	}
+}
+
+namespace
+{
+	constexpr nLen DataOffset = (sizeof(detail_::SharedRingHeader) + 63) & ~nLen{ 63 };
+	constexpr nuInt SpinCount = 64;
+
+	nLen RoundUpToPowerOf2(nLen value)
+	{
+		nLen result = 1;
+		while (result < value)
+		{
+			result <<= 1;
+		}
+		return result;
+	}
+
+	// 等待word的值不再为expected，可能虚假唤醒
+	void WaitOnWord(std::atomic<nuInt>& word, nuInt expected)
+	{
+#ifdef __linux__
+		syscall(SYS_futex, reinterpret_cast<nuInt*>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+#else
+		static_cast<void>(word);
+		static_cast<void>(expected);
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+#endif
+	}
+
+	void WakeWord(std::atomic<nuInt>& word)
+	{
+#ifdef __linux__
+		syscall(SYS_futex, reinterpret_cast<nuInt*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+		static_cast<void>(word);
+#endif
+	}
+
+	// 更新位置后通知可能正在等待的另一端
+	void Notify(std::atomic<nuInt>& sequence, std::atomic<nuInt> const& waiting)
+	{
+		sequence.fetch_add(1);
+		if (waiting.load())
+		{
+			WakeWord(sequence);
+		}
+	}
+
+#ifndef _WIN32
+	std::string GetSharedMemoryName(nStrView name)
+	{
+		std::string result{ name.begin(), name.end() };
+		if (result.empty() || result.front() != '/')
+		{
+			result.insert(0, "/NatsuLibShm_");
+		}
+
+		return result;
+	}
+#endif
+}
+
+#ifdef _WIN32
+
+natSharedMemoryStream::natSharedMemoryStream(nStrView name, PipeDirection direction, nBool create, nLen /*capacity*/)
+	: m_Name{ name }, m_Handle{}, m_Header{}, m_Data{}, m_MappedSize{}, m_AcquiredSize{}, m_bWritable{ direction == PipeDirection::Out }, m_bOwner{ create }
+{
+	nat_Throw(NotImplementedException);
+}
+
+natSharedMemoryStream::~natSharedMemoryStream()
+{
+}
+
+#else
+
+natSharedMemoryStream::natSharedMemoryStream(nStrView name, PipeDirection direction, nBool create, nLen capacity)
+	: m_Name{ name }, m_Handle{ -1 }, m_Header{}, m_Data{}, m_MappedSize{}, m_AcquiredSize{}, m_bWritable{ direction == PipeDirection::Out }, m_bOwner{ create }
+{
+	if (direction != PipeDirection::In && direction != PipeDirection::Out)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "direction should be either PipeDirection::In or PipeDirection::Out."_nv);
+	}
+
+	const auto sharedMemoryName = GetSharedMemoryName(m_Name);
+
+	if (create)
+	{
+		if (!capacity)
+		{
+			nat_Throw(natErrException, NatErr_InvalidArg, "capacity cannot be 0."_nv);
+		}
+
+		const auto realCapacity = RoundUpToPowerOf2(capacity);
+		// 同名的共享内存可能正被其他进程使用，不能替换
+		m_Handle = shm_open(sharedMemoryName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (m_Handle < 0)
+		{
+			if (errno == EEXIST)
+			{
+				nat_Throw(natErrException, NatErr_Duplicated, "Shared memory already exists."_nv);
+			}
+			nat_Throw(natErrException, NatErr_InternalErr, "shm_open failed (errno = {0})."_nv, errno);
+		}
+
+		m_MappedSize = DataOffset + realCapacity;
+		if (ftruncate(m_Handle, static_cast<off_t>(m_MappedSize)) < 0)
+		{
+			const auto error = errno;
+			close(m_Handle);
+			shm_unlink(sharedMemoryName.c_str());
+			nat_Throw(natErrException, NatErr_InternalErr, "ftruncate failed (errno = {0})."_nv, error);
+		}
+	}
+	else
+	{
+		m_Handle = shm_open(sharedMemoryName.c_str(), O_RDWR, 0);
+		if (m_Handle < 0)
+		{
+			nat_Throw(natErrException, errno == ENOENT ? NatErr_NotFound : NatErr_InternalErr, "shm_open failed (errno = {0})."_nv, errno);
+		}
+
+		// 创建者可能尚未设置大小
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		struct stat status;
+		while (fstat(m_Handle, &status) == 0 && static_cast<nLen>(status.st_size) <= DataOffset && std::chrono::steady_clock::now() < deadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		if (static_cast<nLen>(status.st_size) <= DataOffset)
+		{
+			close(m_Handle);
+			nat_Throw(natErrException, NatErr_IllegalState, "Shared memory is not initialized."_nv);
+		}
+
+		m_MappedSize = static_cast<nLen>(status.st_size);
+	}
+
+	const auto mapped = mmap(nullptr, static_cast<std::size_t>(m_MappedSize), PROT_READ | PROT_WRITE, MAP_SHARED, m_Handle, 0);
+	if (mapped == MAP_FAILED)
+	{
+		const auto error = errno;
+		close(m_Handle);
+		if (create)
+		{
+			shm_unlink(sharedMemoryName.c_str());
+		}
+		nat_Throw(natErrException, NatErr_InternalErr, "mmap failed (errno = {0})."_nv, error);
+	}
+
+	m_Header = static_cast<detail_::SharedRingHeader*>(mapped);
+	m_Data = static_cast<nData>(mapped) + DataOffset;
+
+	if (create)
+	{
+		// 新建的共享内存已被清零
+		m_Header->Capacity = m_MappedSize - DataOffset;
+		m_Header->Magic.store(detail_::SharedRingHeader::MagicValue, std::memory_order_release);
+	}
+	else
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		while (m_Header->Magic.load(std::memory_order_acquire) != detail_::SharedRingHeader::MagicValue)
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				munmap(mapped, static_cast<std::size_t>(m_MappedSize));
+				close(m_Handle);
+				nat_Throw(natErrException, NatErr_IllegalState, "Shared memory is not initialized."_nv);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		// 容量由另一端写入，必须确认环形缓冲区位于映射的范围内
+		const auto headerCapacity = m_Header->Capacity;
+		if (!headerCapacity || (headerCapacity & (headerCapacity - 1)) || headerCapacity > m_MappedSize - DataOffset)
+		{
+			munmap(mapped, static_cast<std::size_t>(m_MappedSize));
+			close(m_Handle);
+			nat_Throw(natErrException, NatErr_IllegalState, "Shared memory has an invalid header."_nv);
+		}
+	}
+}
+
+natSharedMemoryStream::~natSharedMemoryStream()
+{
+	if (m_bWritable)
+	{
+		m_Header->WriterClosed.store(1);
+		Notify(m_Header->DataSequence, m_Header->ReaderWaiting);
+	}
+	else
+	{
+		m_Header->ReaderClosed.store(1);
+		Notify(m_Header->SpaceSequence, m_Header->WriterWaiting);
+	}
+
+	munmap(m_Header, static_cast<std::size_t>(m_MappedSize));
+	close(m_Handle);
+	if (m_bOwner)
+	{
+		shm_unlink(GetSharedMemoryName(m_Name).c_str());
+	}
+}
+
+#endif
+
+nLen natSharedMemoryStream::GetCapacity() const noexcept
+{
+	return m_Header->Capacity;
+}
+
+natSharedMemoryStream::Span natSharedMemoryStream::AcquireWrite()
+{
+	if (!m_bWritable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+	}
+
+	const auto freeSize = waitForSpace();
+	const auto offset = static_cast<nLen>(m_Header->WritePosition.load(std::memory_order_relaxed) & (m_Header->Capacity - 1));
+	m_AcquiredSize = std::min(freeSize, m_Header->Capacity - offset);
+	return { m_Data + offset, m_AcquiredSize };
+}
+
+void natSharedMemoryStream::CommitWrite(nLen size)
+{
+	if (size > m_AcquiredSize)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "size is bigger than the acquired span."_nv);
+	}
+
+	if (!size)
+	{
+		return;
+	}
+
+	m_AcquiredSize -= size;
+	m_Header->WritePosition.store(m_Header->WritePosition.load(std::memory_order_relaxed) + size);
+	Notify(m_Header->DataSequence, m_Header->ReaderWaiting);
+}
+
+natSharedMemoryStream::Span natSharedMemoryStream::AcquireRead()
+{
+	if (m_bWritable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	const auto availableSize = waitForData();
+	const auto offset = static_cast<nLen>(m_Header->ReadPosition.load(std::memory_order_relaxed) & (m_Header->Capacity - 1));
+	m_AcquiredSize = std::min(availableSize, m_Header->Capacity - offset);
+	return { m_Data + offset, m_AcquiredSize };
+}
+
+void natSharedMemoryStream::ReleaseRead(nLen size)
+{
+	if (size > m_AcquiredSize)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "size is bigger than the acquired span."_nv);
+	}
+
+	if (!size)
+	{
+		return;
+	}
+
+	m_AcquiredSize -= size;
+	m_Header->ReadPosition.store(m_Header->ReadPosition.load(std::memory_order_relaxed) + size);
+	Notify(m_Header->SpaceSequence, m_Header->WriterWaiting);
+}
+
+nBool natSharedMemoryStream::CanWrite() const
+{
+	return m_bWritable;
+}
+
+nBool natSharedMemoryStream::CanRead() const
+{
+	return !m_bWritable;
+}
+
+nBool natSharedMemoryStream::CanResize() const
+{
+	return false;
+}
+
+nBool natSharedMemoryStream::CanSeek() const
+{
+	return false;
+}
+
+nBool natSharedMemoryStream::IsEndOfStream() const
+{
+	if (m_bWritable)
+	{
+		return m_Header->ReaderClosed.load() != 0;
+	}
+
+	return m_Header->WriterClosed.load() && m_Header->WritePosition.load() == m_Header->ReadPosition.load(std::memory_order_relaxed);
+}
+
+nLen natSharedMemoryStream::GetSize() const
+{
+	return 0ul;
+}
+
+void natSharedMemoryStream::SetSize(nLen)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natSharedMemoryStream::GetPosition() const
+{
+	return m_bWritable ? m_Header->WritePosition.load(std::memory_order_relaxed) : m_Header->ReadPosition.load(std::memory_order_relaxed);
+}
+
+void natSharedMemoryStream::SetPosition(NatSeek, nLong)
+{
+	nat_Throw(natErrException, NatErr_NotSupport, "The type of this stream does not support this operation."_nv);
+}
+
+nLen natSharedMemoryStream::ReadBytes(nData pData, nLen Length)
+{
+	if (Length == 0ul)
+	{
+		return 0;
+	}
+
+	if (pData == nullptr)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+	}
+
+	nLen readBytes{};
+	// 仅在尚未读取到任何数据时等待，数据跨越缓冲区结尾时分两次复制
+	do
+	{
+		const auto span = AcquireRead();
+		if (!span.Size)
+		{
+			break;
+		}
+
+		const auto currentReadBytes = std::min(span.Size, Length - readBytes);
+		std::memcpy(pData + readBytes, span.Data, static_cast<std::size_t>(currentReadBytes));
+		ReleaseRead(currentReadBytes);
+		readBytes += currentReadBytes;
+	} while (readBytes < Length && m_Header->WritePosition.load(std::memory_order_acquire) != m_Header->ReadPosition.load(std::memory_order_relaxed));
+
+	return readBytes;
+}
+
+nLen natSharedMemoryStream::WriteBytes(ncData pData, nLen Length)
+{
+	if (Length == 0ul)
+	{
+		return 0;
+	}
+
+	if (pData == nullptr)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+	}
+
+	nLen writtenBytes{};
+	while (writtenBytes < Length)
+	{
+		const auto span = AcquireWrite();
+		const auto currentWrittenBytes = std::min(span.Size, Length - writtenBytes);
+		std::memcpy(span.Data, pData + writtenBytes, static_cast<std::size_t>(currentWrittenBytes));
+		CommitWrite(currentWrittenBytes);
+		writtenBytes += currentWrittenBytes;
+	}
+
+	return writtenBytes;
+}
+
+void natSharedMemoryStream::Flush()
+{
+}
+
+nLen natSharedMemoryStream::waitForData()
+{
+	const auto readPosition = m_Header->ReadPosition.load(std::memory_order_relaxed);
+	for (nuInt spin = 0;; ++spin)
+	{
+		const auto sequence = m_Header->DataSequence.load();
+		// 写入端在写入全部数据后才会关闭，因此先检查是否关闭
+		const auto closed = m_Header->WriterClosed.load() != 0;
+		const auto availableSize = static_cast<nLen>(m_Header->WritePosition.load() - readPosition);
+		if (availableSize || closed)
+		{
+			return availableSize;
+		}
+
+		if (spin < SpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		m_Header->ReaderWaiting.store(1);
+		if (m_Header->WritePosition.load() == readPosition && !m_Header->WriterClosed.load())
+		{
+			WaitOnWord(m_Header->DataSequence, sequence);
+		}
+		m_Header->ReaderWaiting.store(0);
+	}
+}
+
+nLen natSharedMemoryStream::waitForSpace()
+{
+	const auto writePosition = m_Header->WritePosition.load(std::memory_order_relaxed);
+	const auto capacity = m_Header->Capacity;
+	for (nuInt spin = 0;; ++spin)
+	{
+		const auto sequence = m_Header->SpaceSequence.load();
+		if (m_Header->ReaderClosed.load())
+		{
+			nat_Throw(natErrException, NatErr_IllegalState, "The reader has been closed."_nv);
+		}
+
+		const auto freeSize = capacity - static_cast<nLen>(writePosition - m_Header->ReadPosition.load());
+		if (freeSize)
+		{
+			return freeSize;
+		}
+
+		if (spin < SpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		m_Header->WriterWaiting.store(1);
+		if (m_Header->ReadPosition.load() + capacity == writePosition && !m_Header->ReaderClosed.load())
+		{
+			WaitOnWord(m_Header->SpaceSequence, sequence);
+		}
+		m_Header->WriterWaiting.store(0);
+	}
+}
@@ -0,0 +1,94 @@
+﻿#pragma once
+#include "natStream.h"
+#include "natNamedPipe.h"
+
+namespace NatsuLib
+{
+	namespace detail_
+	{
+		struct SharedRingHeader;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	共享内存流
+	///	@remark	基于共享内存中的单生产者单消费者环形缓冲区的进程间通信流，\n
+	///			每次读写仅复制一次数据且不需要系统调用（仅在需要等待时使用futex），适合传输大量数据
+	///	@note	一个共享内存仅能有一个写入端及一个读取端，由其中一端创建，另一端打开\n
+	///			名称不以'/'开头时将被映射到/NatsuLibShm_name\n
+	///			写入端析构后，读取端读完剩余的数据即到达流的结尾\n
+	///			目前仅在非Windows平台下实现
+	////////////////////////////////////////////////////////////////////////////////
+	class natSharedMemoryStream
+		: public natRefObjImpl<natSharedMemoryStream, natStream>, public nonmovable
+	{
+	public:
+#ifdef _WIN32
+		typedef HANDLE UnsafeHandle;
+#else
+		typedef int UnsafeHandle;
+#endif
+
+		enum : nLen
+		{
+			DefaultCapacity = 4 * 1024 * 1024,
+		};
+
+		///	@brief	可直接读写的共享内存区域
+		struct Span
+		{
+			nData Data;
+			nLen Size;
+		};
+
+		///	@brief	创建或打开共享内存流
+		///	@param	name		共享内存的名称
+		///	@param	direction	本端的方向，PipeDirection::In为读取端，PipeDirection::Out为写入端，不支持PipeDirection::Inout
+		///	@param	create		是否创建共享内存，同名共享内存已存在时将抛出异常，创建者析构时将移除该名称
+		///	@param	capacity	环形缓冲区的容量，将向上取整为2的幂，仅在创建时有效
+		natSharedMemoryStream(nStrView name, PipeDirection direction, nBool create, nLen capacity = DefaultCapacity);
+		~natSharedMemoryStream();
+
+		nLen GetCapacity() const noexcept;
+
+		///	@brief	获得可写入的连续区域，没有空闲空间时等待
+		///	@note	写入后需调用CommitWrite提交，获得的区域可能小于全部空闲空间
+		Span AcquireWrite();
+		///	@brief	提交AcquireWrite获得的区域的前size字节
+		void CommitWrite(nLen size);
+
+		///	@brief	获得可读取的连续区域，没有数据时等待
+		///	@note	读取后需调用ReleaseRead释放，到达流的结尾时返回的区域大小为0
+		Span AcquireRead();
+		///	@brief	释放AcquireRead获得的区域的前size字节
+		void ReleaseRead(nLen size);
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+		void SetSize(nLen /*Size*/) override;
+		///	@brief	获得本端已读取或写入的总字节数
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek /*Origin*/, nLong /*Offset*/) override;
+		///	@brief	读取数据，没有数据时等待，到达流的结尾时返回0
+		nLen ReadBytes(nData pData, nLen Length) override;
+		///	@brief	写入数据，空间不足时等待直到全部写入
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		void Flush() override;
+
+	private:
+		nString m_Name;
+		UnsafeHandle m_Handle;
+		detail_::SharedRingHeader* m_Header;
+		nData m_Data;
+		nLen m_MappedSize;
+		nLen m_AcquiredSize;
+		const nBool m_bWritable;
+		const nBool m_bOwner;
+
+		nLen waitForData();
+		nLen waitForSpace();
+	};
+}
@@ -7,6 +7,7 @@
 #ifndef _WIN32
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 
 #undef max
@@ -272,6 +273,109 @@ void DisposeCallbackStream::CallDisposeCallback()
 	}
 }
 
+natInstrumentedStream::natInstrumentedStream(natRefPointer<natStream> stream, nString name)
+	: natRefObjImpl{ std::move(stream) }, m_Name{ std::move(name) }, m_Statistics{}
+{
+	if (!m_InternalStream)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "stream should not be nullptr."_nv);
+	}
+}
+
+natInstrumentedStream::~natInstrumentedStream()
+{
+}
+
+nStrView natInstrumentedStream::GetName() const noexcept
+{
+	return m_Name;
+}
+
+natInstrumentedStream::OperationStatistics natInstrumentedStream::GetStatistics(Operation operation) const
+{
+	natRefScopeGuard<natCriticalSection> guard{ m_Section };
+	return m_Statistics.at(static_cast<size_t>(operation));
+}
+
+void natInstrumentedStream::ResetStatistics()
+{
+	natRefScopeGuard<natCriticalSection> guard{ m_Section };
+	m_Statistics = {};
+}
+
+size_t natInstrumentedStream::GetHistogramBucket(nLen size) noexcept
+{
+	size_t bucket = 0;
+	while (size)
+	{
+		size >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+nBool natInstrumentedStream::EnumStatistics(natRefPointer<natStream> const& stream, std::function<nBool(natInstrumentedStream&)> const& enumerator)
+{
+	if (const auto instrumentedStream = stream.Cast<natInstrumentedStream>())
+	{
+		if (enumerator(*instrumentedStream))
+		{
+			return true;
+		}
+	}
+
+	const auto wrappedStream = stream.Cast<natWrappedStream>();
+	return wrappedStream && wrappedStream->EnumUnderlyingStream([&enumerator](natWrappedStream& underlyingStream)
+	{
+		const auto instrumentedStream = dynamic_cast<natInstrumentedStream*>(&underlyingStream);
+		return instrumentedStream && enumerator(*instrumentedStream);
+	});
+}
+
+void natInstrumentedStream::SetPosition(NatSeek Origin, nLong Offset)
+{
+	const auto start = std::chrono::steady_clock::now();
+	m_InternalStream->SetPosition(Origin, Offset);
+	record(Operation::Seek, Offset < 0 ? nLen{} - static_cast<nLen>(Offset) : static_cast<nLen>(Offset), std::chrono::steady_clock::now() - start);
+}
+
+nLen natInstrumentedStream::ReadBytes(nData pData, nLen Length)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto readBytes = m_InternalStream->ReadBytes(pData, Length);
+	record(Operation::Read, readBytes, std::chrono::steady_clock::now() - start);
+	return readBytes;
+}
+
+nLen natInstrumentedStream::WriteBytes(ncData pData, nLen Length)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto writtenBytes = m_InternalStream->WriteBytes(pData, Length);
+	// 部分流无法反馈已写入的字节数，因此记录请求写入的长度
+	record(Operation::Write, Length, std::chrono::steady_clock::now() - start);
+	return writtenBytes;
+}
+
+void natInstrumentedStream::Flush()
+{
+	const auto start = std::chrono::steady_clock::now();
+	m_InternalStream->Flush();
+	record(Operation::Flush, 0, std::chrono::steady_clock::now() - start);
+}
+
+void natInstrumentedStream::record(Operation operation, nLen size, std::chrono::steady_clock::duration elapsed)
+{
+	const auto elapsedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+
+	natRefScopeGuard<natCriticalSection> guard{ m_Section };
+	auto& statistics = m_Statistics[static_cast<size_t>(operation)];
+	++statistics.CallCount;
+	statistics.TotalBytes += size;
+	statistics.TotalTime += elapsedTime;
+	statistics.MaxTime = std::max(statistics.MaxTime, elapsedTime);
+	++statistics.SizeHistogram[GetHistogramBucket(size)];
+}
+
 natSubStream::natSubStream(natRefPointer<natStream> stream, nLen startPosition, nLen endPosition)
 	: natRefObjImpl{ std::move(stream) }, m_StartPosition{ startPosition }, m_EndPosition{ endPosition }, m_CurrentPosition{ startPosition }
 {
@@ -448,6 +552,16 @@ std::future<nLen> natSubStream::WriteBytesAsync(ncData pData, nLen Length)
 	return m_InternalStream->WriteBytesAsync(pData, realLength);
 }
 
+nLen natSubStream::GetStartPosition() const noexcept
+{
+	return m_StartPosition;
+}
+
+nLen natSubStream::GetEndPosition() const noexcept
+{
+	return m_EndPosition;
+}
+
 void natSubStream::adjustPosition() const
 {
 	assert(m_CurrentPosition >= m_StartPosition && m_CurrentPosition <= m_EndPosition);
@@ -798,6 +912,71 @@ void natFileStream::Flush()
 	FlushFileBuffers(m_hFile);
 }
 
+nLen natFileStream::ReadBytesAt(nLen Position, nData pData, nLen Length)
+{
+	if (!m_bReadable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	if (Length == 0ul)
+	{
+		return 0;
+	}
+
+	if (pData == nullptr)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+	}
+
+	OVERLAPPED olp{};
+	olp.Offset = static_cast<DWORD>(Position);
+	olp.OffsetHigh = static_cast<DWORD>(Position >> 32);
+	// 异步打开的文件可能同时有多个读取操作，需使用各自的事件等待
+	if (m_IsAsync)
+	{
+		olp.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!olp.hEvent)
+		{
+			nat_Throw(natWinException, "CreateEvent failed."_nv);
+		}
+	}
+	const auto scope = make_scope([&olp]
+	{
+		if (olp.hEvent)
+		{
+			CloseHandle(olp.hEvent);
+		}
+	});
+
+	// 同步打开的文件在读取后文件指针将位于Position + 读取的字节数，不在此处恢复
+	// 保存并恢复文件指针无法与其他线程中的ReadBytesAt同时进行，需要保持当前位置的调用者应自行在调用后SetPosition
+	DWORD tReadBytes = 0ul;
+	if (ReadFile(m_hFile, pData, static_cast<DWORD>(Length), m_IsAsync ? NULL : &tReadBytes, &olp) == FALSE)
+	{
+		const auto lastError = GetLastError();
+		if (lastError == ERROR_HANDLE_EOF)
+		{
+			return 0;
+		}
+		if (lastError != ERROR_IO_PENDING)
+		{
+			nat_Throw(natWinException, lastError, "ReadFile failed."_nv);
+		}
+	}
+
+	if (m_IsAsync && !GetOverlappedResult(m_hFile, &olp, &tReadBytes, TRUE))
+	{
+		const auto lastError = GetLastError();
+		if (lastError != ERROR_HANDLE_EOF)
+		{
+			nat_Throw(natWinException, lastError, "GetOverlappedResult failed."_nv);
+		}
+	}
+
+	return tReadBytes;
+}
+
 nStrView natFileStream::GetFilename() const noexcept
 {
 	return m_Filename;
@@ -842,7 +1021,7 @@ natFileStream::~natFileStream()
 }
 
 natStdStream::natStdStream(StdStreamType stdStreamType)
-	: m_StdStreamType(stdStreamType)
+	: m_StdStreamType(stdStreamType), m_FlushPolicy(FlushPolicy::Unbuffered), m_ThreadSafe(true), m_BufferSize(), m_FlushInterval()
 {
 	switch (m_StdStreamType)
 	{
@@ -879,10 +1058,6 @@ nBool natStdStream::UseFileApi() const noexcept
 	return m_InternalStream;
 }
 
-natStdStream::~natStdStream()
-{
-}
-
 natStdStream::NativeHandle natStdStream::GetNativeHandle() const noexcept
 {
 	return m_StdHandle;
@@ -984,32 +1159,13 @@ std::future<nLen> natStdStream::ReadBytesAsync(nData pData, nLen Length)
 	});
 }
 
-void natStdStream::WriteByte(nByte byte)
-{
-	if (m_InternalStream)
-	{
-		m_InternalStream->WriteByte(byte);
-	}
-
-	if (WriteBytes(&byte, 1) != 1)
-	{
-		nat_Throw(natWinException, "Cannot write byte."_nv);
-	}
-}
-
-nLen natStdStream::WriteBytes(ncData pData, nLen Length)
+nLen natStdStream::writeDirect(ncData pData, nLen Length)
 {
 	if (m_InternalStream)
 	{
 		return m_InternalStream->WriteBytes(pData, Length);
 	}
 
-	// Workaround: 辣鸡WinAPI
-	if (!CanWrite())
-	{
-		nat_Throw(natErrException, NatErr_IllegalState, "This stream cannot write."_nv);
-	}
-
 	DWORD writtenCharsCount;
 	if (!WriteConsole(m_StdHandle, pData, static_cast<DWORD>(Length / sizeof(TCHAR)), &writtenCharsCount, NULL))
 	{
@@ -1019,20 +1175,7 @@ nLen natStdStream::WriteBytes(ncData pData, nLen Length)
 	return static_cast<nLen>(writtenCharsCount * sizeof(TCHAR));
 }
 
-std::future<nLen> natStdStream::WriteBytesAsync(ncData pData, nLen Length)
-{
-	if (m_InternalStream)
-	{
-		return m_InternalStream->WriteBytesAsync(pData, Length);
-	}
-
-	return std::async(std::launch::async, [=]
-	{
-		return WriteBytes(pData, Length);
-	});
-}
-
-void natStdStream::Flush()
+void natStdStream::flushDirect()
 {
 	if (m_InternalStream)
 	{
@@ -1227,6 +1370,42 @@ nLen natFileStream::WriteBytes(ncData pData, nLen Length)
 
 void natFileStream::Flush()
 {
+	if (m_pMappedFile && m_bWritable)
+	{
+		msync(const_cast<nData>(m_pMappedFile->GetExternData()), static_cast<std::size_t>(m_pMappedFile->GetSize()), MS_SYNC);
+	}
+}
+
+nLen natFileStream::ReadBytesAt(nLen Position, nData pData, nLen Length)
+{
+	if (!m_bReadable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	if (Length == 0ul)
+	{
+		return 0;
+	}
+
+	if (pData == nullptr)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "pData cannot be nullptr."_nv);
+	}
+
+	while (true)
+	{
+		const auto ret = pread(m_hFile, pData, static_cast<std::size_t>(Length), static_cast<off_t>(Position));
+		if (ret >= 0)
+		{
+			return static_cast<nLen>(ret);
+		}
+
+		if (errno != EINTR)
+		{
+			nat_Throw(natErrException, NatErr_InternalErr, "pread failed (errno = {0})."_nv, errno);
+		}
+	}
 }
 
 nStrView natFileStream::GetFilename() const noexcept
@@ -1239,8 +1418,36 @@ natFileStream::UnsafeHandle natFileStream::GetUnsafeHandle() const noexcept
 	return m_hFile;
 }
 
+natRefPointer<natExternMemoryStream> natFileStream::MapToMemoryStream()
+{
+	if (m_pMappedFile)
+	{
+		return m_pMappedFile;
+	}
+
+	const auto size = GetSize();
+	if (size == 0)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Cannot map an empty file."_nv);
+	}
+
+	const auto pFile = mmap(nullptr, static_cast<std::size_t>(size), (m_bReadable ? PROT_READ : 0) | (m_bWritable ? PROT_WRITE : 0), MAP_SHARED, m_hFile, 0);
+	if (pFile == MAP_FAILED)
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "mmap failed (errno = {0})."_nv, errno);
+	}
+
+	m_pMappedFile = make_ref<natExternMemoryStream>(static_cast<nData>(pFile), size, m_bReadable, m_bWritable);
+
+	return m_pMappedFile;
+}
+
 natFileStream::~natFileStream()
 {
+	if (m_pMappedFile)
+	{
+		munmap(const_cast<nData>(m_pMappedFile->GetExternData()), static_cast<std::size_t>(m_pMappedFile->GetSize()));
+	}
 	if (m_ShouldDispose)
 	{
 		close(m_hFile);
@@ -1248,7 +1455,7 @@ natFileStream::~natFileStream()
 }
 
 natStdStream::natStdStream(StdStreamType stdStreamType)
-	: m_StdStreamType(stdStreamType)
+	: m_StdStreamType(stdStreamType), m_FlushPolicy(FlushPolicy::Unbuffered), m_ThreadSafe(true), m_BufferSize(), m_FlushInterval()
 {
 	switch (m_StdStreamType)
 	{
@@ -1266,10 +1473,6 @@ natStdStream::natStdStream(StdStreamType stdStreamType)
 	}
 }
 
-natStdStream::~natStdStream()
-{
-}
-
 natStdStream::NativeHandle natStdStream::GetNativeHandle() const noexcept
 {
 	return m_StdHandle;
@@ -1379,10 +1582,120 @@ std::future<nLen> natStdStream::ReadBytesAsync(nData pData, nLen Length)
 	});
 }
 
+nLen natStdStream::writeDirect(ncData pData, nLen Length)
+{
+	// 不需要加锁时使用glibc提供的无锁版本
+#ifdef __GLIBC__
+	if (!m_ThreadSafe)
+	{
+		return static_cast<nLen>(fwrite_unlocked(pData, 1, Length, m_StdHandle));
+	}
+#endif
+
+	return static_cast<nLen>(fwrite(pData, 1, Length, m_StdHandle));
+}
+
+void natStdStream::flushDirect()
+{
+#ifdef __GLIBC__
+	if (!m_ThreadSafe)
+	{
+		fflush_unlocked(m_StdHandle);
+		return;
+	}
+#endif
+
+	fflush(m_StdHandle);
+}
+
+#endif
+
+namespace
+{
+	class OptionalLockGuard final
+		: nonmovable
+	{
+	public:
+		OptionalLockGuard(natCriticalSection& section, nBool enabled)
+			: m_Section(enabled ? &section : nullptr)
+		{
+			if (m_Section)
+			{
+				m_Section->Lock();
+			}
+		}
+
+		~OptionalLockGuard()
+		{
+			if (m_Section)
+			{
+				m_Section->UnLock();
+			}
+		}
+
+	private:
+		natCriticalSection* m_Section;
+	};
+}
+
+natStdStream::~natStdStream()
+{
+	if (CanWrite() && !m_Buffer.empty())
+	{
+		try
+		{
+			flushBuffer();
+			flushDirect();
+		}
+		catch (...)
+		{
+		}
+	}
+}
+
+void natStdStream::SetBufferMode(FlushPolicy policy, nLen bufferSize, std::chrono::milliseconds flushInterval, nBool threadSafe)
+{
+	if (!CanWrite())
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "This stream cannot write."_nv);
+	}
+
+	if (policy != FlushPolicy::Unbuffered && policy != FlushPolicy::Explicit && !bufferSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "bufferSize cannot be zero."_nv);
+	}
+
+	OptionalLockGuard guard{ m_Section, m_ThreadSafe };
+	flushBuffer();
+	flushDirect();
+
+	m_FlushPolicy = policy;
+	m_ThreadSafe = threadSafe;
+	m_BufferSize = policy == FlushPolicy::Unbuffered ? 0 : bufferSize;
+	m_FlushInterval = flushInterval;
+	m_LastFlushTime = std::chrono::steady_clock::now();
+
+	std::vector<nByte> buffer;
+	buffer.reserve(m_BufferSize);
+	m_Buffer.swap(buffer);
+}
+
+natStdStream::FlushPolicy natStdStream::GetFlushPolicy() const noexcept
+{
+	return m_FlushPolicy;
+}
+
+nLen natStdStream::GetBufferSize() const noexcept
+{
+	return m_BufferSize;
+}
+
 void natStdStream::WriteByte(nByte byte)
 {
-	assert(CanWrite());
-	WriteBytes(&byte, 1);
+	if (WriteBytes(&byte, 1) != 1)
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "Failed to write a byte."_nv);
+	}
 }
 
 nLen natStdStream::WriteBytes(ncData pData, nLen Length)
@@ -1392,12 +1705,42 @@ nLen natStdStream::WriteBytes(ncData pData, nLen Length)
 		nat_Throw(natErrException, NatErr_IllegalState, "This stream cannot write."_nv);
 	}
 
-	return static_cast<nLen>(fwrite(pData, Length, 1, m_StdHandle));
+	if (m_FlushPolicy == FlushPolicy::Unbuffered)
+	{
+		return writeDirect(pData, Length);
+	}
+
+	OptionalLockGuard guard{ m_Section, m_ThreadSafe };
+
+	if (m_FlushPolicy != FlushPolicy::Explicit && m_Buffer.size() + Length > m_BufferSize)
+	{
+		flushBuffer();
+		// 放不进缓冲区的数据直接写出
+		if (Length >= m_BufferSize)
+		{
+			return writeDirect(pData, Length);
+		}
+	}
+
+	m_Buffer.insert(m_Buffer.end(), pData, pData + Length);
+
+	if (m_FlushPolicy == FlushPolicy::Interval)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now - m_LastFlushTime >= m_FlushInterval)
+		{
+			flushBuffer();
+			flushDirect();
+			m_LastFlushTime = now;
+		}
+	}
+
+	return Length;
 }
 
 std::future<nLen> natStdStream::WriteBytesAsync(ncData pData, nLen Length)
 {
-	return std::async(std::launch::async, [=]()
+	return std::async(std::launch::async, [=]
 	{
 		return WriteBytes(pData, Length);
 	});
@@ -1405,13 +1748,37 @@ std::future<nLen> natStdStream::WriteBytesAsync(ncData pData, nLen Length)
 
 void natStdStream::Flush()
 {
-	fflush(m_StdHandle);
+	if (CanWrite())
+	{
+		OptionalLockGuard guard{ m_Section, m_ThreadSafe };
+		flushBuffer();
+		flushDirect();
+		m_LastFlushTime = std::chrono::steady_clock::now();
+		return;
+	}
+
+	flushDirect();
 }
 
-#endif
+void natStdStream::flushBuffer()
+{
+	if (m_Buffer.empty())
+	{
+		return;
+	}
 
-natMemoryStream::natMemoryStream(ncData pData, nLen Length, nBool bReadable, nBool bWritable, nBool autoResize)
-	: m_pData(nullptr), m_Size(), m_CurPos(), m_bReadable(bReadable), m_bWritable(bWritable), m_AutoResize(autoResize)
+	const auto size = m_Buffer.size();
+	const auto written = writeDirect(m_Buffer.data(), size);
+	m_Buffer.clear();
+	if (written != size)
+	{
+		nat_Throw(natErrException, NatErr_InternalErr, "Failed to write buffered data, {0} of {1} bytes written."_nv, written, size);
+	}
+}
+
+template <typename LockType>
+natBasicMemoryStream<LockType>::natBasicMemoryStream(ncData pData, nLen Length, nBool bReadable, nBool bWritable, nBool autoResize)
+	: m_pData(nullptr), m_Size(), m_Capacity(), m_CurPos(), m_bReadable(bReadable), m_bWritable(bWritable), m_AutoResize(autoResize)
 {
 	Reserve(Length);
 
@@ -1422,66 +1789,78 @@ natMemoryStream::natMemoryStream(ncData pData, nLen Length, nBool bReadable, nBo
 	}
 }
 
-natMemoryStream::natMemoryStream(nLen Length, nBool bReadable, nBool bWritable, nBool autoResize)
-	: natMemoryStream(nullptr, Length, bReadable, bWritable, autoResize)
+template <typename LockType>
+natBasicMemoryStream<LockType>::natBasicMemoryStream(nLen Length, nBool bReadable, nBool bWritable, nBool autoResize)
+	: natBasicMemoryStream(nullptr, Length, bReadable, bWritable, autoResize)
 {
 }
 
-natMemoryStream::natMemoryStream(natMemoryStream const& other)
-	: natRefObjImpl{}, m_pData(), m_Size(), m_Capacity(), m_CurPos(), m_bReadable(), m_bWritable(), m_AutoResize()
+template <typename LockType>
+natBasicMemoryStream<LockType>::natBasicMemoryStream(natBasicMemoryStream const& other)
+	: natRefObjImpl<natBasicMemoryStream, natStream>{}, m_pData(), m_Size(), m_Capacity(), m_CurPos(), m_bReadable(), m_bWritable(), m_AutoResize()
 {
 	*this = other;
 }
 
-natMemoryStream::natMemoryStream(natMemoryStream&& other) noexcept
-	: natRefObjImpl{}, m_pData(), m_Size(), m_Capacity(), m_CurPos(), m_bReadable(), m_bWritable(), m_AutoResize()
+template <typename LockType>
+natBasicMemoryStream<LockType>::natBasicMemoryStream(natBasicMemoryStream&& other) noexcept
+	: natRefObjImpl<natBasicMemoryStream, natStream>{}, m_pData(), m_Size(), m_Capacity(), m_CurPos(), m_bReadable(), m_bWritable(), m_AutoResize()
 {
 	*this = std::move(other);
 }
 
-nBool natMemoryStream::CanWrite() const
+template <typename LockType>
+nBool natBasicMemoryStream<LockType>::CanWrite() const
 {
 	return m_bWritable;
 }
 
-nBool natMemoryStream::CanRead() const
+template <typename LockType>
+nBool natBasicMemoryStream<LockType>::CanRead() const
 {
 	return m_bReadable;
 }
 
-nBool natMemoryStream::CanResize() const
+template <typename LockType>
+nBool natBasicMemoryStream<LockType>::CanResize() const
 {
 	return true;
 }
 
-nBool natMemoryStream::CanSeek() const
+template <typename LockType>
+nBool natBasicMemoryStream<LockType>::CanSeek() const
 {
 	return true;
 }
 
-nBool natMemoryStream::IsEndOfStream() const
+template <typename LockType>
+nBool natBasicMemoryStream<LockType>::IsEndOfStream() const
 {
 	return m_CurPos >= m_Size;
 }
 
-nLen natMemoryStream::GetSize() const
+template <typename LockType>
+nLen natBasicMemoryStream<LockType>::GetSize() const
 {
 	return m_Size;
 }
 
-void natMemoryStream::SetSize(nLen Size)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::SetSize(nLen Size)
 {
 	Reserve(Size);
 	m_Size = Size;
 	m_CurPos = std::min(m_CurPos, m_Size);
 }
 
-nLen natMemoryStream::GetPosition() const
+template <typename LockType>
+nLen natBasicMemoryStream<LockType>::GetPosition() const
 {
 	return m_CurPos;
 }
 
-void natMemoryStream::SetPosition(NatSeek Origin, nLong Offset)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::SetPosition(NatSeek Origin, nLong Offset)
 {
 	switch (Origin)
 	{
@@ -1516,7 +1895,8 @@ void natMemoryStream::SetPosition(NatSeek Origin, nLong Offset)
 	}
 }
 
-nByte natMemoryStream::ReadByte()
+template <typename LockType>
+nByte natBasicMemoryStream<LockType>::ReadByte()
 {
 	if (m_CurPos >= m_Size)
 	{
@@ -1526,7 +1906,8 @@ nByte natMemoryStream::ReadByte()
 	return m_pData[m_CurPos++];
 }
 
-nLen natMemoryStream::ReadBytes(nData pData, nLen Length)
+template <typename LockType>
+nLen natBasicMemoryStream<LockType>::ReadBytes(nData pData, nLen Length)
 {
 	assert(m_pData && "m_pData should not be nullptr.");
 
@@ -1542,7 +1923,7 @@ nLen natMemoryStream::ReadBytes(nData pData, nLen Length)
 		return tReadBytes;
 	}
 
-	natRefScopeGuard<natCriticalSection> guard(m_CriSection);
+	natRefScopeGuard<LockType> guard(m_CriSection);
 
 	tReadBytes = std::min(Length, m_Size - m_CurPos);
 	std::memmove(pData, m_pData + m_CurPos, static_cast<std::size_t>(tReadBytes));
@@ -1551,15 +1932,25 @@ nLen natMemoryStream::ReadBytes(nData pData, nLen Length)
 	return tReadBytes;
 }
 
-std::future<nLen> natMemoryStream::ReadBytesAsync(nData pData, nLen Length)
+template <typename LockType>
+std::future<nLen> natBasicMemoryStream<LockType>::ReadBytesAsync(nData pData, nLen Length)
 {
-	return std::async(std::launch::async, [=]()
+	// 内存操作开销很小，直接同步完成以避免创建线程
+	std::promise<nLen> result;
+	try
 	{
-		return ReadBytes(pData, Length);
-	});
+		result.set_value(ReadBytes(pData, Length));
+	}
+	catch (...)
+	{
+		result.set_exception(std::current_exception());
+	}
+
+	return result.get_future();
 }
 
-void natMemoryStream::WriteByte(nByte byte)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::WriteByte(nByte byte)
 {
 	if (m_CurPos >= m_Capacity)
 	{
@@ -1571,7 +1962,8 @@ void natMemoryStream::WriteByte(nByte byte)
 	assert(m_Size <= m_Capacity);
 }
 
-nLen natMemoryStream::WriteBytes(ncData pData, nLen Length)
+template <typename LockType>
+nLen natBasicMemoryStream<LockType>::WriteBytes(ncData pData, nLen Length)
 {
 	assert(m_pData && "m_pData should not be nullptr.");
 	nLen tWriteBytes = 0ul;
@@ -1586,7 +1978,7 @@ nLen natMemoryStream::WriteBytes(ncData pData, nLen Length)
 		return tWriteBytes;
 	}
 
-	natRefScopeGuard<natCriticalSection> guard(m_CriSection);
+	natRefScopeGuard<LockType> guard(m_CriSection);
 
 	if (Length > m_Capacity - m_CurPos)
 	{
@@ -1612,29 +2004,42 @@ nLen natMemoryStream::WriteBytes(ncData pData, nLen Length)
 	return tWriteBytes;
 }
 
-std::future<nLen> natMemoryStream::WriteBytesAsync(ncData pData, nLen Length)
+template <typename LockType>
+std::future<nLen> natBasicMemoryStream<LockType>::WriteBytesAsync(ncData pData, nLen Length)
 {
-	return std::async(std::launch::async, [=]()
+	// 内存操作开销很小，直接同步完成以避免创建线程
+	std::promise<nLen> result;
+	try
 	{
-		return WriteBytes(pData, Length);
-	});
+		result.set_value(WriteBytes(pData, Length));
+	}
+	catch (...)
+	{
+		result.set_exception(std::current_exception());
+	}
+
+	return result.get_future();
 }
 
-void natMemoryStream::Flush()
+template <typename LockType>
+void natBasicMemoryStream<LockType>::Flush()
 {
 }
 
-nData natMemoryStream::GetInternalBuffer() noexcept
+template <typename LockType>
+nData natBasicMemoryStream<LockType>::GetInternalBuffer() noexcept
 {
 	return m_pData;
 }
 
-ncData natMemoryStream::GetInternalBuffer() const noexcept
+template <typename LockType>
+ncData natBasicMemoryStream<LockType>::GetInternalBuffer() const noexcept
 {
 	return m_pData;
 }
 
-void natMemoryStream::Reserve(nLen newCapacity)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::Reserve(nLen newCapacity)
 {
 	using std::swap;
 
@@ -1649,39 +2054,45 @@ void natMemoryStream::Reserve(nLen newCapacity)
 		delete[] pNewStorage;
 	});
 
-	if (m_Size > 0 && m_pData)
+	// 容量可能缩小（如SetSize(0)），只复制新容量能容纳的部分
+	const auto copySize = std::min(m_Size, newCapacity);
+	if (copySize > 0 && m_pData)
 	{
-		std::memmove(pNewStorage, m_pData, static_cast<std::size_t>(m_Size));
+		std::memmove(pNewStorage, m_pData, static_cast<std::size_t>(copySize));
 	}
 
 	swap(m_pData, pNewStorage);
 	m_Capacity = newCapacity;
 }
 
-nLen natMemoryStream::GetCapacity() const noexcept
+template <typename LockType>
+nLen natBasicMemoryStream<LockType>::GetCapacity() const noexcept
 {
 	return m_Capacity;
 }
 
-void natMemoryStream::ClearAndResetSize(nLen capacity)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::ClearAndResetSize(nLen capacity)
 {
 	allocateAndInvalidateOldData(capacity);
 }
 
-natMemoryStream::~natMemoryStream()
+template <typename LockType>
+natBasicMemoryStream<LockType>::~natBasicMemoryStream()
 {
 	SafeDelArr(m_pData);
 }
 
-natMemoryStream& natMemoryStream::operator=(natMemoryStream const& other)
+template <typename LockType>
+natBasicMemoryStream<LockType>& natBasicMemoryStream<LockType>::operator=(natBasicMemoryStream const& other)
 {
 	if (this == &other)
 	{
 		return *this;
 	}
 
-	natRefScopeGuard<natCriticalSection> otherguard(m_CriSection);
-	natRefScopeGuard<natCriticalSection> selfguard(other.m_CriSection);
+	natRefScopeGuard<LockType> otherguard(m_CriSection);
+	natRefScopeGuard<LockType> selfguard(other.m_CriSection);
 
 	if (other.m_Size > m_Capacity)
 	{
@@ -1702,7 +2113,8 @@ natMemoryStream& natMemoryStream::operator=(natMemoryStream const& other)
 	return *this;
 }
 
-natMemoryStream& natMemoryStream::operator=(natMemoryStream&& other) noexcept
+template <typename LockType>
+natBasicMemoryStream<LockType>& natBasicMemoryStream<LockType>::operator=(natBasicMemoryStream&& other) noexcept
 {
 	using std::swap;
 
@@ -1711,8 +2123,8 @@ natMemoryStream& natMemoryStream::operator=(natMemoryStream&& other) noexcept
 		return *this;
 	}
 
-	natRefScopeGuard<natCriticalSection> otherguard(m_CriSection);
-	natRefScopeGuard<natCriticalSection> selfguard(other.m_CriSection);
+	natRefScopeGuard<LockType> otherguard(m_CriSection);
+	natRefScopeGuard<LockType> selfguard(other.m_CriSection);
 
 	swap(m_pData, other.m_pData);
 	swap(m_Size, other.m_Size);
@@ -1725,7 +2137,8 @@ natMemoryStream& natMemoryStream::operator=(natMemoryStream&& other) noexcept
 	return *this;
 }
 
-void natMemoryStream::allocateAndInvalidateOldData(nLen newCapacity)
+template <typename LockType>
+void natBasicMemoryStream<LockType>::allocateAndInvalidateOldData(nLen newCapacity)
 {
 	using std::swap;
 
@@ -1741,6 +2154,247 @@ void natMemoryStream::allocateAndInvalidateOldData(nLen newCapacity)
 	delete[] pNewStorage;
 }
 
+namespace NatsuLib
+{
+	template class natBasicMemoryStream<natCriticalSection>;
+	template class natBasicMemoryStream<natNullCriticalSection>;
+}
+
+natChunkedMemoryStream::natChunkedMemoryStream(nBool bReadable, nBool bWritable, nLen chunkSize)
+	: m_ChunkSize{ chunkSize }, m_Size{}, m_CurPos{}, m_bReadable{ bReadable }, m_bWritable{ bWritable }
+{
+	if (!chunkSize)
+	{
+		nat_Throw(natErrException, NatErr_InvalidArg, "chunkSize should not be zero."_nv);
+	}
+}
+
+natChunkedMemoryStream::~natChunkedMemoryStream()
+{
+}
+
+nBool natChunkedMemoryStream::CanWrite() const
+{
+	return m_bWritable;
+}
+
+nBool natChunkedMemoryStream::CanRead() const
+{
+	return m_bReadable;
+}
+
+nBool natChunkedMemoryStream::CanResize() const
+{
+	return true;
+}
+
+nBool natChunkedMemoryStream::CanSeek() const
+{
+	return true;
+}
+
+nBool natChunkedMemoryStream::IsEndOfStream() const
+{
+	return m_CurPos >= m_Size;
+}
+
+nLen natChunkedMemoryStream::GetSize() const
+{
+	return m_Size;
+}
+
+void natChunkedMemoryStream::SetSize(nLen Size)
+{
+	ensureCapacity(Size);
+	m_Chunks.resize(static_cast<std::size_t>((Size + m_ChunkSize - 1) / m_ChunkSize));
+
+	// 扩大时将新增的部分清零，缩小后再次扩大时不会暴露之前的数据
+	for (auto pos = m_Size; pos < Size;)
+	{
+		const auto offsetInChunk = pos % m_ChunkSize;
+		const auto currentSize = std::min(Size - pos, m_ChunkSize - offsetInChunk);
+		std::memset(m_Chunks[static_cast<std::size_t>(pos / m_ChunkSize)].get() + offsetInChunk, 0, static_cast<std::size_t>(currentSize));
+		pos += currentSize;
+	}
+
+	m_Size = Size;
+	m_CurPos = std::min(m_CurPos, m_Size);
+}
+
+nLen natChunkedMemoryStream::GetPosition() const
+{
+	return m_CurPos;
+}
+
+void natChunkedMemoryStream::SetPosition(NatSeek Origin, nLong Offset)
+{
+	nLen base;
+	switch (Origin)
+	{
+	case NatSeek::Beg:
+		base = 0;
+		break;
+	case NatSeek::Cur:
+		base = m_CurPos;
+		break;
+	case NatSeek::End:
+		base = m_Size;
+		break;
+	default:
+		assert(!"Invalid Origin.");
+		nat_Throw(natErrException, NatErr_InvalidArg, "Origin is not a valid NatSeek."_nv);
+	}
+
+	if ((Offset < 0 && base < static_cast<nLen>(-Offset)) || (Offset > 0 && m_Size - base < static_cast<nLen>(Offset)))
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "Out of range."_nv);
+	}
+
+	m_CurPos = base + Offset;
+}
+
+nByte natChunkedMemoryStream::ReadByte()
+{
+	if (!m_bReadable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	if (m_CurPos >= m_Size)
+	{
+		nat_Throw(natErrException, NatErr_OutOfRange, "End of stream reached."_nv);
+	}
+
+	const auto byte = m_Chunks[static_cast<std::size_t>(m_CurPos / m_ChunkSize)][static_cast<std::size_t>(m_CurPos % m_ChunkSize)];
+	++m_CurPos;
+	return byte;
+}
+
+nLen natChunkedMemoryStream::ReadBytes(nData pData, nLen Length)
+{
+	if (!m_bReadable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	const auto totalReadBytes = std::min(Length, m_Size - m_CurPos);
+	auto remainedBytes = totalReadBytes;
+	while (remainedBytes)
+	{
+		const auto offsetInChunk = m_CurPos % m_ChunkSize;
+		const auto currentReadBytes = std::min(remainedBytes, m_ChunkSize - offsetInChunk);
+		std::memcpy(pData, m_Chunks[static_cast<std::size_t>(m_CurPos / m_ChunkSize)].get() + offsetInChunk, static_cast<std::size_t>(currentReadBytes));
+		pData += currentReadBytes;
+		m_CurPos += currentReadBytes;
+		remainedBytes -= currentReadBytes;
+	}
+
+	return totalReadBytes;
+}
+
+void natChunkedMemoryStream::WriteByte(nByte byte)
+{
+	if (!m_bWritable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+	}
+
+	ensureCapacity(m_CurPos + 1);
+	m_Chunks[static_cast<std::size_t>(m_CurPos / m_ChunkSize)][static_cast<std::size_t>(m_CurPos % m_ChunkSize)] = byte;
+	++m_CurPos;
+	m_Size = std::max(m_CurPos, m_Size);
+}
+
+nLen natChunkedMemoryStream::WriteBytes(ncData pData, nLen Length)
+{
+	if (!m_bWritable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not writable."_nv);
+	}
+
+	ensureCapacity(m_CurPos + Length);
+
+	auto remainedBytes = Length;
+	while (remainedBytes)
+	{
+		const auto offsetInChunk = m_CurPos % m_ChunkSize;
+		const auto currentWrittenBytes = std::min(remainedBytes, m_ChunkSize - offsetInChunk);
+		std::memcpy(m_Chunks[static_cast<std::size_t>(m_CurPos / m_ChunkSize)].get() + offsetInChunk, pData, static_cast<std::size_t>(currentWrittenBytes));
+		pData += currentWrittenBytes;
+		m_CurPos += currentWrittenBytes;
+		remainedBytes -= currentWrittenBytes;
+	}
+
+	m_Size = std::max(m_CurPos, m_Size);
+	return Length;
+}
+
+nLen natChunkedMemoryStream::CopyTo(natRefPointer<natStream> const& other)
+{
+	assert(other && "other should not be nullptr.");
+
+	if (!m_bReadable)
+	{
+		nat_Throw(natErrException, NatErr_IllegalState, "Stream is not readable."_nv);
+	}
+
+	nLen totalReadBytes{};
+	while (m_CurPos < m_Size)
+	{
+		const auto offsetInChunk = m_CurPos % m_ChunkSize;
+		const auto currentReadBytes = std::min(m_Size - m_CurPos, m_ChunkSize - offsetInChunk);
+		other->WriteBytes(m_Chunks[static_cast<std::size_t>(m_CurPos / m_ChunkSize)].get() + offsetInChunk, currentReadBytes);
+		m_CurPos += currentReadBytes;
+		totalReadBytes += currentReadBytes;
+	}
+
+	return totalReadBytes;
+}
+
+void natChunkedMemoryStream::Flush()
+{
+}
+
+nLen natChunkedMemoryStream::GetChunkSize() const noexcept
+{
+	return m_ChunkSize;
+}
+
+std::size_t natChunkedMemoryStream::GetChunkCount() const noexcept
+{
+	return m_Chunks.size();
+}
+
+nBool natChunkedMemoryStream::EnumChunks(std::function<nBool(ncData, nLen)> const& enumerator) const
+{
+	auto remainedBytes = m_Size;
+	for (auto&& chunk : m_Chunks)
+	{
+		if (!remainedBytes)
+		{
+			break;
+		}
+
+		const auto chunkDataSize = std::min(remainedBytes, m_ChunkSize);
+		if (enumerator(chunk.get(), chunkDataSize))
+		{
+			return true;
+		}
+		remainedBytes -= chunkDataSize;
+	}
+
+	return false;
+}
+
+void natChunkedMemoryStream::ensureCapacity(nLen capacity)
+{
+	const auto chunkCount = static_cast<std::size_t>((capacity + m_ChunkSize - 1) / m_ChunkSize);
+	while (m_Chunks.size() < chunkCount)
+	{
+		m_Chunks.emplace_back(new nByte[static_cast<std::size_t>(m_ChunkSize)]);
+	}
+}
+
 natExternMemoryStream::natExternMemoryStream(nData externData, nLen size, nBool readable, nBool writable)
 	: m_ExternData{ externData }, m_Size{ size }, m_CurrentPos{}, m_Readable{ readable }, m_Writable{ writable }
 {
@@ -1810,7 +2464,7 @@ void natExternMemoryStream::SetPosition(NatSeek Origin, nLong Offset)
 		m_CurrentPos = Offset;
 		break;
 	case NatSeek::Cur:
-		if ((Offset < 0 && m_CurrentPos < static_cast<nLen>(-Offset)) || m_Size > static_cast<nLen>(m_CurrentPos + Offset))
+		if ((Offset < 0 && m_CurrentPos < static_cast<nLen>(-Offset)) || m_Size < static_cast<nLen>(m_CurrentPos + Offset))
 			nat_Throw(OutOfRange, "Out of range."_nv);
 		m_CurrentPos += Offset;
 		break;
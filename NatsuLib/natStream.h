@@ -8,6 +8,10 @@
 #include "natString.h"
 #include "natException.h"
 
+#include <array>
+#include <chrono>
+#include <vector>
+
 #ifndef _WIN32
 #	include <fstream>
 #endif
@@ -199,21 +203,90 @@ namespace NatsuLib
 		std::function<void(DisposeCallbackStream&)> m_DisposeCallback;
 	};
 
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	统计流
+	///	@note	记录ReadBytes、WriteBytes、SetPosition及Flush的调用次数、字节数、大小分布及耗时，其他操作直接转发到内部流\n
+	///			可在流链的任意层插入，之后通过EnumStatistics获得每一层的统计，以便发现过小的读写
+	////////////////////////////////////////////////////////////////////////////////
+	class natInstrumentedStream final
+		: public natRefObjImpl<natInstrumentedStream, natWrappedStream>
+	{
+	public:
+		enum class Operation
+		{
+			Read,
+			Write,
+			Seek,
+			Flush,
+
+			Count
+		};
+
+		enum : size_t
+		{
+			///	@brief	第0个桶记录大小为0的调用，第i个桶记录大小在[2^(i-1), 2^i)之间的调用
+			HistogramBucketCount = 65,
+		};
+
+		struct OperationStatistics
+		{
+			nuLong CallCount;
+			nuLong TotalBytes;
+			std::chrono::nanoseconds TotalTime;
+			std::chrono::nanoseconds MaxTime;
+			std::array<nuLong, HistogramBucketCount> SizeHistogram;
+		};
+
+		explicit natInstrumentedStream(natRefPointer<natStream> stream, nString name = {});
+		~natInstrumentedStream();
+
+		///	@brief	获得创建时指定的名称，用于区分流链中的不同层
+		nStrView GetName() const noexcept;
+
+		///	@brief	获得特定操作的统计
+		OperationStatistics GetStatistics(Operation operation) const;
+		///	@brief	清空所有统计
+		void ResetStatistics();
+
+		///	@brief	获得大小在直方图中的桶序号
+		static size_t GetHistogramBucket(nLen size) noexcept;
+
+		///	@brief	依次枚举stream本身及其所有内部流中的natInstrumentedStream
+		///	@param	enumerator	枚举函数，返回true会立即停止枚举
+		///	@return	枚举是否由于enumerator返回true而中止
+		static nBool EnumStatistics(natRefPointer<natStream> const& stream, std::function<nBool(natInstrumentedStream&)> const& enumerator);
+
+		void SetPosition(NatSeek Origin, nLong Offset) override;
+		nLen ReadBytes(nData pData, nLen Length) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+		void Flush() override;
+
+	private:
+		const nString m_Name;
+		mutable natCriticalSection m_Section;
+		std::array<OperationStatistics, static_cast<size_t>(Operation::Count)> m_Statistics;
+
+		void record(Operation operation, nLen size, std::chrono::steady_clock::duration elapsed);
+	};
+
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	内存流
+	///	@tparam	LockType	用于保护流状态的锁类型，仅由单个线程使用时可使用natNullCriticalSection以避免加锁开销
+	///	@note	一般使用natMemoryStream及natUnsyncMemoryStream
 	////////////////////////////////////////////////////////////////////////////////
-	class natMemoryStream
-		: public natRefObjImpl<natMemoryStream, natStream>
+	template <typename LockType>
+	class natBasicMemoryStream
+		: public natRefObjImpl<natBasicMemoryStream<LockType>, natStream>
 	{
 	public:
-		natMemoryStream(ncData pData, nLen Length, nBool bReadable, nBool bWritable, nBool autoResize);
-		natMemoryStream(nLen Length, nBool bReadable, nBool bWritable, nBool autoResize);
-		natMemoryStream(natMemoryStream const& other);
-		natMemoryStream(natMemoryStream && other) noexcept;
-		~natMemoryStream();
+		natBasicMemoryStream(ncData pData, nLen Length, nBool bReadable, nBool bWritable, nBool autoResize);
+		natBasicMemoryStream(nLen Length, nBool bReadable, nBool bWritable, nBool autoResize);
+		natBasicMemoryStream(natBasicMemoryStream const& other);
+		natBasicMemoryStream(natBasicMemoryStream && other) noexcept;
+		~natBasicMemoryStream();
 
-		natMemoryStream& operator=(natMemoryStream const& other);
-		natMemoryStream& operator=(natMemoryStream && other) noexcept;
+		natBasicMemoryStream& operator=(natBasicMemoryStream const& other);
+		natBasicMemoryStream& operator=(natBasicMemoryStream && other) noexcept;
 
 		nBool CanWrite() const override;
 		nBool CanRead() const override;
@@ -247,7 +320,7 @@ namespace NatsuLib
 		void ClearAndResetSize(nLen capacity);
 
 	private:
-		mutable natCriticalSection m_CriSection;
+		mutable LockType m_CriSection;
 
 		nData m_pData;
 		nLen m_Size;
@@ -260,6 +333,79 @@ namespace NatsuLib
 		void allocateAndInvalidateOldData(nLen newCapacity);
 	};
 
+	///	@brief	内存流
+	///	@note	所有操作均会加锁
+	typedef natBasicMemoryStream<natCriticalSection> natMemoryStream;
+
+	///	@brief	非同步内存流
+	///	@note	不进行加锁，仅可由单个线程使用
+	typedef natBasicMemoryStream<natNullCriticalSection> natUnsyncMemoryStream;
+
+	extern template class natBasicMemoryStream<natCriticalSection>;
+	extern template class natBasicMemoryStream<natNullCriticalSection>;
+
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	分块内存流
+	///	@note	数据保存在若干固定大小的块中，增长时仅分配新块而不会重新分配并复制已有数据\n
+	///			已分配的块的地址在流的生命期内保持不变（除非通过SetSize截断）
+	///	@remark	实现提示：无线程安全保证
+	////////////////////////////////////////////////////////////////////////////////
+	class natChunkedMemoryStream
+		: public natRefObjImpl<natChunkedMemoryStream, natStream>, public nonmovable
+	{
+	public:
+		enum : nLen
+		{
+			DefaultChunkSize = 65536,
+		};
+
+		explicit natChunkedMemoryStream(nBool bReadable = true, nBool bWritable = true, nLen chunkSize = DefaultChunkSize);
+		~natChunkedMemoryStream();
+
+		nBool CanWrite() const override;
+		nBool CanRead() const override;
+		nBool CanResize() const override;
+		nBool CanSeek() const override;
+		nBool IsEndOfStream() const override;
+		nLen GetSize() const override;
+
+		///	@brief	设置流的大小
+		///	@note	与natMemoryStream不同，设置较小的大小会截断数据并释放多余的块
+		void SetSize(nLen Size) override;
+
+		nLen GetPosition() const override;
+		void SetPosition(NatSeek Origin, nLong Offset) override;
+		nByte ReadByte() override;
+		nLen ReadBytes(nData pData, nLen Length) override;
+		void WriteByte(nByte byte) override;
+		nLen WriteBytes(ncData pData, nLen Length) override;
+
+		///	@brief	将当前位置到结尾的内容复制到另一流
+		///	@note	直接将各个块交给另一流写入，不经过中间缓冲区
+		nLen CopyTo(natRefPointer<natStream> const& other) override;
+
+		void Flush() override;
+
+		nLen GetChunkSize() const noexcept;
+		std::size_t GetChunkCount() const noexcept;
+
+		///	@brief	按顺序枚举保存了有效数据的块，直到枚举完毕或者enumerator返回true为止
+		///	@param	enumerator	枚举函数，参数为块的起始地址及块内有效数据的长度，返回true会立即停止枚举
+		///	@note	枚举期间不应修改流
+		///	@return	枚举是否由于enumerator返回true而中止
+		nBool EnumChunks(std::function<nBool(ncData, nLen)> const& enumerator) const;
+
+	private:
+		std::vector<std::unique_ptr<nByte[]>> m_Chunks;
+		const nLen m_ChunkSize;
+		nLen m_Size;
+		nLen m_CurPos;
+		const nBool m_bReadable;
+		const nBool m_bWritable;
+
+		void ensureCapacity(nLen capacity);
+	};
+
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	外部内存流
 	///	@note	用于使用流的方式操作外部的内存
@@ -352,12 +498,18 @@ namespace NatsuLib
 
 		void Flush() override;
 
+		///	@brief	从指定位置读取数据
+		///	@note	可在多个线程中同时调用，除Windows下以同步方式打开的文件外不会改变流的当前位置\n
+		///			Windows下以同步方式打开的文件在调用后当前位置为Position加上读取的字节数，需要保持当前位置时请在调用后自行SetPosition
+		nLen ReadBytesAt(nLen Position, nData pData, nLen Length);
+
 		nStrView GetFilename() const noexcept;
 		UnsafeHandle GetUnsafeHandle() const noexcept;
 
-#ifdef _WIN32
+		///	@brief	将文件映射到内存
+		///	@note	映射的大小为调用时文件的大小，多次调用将返回同一个流
+		///	@warning	非Windows平台下映射在文件流析构时解除，此后不能再使用返回的流
 		natRefPointer<natExternMemoryStream> MapToMemoryStream();
-#endif
 
 	private:
 		UnsafeHandle m_hFile;
@@ -368,6 +520,7 @@ namespace NatsuLib
 		natRefPointer<natExternMemoryStream> m_pMappedFile;
 		const nBool m_IsAsync;
 #else
+		natRefPointer<natExternMemoryStream> m_pMappedFile;
 		nBool m_IsEndOfFile;
 #endif
 
@@ -401,6 +554,11 @@ namespace NatsuLib
 		nLen WriteBytes(ncData pData, nLen Length) override;
 		std::future<nLen> WriteBytesAsync(ncData pData, nLen Length) override;
 
+		///	@brief	获得本流在内部流中的起始位置
+		nLen GetStartPosition() const noexcept;
+		///	@brief	获得本流在内部流中的结束位置
+		nLen GetEndPosition() const noexcept;
+
 	private:
 		const nLen m_StartPosition;
 		const nLen m_EndPosition;
@@ -413,6 +571,8 @@ namespace NatsuLib
 	////////////////////////////////////////////////////////////////////////////////
 	///	@brief	标准流
 	///	@remark	用于操作标准输入输出
+	///	@note	标准输出及标准错误可通过SetBufferMode启用内部缓冲区以减少大量小块写入的开销，\n
+	///			启用后写入的数据与直接使用C运行库写入的数据的顺序仅在Flush后得到保证
 	////////////////////////////////////////////////////////////////////////////////
 	class natStdStream
 		: public natRefObjImpl<natStdStream, natStream>, public nonmovable
@@ -425,6 +585,20 @@ namespace NatsuLib
 			StdErr,
 		};
 
+		///	@brief	缓冲区刷新策略
+		enum class FlushPolicy
+		{
+			Unbuffered,	///< @brief	不使用缓冲区，直接写入（默认）
+			Size,		///< @brief	缓冲区满时写出
+			Interval,	///< @brief	缓冲区满或写入时距上次刷新超过指定间隔时写出并刷新
+			Explicit,	///< @brief	仅在调用Flush或析构时写出，缓冲区将按需增长
+		};
+
+		enum : nLen
+		{
+			DefaultBufferSize = 65536,
+		};
+
 #ifdef _WIN32
 		typedef HANDLE NativeHandle;
 
@@ -438,6 +612,16 @@ namespace NatsuLib
 
 		NativeHandle GetNativeHandle() const noexcept;
 
+		///	@brief	设置写入缓冲模式
+		///	@param	policy			缓冲区刷新策略
+		///	@param	bufferSize		缓冲区大小，对FlushPolicy::Explicit而言仅为初始容量
+		///	@param	flushInterval	FlushPolicy::Interval下的刷新间隔，仅在写入时检查
+		///	@param	threadSafe		是否对写入加锁，仅由单个线程写入时可设为false以使用无锁的写入路径
+		///	@note	设置前将写出缓冲区中的数据，调用时不应有其他线程正在写入此流
+		void SetBufferMode(FlushPolicy policy, nLen bufferSize = DefaultBufferSize, std::chrono::milliseconds flushInterval = std::chrono::milliseconds{ 100 }, nBool threadSafe = true);
+		FlushPolicy GetFlushPolicy() const noexcept;
+		nLen GetBufferSize() const noexcept;
+
 		nBool CanWrite() const override;
 		nBool CanRead() const override;
 		nBool CanResize() const override;
@@ -453,6 +637,7 @@ namespace NatsuLib
 		void WriteByte(nByte byte) override;
 		nLen WriteBytes(ncData pData, nLen Length) override;
 		std::future<nLen> WriteBytesAsync(ncData pData, nLen Length) override;
+		///	@brief	写出缓冲区中的数据并刷新底层流
 		void Flush() override;
 
 	private:
@@ -461,6 +646,18 @@ namespace NatsuLib
 #ifdef _WIN32
 		natRefPointer<natFileStream> m_InternalStream;
 #endif
+
+		FlushPolicy m_FlushPolicy;
+		nBool m_ThreadSafe;
+		nLen m_BufferSize;
+		std::chrono::milliseconds m_FlushInterval;
+		std::chrono::steady_clock::time_point m_LastFlushTime;
+		std::vector<nByte> m_Buffer;
+		natCriticalSection m_Section;
+
+		nLen writeDirect(ncData pData, nLen Length);
+		void flushDirect();
+		void flushBuffer();
 	};
 
 	namespace detail_
@@ -1,5 +1,7 @@
 ﻿#pragma once
 #include <utility>
+#include <algorithm>
+#include <cstring>
 #include "natStream.h"
 #include "natText.h"
 
@@ -10,6 +12,53 @@
 
 namespace NatsuLib
 {
+	namespace detail_
+	{
+		///	@brief	验证UTF-8数据
+		///	@return	验证结果及有效部分的结尾
+		inline std::pair<EncodingResult, const nChar*> ValidateUtf8(const nChar* begin, const nChar* end)
+		{
+			auto current = begin;
+			while (current != end)
+			{
+				// 一次检查8个字节是否均为ASCII
+				while (end - current >= 8)
+				{
+					nuLong word;
+					std::memcpy(&word, current, sizeof word);
+					if (word & 0x8080808080808080ull)
+					{
+						break;
+					}
+					current += 8;
+				}
+
+				if (current == end)
+				{
+					break;
+				}
+
+				if (!(static_cast<nByte>(*current) & 0x80))
+				{
+					++current;
+					continue;
+				}
+
+				nuInt codePoint;
+				EncodingResult result;
+				std::size_t length;
+				std::tie(result, length) = EncodingCodePoint<StringType::Utf8>::Decode({ current, end }, codePoint);
+				if (result != EncodingResult::Accept)
+				{
+					return { result, current };
+				}
+				current += length;
+			}
+
+			return { EncodingResult::Accept, end };
+		}
+	}
+
 	template <StringType encoding>
 	class natStreamReader final
 		: public natRefObjImpl<natStreamReader<encoding>, TextReader<encoding>>
@@ -19,7 +68,7 @@ namespace NatsuLib
 
 		enum
 		{
-			DefaultBufferSize = 128,
+			DefaultBufferSize = 65536,
 		};
 
 		explicit natStreamReader(natRefPointer<natStream> pStream, std::size_t bufferSize = DefaultBufferSize) noexcept
@@ -49,6 +98,37 @@ namespace NatsuLib
 			return InternalPeek(codePoint) > 0;
 		}
 
+		///	@note	对于UTF-8且终止符均为ASCII字符的情况，直接在缓冲区中查找终止符并整段添加到结果中
+		String<encoding> ReadUntil(std::initializer_list<nuInt> terminatorChars) override
+		{
+			if constexpr (encoding == StringType::Utf8)
+			{
+				if (std::all_of(terminatorChars.begin(), terminatorChars.end(), [](nuInt terminatorChar) { return terminatorChar < 0x80; }))
+				{
+					return BulkReadUntil(terminatorChars);
+				}
+			}
+
+			return TextReader<encoding>::ReadUntil(terminatorChars);
+		}
+
+		///	@note	对于UTF-8且换行符均为ASCII字符的情况，直接在缓冲区中查找换行符并整段添加到结果中
+		String<encoding> ReadLine() override
+		{
+			if constexpr (encoding == StringType::Utf8)
+			{
+				const auto& newLine = this->m_NewLine;
+				// 换行符的首字符不能在换行符中再次出现，否则部分匹配失败后可能错过真正的换行符
+				if (!newLine.empty() && std::find(std::next(newLine.begin()), newLine.end(), newLine.front()) == newLine.end()
+					&& std::all_of(newLine.begin(), newLine.end(), [](nuInt newLineChar) { return newLineChar < 0x80; }))
+				{
+					return BulkReadLine();
+				}
+			}
+
+			return TextReader<encoding>::ReadLine();
+		}
+
 		nBool IsEndOfStream() const
 		{
 			return m_InternalStream->IsEndOfStream();
@@ -59,6 +139,11 @@ namespace NatsuLib
 			return m_InternalStream;
 		}
 
+		std::size_t GetBufferSize() const noexcept
+		{
+			return m_BufferSize;
+		}
+
 	private:
 		natRefPointer<natStream> m_InternalStream;
 		std::vector<nByte> m_Buffer;
@@ -74,10 +159,11 @@ namespace NatsuLib
 			}
 
 			assert(size >= reserved);
-			assert(reserved <= m_Buffer.size());
+			assert(reserved <= m_EndPos);
 			if (reserved)
 			{
-				copy(prev(cend(m_Buffer), reserved), cend(m_Buffer), begin(m_Buffer));
+				const auto reservedBegin = std::next(cbegin(m_Buffer), static_cast<std::ptrdiff_t>(m_EndPos - reserved));
+				copy(reservedBegin, std::next(reservedBegin, static_cast<std::ptrdiff_t>(reserved)), begin(m_Buffer));
 			}
 			m_Buffer.resize(size);
 
@@ -106,8 +192,7 @@ namespace NatsuLib
 
 			EncodingResult result;
 			std::size_t readChars;
-			const ncData data = m_Buffer.data();
-			std::tie(result, readChars) = detail_::EncodingCodePoint<encoding>::Decode({ reinterpret_cast<const CharType*>(data + m_CurrentPos), reinterpret_cast<const CharType*>(data + std::min(m_EndPos, m_Buffer.size())) }, codePoint);
+			std::tie(result, readChars) = detail_::EncodingCodePoint<encoding>::Decode({ reinterpret_cast<const CharType*>(m_Buffer.data() + m_CurrentPos), reinterpret_cast<const CharType*>(m_Buffer.data() + std::min(m_EndPos, m_Buffer.size())) }, codePoint);
 			if (result == EncodingResult::Accept)
 			{
 				return readChars;
@@ -115,7 +200,7 @@ namespace NatsuLib
 			if (result == EncodingResult::Incomplete)
 			{
 				ReadBuffer(m_BufferSize, m_EndPos - m_CurrentPos);
-				std::tie(result, readChars) = detail_::EncodingCodePoint<encoding>::Decode({ reinterpret_cast<const CharType*>(data + m_CurrentPos), reinterpret_cast<const CharType*>(data + std::min(m_EndPos, m_Buffer.size())) }, codePoint);
+				std::tie(result, readChars) = detail_::EncodingCodePoint<encoding>::Decode({ reinterpret_cast<const CharType*>(m_Buffer.data() + m_CurrentPos), reinterpret_cast<const CharType*>(m_Buffer.data() + std::min(m_EndPos, m_Buffer.size())) }, codePoint);
 				if (result == EncodingResult::Accept)
 				{
 					return readChars;
@@ -126,51 +211,280 @@ namespace NatsuLib
 
 			return 0;
 		}
+
+		// 缓冲区已读完时重新读取，否则保留未处理的部分（不完整的字符）并读取后续数据
+		nBool FillBuffer()
+		{
+			if (m_InternalStream->IsEndOfStream())
+			{
+				return false;
+			}
+
+			const auto reserved = m_EndPos - m_CurrentPos;
+			ReadBuffer(std::max(m_BufferSize, reserved + 1), reserved);
+			return m_EndPos > reserved;
+		}
+
+		// 将[m_CurrentPos, spanEnd)中有效的部分添加到result，返回是否可以继续读取
+		nBool AppendValidSpan(String<encoding>& result, std::size_t spanEnd)
+		{
+			const auto begin = reinterpret_cast<const CharType*>(m_Buffer.data() + m_CurrentPos);
+			const auto end = reinterpret_cast<const CharType*>(m_Buffer.data() + spanEnd);
+			EncodingResult validateResult;
+			const CharType* validEnd;
+			std::tie(validateResult, validEnd) = detail_::ValidateUtf8(begin, end);
+			result.Append(StringView<encoding>{ begin, validEnd });
+			m_CurrentPos += static_cast<std::size_t>(validEnd - begin);
+
+			// 不完整的字符仅可能出现在缓冲区的结尾，此时需要读取后续数据
+			return validateResult == EncodingResult::Accept || (validateResult == EncodingResult::Incomplete && spanEnd == m_EndPos && FillBuffer());
+		}
+
+		String<encoding> BulkReadUntil(std::initializer_list<nuInt> terminatorChars)
+		{
+			String<encoding> result;
+
+			while (m_CurrentPos != m_EndPos || FillBuffer())
+			{
+				const auto begin = m_Buffer.data() + m_CurrentPos, end = m_Buffer.data() + m_EndPos;
+				auto terminator = end;
+				if (terminatorChars.size() == 1)
+				{
+					if (const auto found = std::memchr(begin, static_cast<int>(*terminatorChars.begin()), end - begin))
+					{
+						terminator = static_cast<nData>(found);
+					}
+				}
+				else if (terminatorChars.size() > 1)
+				{
+					terminator = std::find_if(begin, end, [&terminatorChars](nByte byte)
+					{
+						return std::find(terminatorChars.begin(), terminatorChars.end(), byte) != terminatorChars.end();
+					});
+				}
+
+				const auto spanEnd = static_cast<std::size_t>(terminator - m_Buffer.data());
+				if (!AppendValidSpan(result, spanEnd))
+				{
+					break;
+				}
+
+				if (terminator != end)
+				{
+					++m_CurrentPos;
+					break;
+				}
+			}
+
+			return result;
+		}
+
+		String<encoding> BulkReadLine()
+		{
+			const auto& newLine = this->m_NewLine;
+			String<encoding> result;
+			std::size_t matchedLength = 0;
+
+			while (m_CurrentPos != m_EndPos || FillBuffer())
+			{
+				if (matchedLength)
+				{
+					if (m_Buffer[m_CurrentPos] == newLine[matchedLength])
+					{
+						++m_CurrentPos;
+						if (++matchedLength == newLine.size())
+						{
+							return result;
+						}
+						continue;
+					}
+
+					// 部分匹配失败，已匹配的部分属于本行的内容
+					for (std::size_t i = 0; i < matchedLength; ++i)
+					{
+						result.Append(static_cast<CharType>(newLine[i]));
+					}
+					matchedLength = 0;
+				}
+
+				const auto begin = m_Buffer.data() + m_CurrentPos, end = m_Buffer.data() + m_EndPos;
+				const auto found = std::memchr(begin, static_cast<int>(newLine.front()), end - begin);
+				const auto spanEnd = found ? static_cast<std::size_t>(static_cast<nData>(found) - m_Buffer.data()) : m_EndPos;
+				if (!AppendValidSpan(result, spanEnd))
+				{
+					return result;
+				}
+
+				if (found)
+				{
+					++m_CurrentPos;
+					if (++matchedLength == newLine.size())
+					{
+						return result;
+					}
+				}
+			}
+
+			for (std::size_t i = 0; i < matchedLength; ++i)
+			{
+				result.Append(static_cast<CharType>(newLine[i]));
+			}
+
+			return result;
+		}
 	};
 
+	////////////////////////////////////////////////////////////////////////////////
+	///	@brief	流写入器
+	///	@note	默认不进行缓冲，每次写入都直接写入内部流\n
+	///			指定缓冲区大小后写入的内容会先收集到内部缓冲区中，缓冲区满、调用Flush或析构时才写入内部流
+	////////////////////////////////////////////////////////////////////////////////
 	template <StringType encoding>
 	class natStreamWriter final
 		: public natRefObjImpl<natStreamWriter<encoding>, TextWriter<encoding>>
 	{
 	public:
-		explicit natStreamWriter(natRefPointer<natStream> pStream) noexcept
-			: m_InternalStream(std::move(pStream))
+		typedef typename StringEncodingTrait<encoding>::CharType CharType;
+
+		enum
 		{
+			DefaultBufferSize = 65536,
+		};
+
+		explicit natStreamWriter(natRefPointer<natStream> pStream, std::size_t bufferSize = 0)
+			: m_InternalStream(std::move(pStream)), m_BufferSize{ bufferSize }
+		{
+			m_Buffer.reserve(m_BufferSize);
+			UpdateNewLine();
 		}
 
+		///	@brief	将缓冲区中的内容写入内部流
+		///	@note	此时发生的异常将被忽略，需要得知写入是否成功时请在析构前调用Flush
 		~natStreamWriter()
 		{
+			try
+			{
+				FlushBuffer();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		void SetNewLine(StringView<encoding> const& newLine) override
+		{
+			TextWriter<encoding>::SetNewLine(newLine);
+			UpdateNewLine();
 		}
 
 		nBool Write(nuInt Char) override
 		{
-			String<encoding> tmpStr;
-			if (detail_::EncodingCodePoint<encoding>::Encode(tmpStr, Char) == EncodingResult::Accept)
+			m_EncodeBuffer.Clear();
+			if (detail_::EncodingCodePoint<encoding>::Encode(m_EncodeBuffer, Char) == EncodingResult::Accept)
 			{
-				return Write(tmpStr) == tmpStr.GetView().GetCharCount();
+				WriteToBuffer(reinterpret_cast<ncData>(m_EncodeBuffer.data()), m_EncodeBuffer.size() * sizeof(CharType));
+				return true;
 			}
 			return false;
 		}
 
 		std::size_t Write(StringView<encoding> const& str) override
 		{
-			typedef typename StringEncodingTrait<encoding>::CharType CharType;
-			m_InternalStream->WriteBytes(reinterpret_cast<ncData>(str.cbegin()), str.size() * sizeof(CharType));
+			WriteToBuffer(reinterpret_cast<ncData>(str.cbegin()), str.size() * sizeof(CharType));
 			return str.GetCharCount();
 		}
 
+		///	@brief	写入其他编码的字符串
+		///	@note	编码相同时直接复制，否则整体转换后写入
+		template <StringType otherEncoding>
+		std::size_t Write(StringView<otherEncoding> const& str)
+		{
+			if constexpr (otherEncoding == encoding)
+			{
+				return Write(str);
+			}
+			else
+			{
+				return Write(String<encoding>{ str }.GetView());
+			}
+		}
+
+		std::size_t WriteLine(StringView<encoding> const& str) override
+		{
+			const auto size = Write(str);
+			return size + WriteLine();
+		}
+
+		std::size_t WriteLine() override
+		{
+			WriteToBuffer(reinterpret_cast<ncData>(m_EncodedNewLine.data()), m_EncodedNewLine.size() * sizeof(CharType));
+			return this->m_NewLine.size();
+		}
+
+		///	@brief	将缓冲区中的内容写入内部流并刷新内部流
+		void Flush()
+		{
+			FlushBuffer();
+			m_InternalStream->Flush();
+		}
+
 		nBool IsEndOfStream() const
 		{
 			return m_InternalStream->IsEndOfStream();
 		}
 
+		///	@note	直接操作内部流前请先调用Flush
 		natRefPointer<natStream> GetInternalStream() const noexcept
 		{
 			return m_InternalStream;
 		}
 
+		std::size_t GetBufferSize() const noexcept
+		{
+			return m_BufferSize;
+		}
+
 	private:
 		natRefPointer<natStream> m_InternalStream;
+		std::vector<nByte> m_Buffer;
+		std::size_t m_BufferSize;
+		String<encoding> m_EncodeBuffer;
+		String<encoding> m_EncodedNewLine;
+
+		void UpdateNewLine()
+		{
+			m_EncodedNewLine.Clear();
+			for (const auto codePoint : this->m_NewLine)
+			{
+				detail_::EncodingCodePoint<encoding>::Encode(m_EncodedNewLine, codePoint);
+			}
+		}
+
+		void WriteToBuffer(ncData data, std::size_t size)
+		{
+			if (m_Buffer.size() + size > m_BufferSize)
+			{
+				FlushBuffer();
+			}
+
+			// 放不进缓冲区的数据直接写入
+			if (size > m_BufferSize)
+			{
+				m_InternalStream->WriteBytes(data, size);
+				return;
+			}
+
+			m_Buffer.insert(m_Buffer.end(), data, data + size);
+		}
+
+		void FlushBuffer()
+		{
+			if (!m_Buffer.empty())
+			{
+				m_InternalStream->WriteBytes(m_Buffer.data(), m_Buffer.size());
+				m_Buffer.clear();
+			}
+		}
 	};
 }
 
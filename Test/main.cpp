@@ -8,19 +8,26 @@
 #include <natMultiThread.h>
 #include <natLinq.h>
 #include <natStackWalker.h>
+#include <natStopWatch.h>
 #include <natString.h>
 #include <natStream.h>
 #include <natStreamHelper.h>
 #include <natVFS.h>
 #include <natLocalFileScheme.h>
 #include <natCompression.h>
+#include <natCrc.h>
 #include <natCompressionStream.h>
+#include <natLz4Stream.h>
+#include <natAsyncStream.h>
+#include <natNamedPipe.h>
+#include <natSharedMemoryStream.h>
 #include <natRelationalOperator.h>
 #include <natProperty.h>
 #include <natContainer.h>
 #include <natInfixOperator.h>
 #include <natConcurrent.h>
 #include <forward_list>
+#include <random>
 
 using namespace NatsuLib;
 
@@ -301,6 +308,85 @@ int main()
 			}
 		}
 
+		{
+			const auto chunkedStream = make_ref<natChunkedMemoryStream>(true, true, 4);
+			chunkedStream->WriteBytes(reinterpret_cast<ncData>("2333233323"), 10);
+			assert(chunkedStream->GetChunkCount() == 3);
+			chunkedStream->SetPosition(NatSeek::Beg, 3);
+			const auto memoryStream = make_ref<natMemoryStream>(0, true, true, true);
+			chunkedStream->CopyTo(memoryStream);
+			assert(memoryStream->GetSize() == 7 && memcmp(memoryStream->GetInternalBuffer(), "3233323", 7) == 0);
+
+			// 缩小后再扩大，新增的部分应为0
+			chunkedStream->SetSize(2);
+			chunkedStream->SetSize(9);
+			nByte data[9];
+			chunkedStream->SetPosition(NatSeek::Beg, 0);
+			assert(chunkedStream->ReadBytes(data, sizeof data) == 9 && memcmp(data, "23\0\0\0\0\0\0\0", 9) == 0);
+		}
+
+		{
+			const auto memoryStream = make_ref<natMemoryStream>(reinterpret_cast<ncData>("0123456789"), 10, true, false, false);
+			const auto prefetchStream = make_ref<natPrefetchStream>(memoryStream, 4, 2);
+			nByte data[10]{};
+			assert(prefetchStream->ReadBytes(data, 6) == 6 && memcmp(data, "012345", 6) == 0);
+			prefetchStream->SetPosition(NatSeek::Cur, -5);
+			assert(prefetchStream->ReadBytes(data, sizeof data) == 9 && memcmp(data, "123456789", 9) == 0);
+			assert(prefetchStream->IsEndOfStream());
+		}
+
+		{
+			const auto memoryStream = make_ref<natMemoryStream>(0, true, true, true);
+			const auto writeBehindStream = make_ref<natWriteBehindStream>(memoryStream, 4, 8);
+			writeBehindStream->WriteBytes(reinterpret_cast<ncData>("0123456789"), 10);
+			assert(writeBehindStream->GetPosition() == 10);
+			writeBehindStream->Flush();
+			assert(memoryStream->GetSize() == 10 && memcmp(memoryStream->GetInternalBuffer(), "0123456789", 10) == 0);
+		}
+
+		{
+			const auto memoryStream = make_ref<natInstrumentedStream>(make_ref<natMemoryStream>(0, true, true, true), "memory"_nv);
+			const auto crc32Stream = make_ref<natInstrumentedStream>(make_ref<natCrc32Stream>(memoryStream), "crc32"_nv);
+			for (nuInt i = 0; i < 4; ++i)
+			{
+				crc32Stream->WriteBytes(reinterpret_cast<ncData>("2333"), 4);
+			}
+			natInstrumentedStream::EnumStatistics(crc32Stream, [&logger](natInstrumentedStream& stream)
+			{
+				const auto statistics = stream.GetStatistics(natInstrumentedStream::Operation::Write);
+				assert(statistics.CallCount == 4 && statistics.TotalBytes == 16 && statistics.SizeHistogram[natInstrumentedStream::GetHistogramBucket(4)] == 4);
+				logger.LogMsg("{0}: {1} writes, {2} bytes, {3}ns"_nv, stream.GetName(), statistics.CallCount, statistics.TotalBytes, statistics.TotalTime.count());
+				return false;
+			});
+		}
+
+		{
+			const nChar text[] = u8"第一行\r\n第二行,逗号\r\n";
+			natStreamReader<StringType::Utf8> reader{
+				make_ref<natMemoryStream>(reinterpret_cast<ncData>(text), sizeof text - 1, true, false, false), 8
+			};
+			reader.SetNewLine("\r\n"_u8v);
+			assert(reader.ReadLine() == u8"第一行"_u8v);
+			assert(reader.ReadUntil({ ',' }) == u8"第二行"_u8v);
+			assert(reader.ReadToEnd() == u8"逗号\r\n"_u8v);
+		}
+
+		{
+			const auto memoryStream = make_ref<natMemoryStream>(0, true, true, true);
+			natStreamWriter<StringType::Utf8> writer{ memoryStream, natStreamWriter<StringType::Utf8>::DefaultBufferSize };
+			writer.SetNewLine("\n"_u8v);
+			writer.Write(U'中');
+			writer.WriteLine(u8"文"_u8v);
+			assert(memoryStream->GetSize() == 0);
+			writer.Flush();
+			assert(memoryStream->GetSize() == 7 && memcmp(memoryStream->GetInternalBuffer(), u8"中文\n", 7) == 0);
+
+			// 默认不进行缓冲
+			natStreamWriter<StringType::Utf8> unbufferedWriter{ memoryStream };
+			unbufferedWriter.Write(u8"字"_u8v);
+			assert(memoryStream->GetSize() == 10);
+		}
+
 		{
 			{
 				natZipArchive zip{
@@ -418,6 +504,714 @@ int main()
 			}
 		}
 
+		{
+			// 小块ReadPod/WritePod在加锁及不加锁的内存流上的性能对比
+			const auto benchmark = [](natRefPointer<natStream> const& stream)
+			{
+				constexpr nuInt count = 1000000;
+				natBinaryWriter writer{ stream };
+				natBinaryReader reader{ stream };
+				natStopWatch stopWatch;
+				for (nuInt i = 0; i < count; ++i)
+				{
+					writer.WritePod(i);
+				}
+				stream->SetPosition(NatSeek::Beg, 0);
+				nuLong sum{};
+				for (nuInt i = 0; i < count; ++i)
+				{
+					sum += reader.ReadPod<nuInt>();
+				}
+				assert(sum == static_cast<nuLong>(count) * (count - 1) / 2);
+				return stopWatch.GetElpased();
+			};
+
+			logger.LogMsg("natMemoryStream: {0}s, natUnsyncMemoryStream: {1}s"_nv,
+			              benchmark(make_ref<natMemoryStream>(0, true, true, true)),
+			              benchmark(make_ref<natUnsyncMemoryStream>(0, true, true, true)));
+		}
+
+		{
+			const auto stream = make_ref<natUnsyncMemoryStream>(0, true, true, true);
+			natBinaryWriter writer{ stream, Environment::Endianness::BigEndian };
+			natBinaryReader reader{ stream, Environment::Endianness::BigEndian };
+			writer.WritePod(nuShort{ 0x0102 });
+			const nuInt values[] = { 0x03040506, 0x0708090a };
+			writer.WritePodArray(values);
+			const nByte expected[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+			assert(stream->GetSize() == sizeof expected && memcmp(stream->GetInternalBuffer(), expected, sizeof expected) == 0);
+			stream->SetPosition(NatSeek::Beg, 0);
+			nuInt readValues[2];
+			assert(reader.ReadPod<nuShort>() == 0x0102);
+			reader.ReadPodArray(readValues);
+			assert(memcmp(readValues, values, sizeof values) == 0);
+
+			// 再次写入时复用翻转字节序用的缓冲区
+			const nuShort shortValues[] = { 0x0b0c, 0x0d0e, 0x0f10 };
+			writer.WritePodArray(shortValues);
+			const nByte expectedShorts[] = { 11, 12, 13, 14, 15, 16 };
+			assert(stream->GetSize() == sizeof expected + sizeof expectedShorts && memcmp(stream->GetInternalBuffer() + sizeof expected, expectedShorts, sizeof expectedShorts) == 0);
+		}
+
+		{
+			const nByte data[] = { 0, 3, 'a', 'b', 'c', 0, 0, 0, 1 };
+			natBinaryViewReader reader{ make_ref<natExternMemoryStream>(data, true), Environment::Endianness::BigEndian };
+			const auto length = reader.ReadPod<nuShort>();
+			const auto name = reader.ReadStringView<StringType::Utf8>(length);
+			assert(name == "abc"_u8v && reinterpret_cast<ncData>(name.cbegin()) == data + 2);
+			assert(reader.ReadPod<nuInt>() == 1 && reader.IsEnd());
+		}
+
+		{
+			// 本地命名管道的吞吐量及往返延迟
+			constexpr nuInt messageCount = 1000, roundTripCount = 10000;
+			constexpr nLen messageSize = 65536;
+			const auto pipeName = R"(\\.\pipe\NatsuLibBenchmark)"_nv;
+			natNamedPipeServerStream server{ pipeName, PipeDirection::Inout, 1 };
+			auto connection = server.WaitForConnectionAsync();
+			natNamedPipeClientStream client{ pipeName, true, true };
+			client.Wait();
+			connection.get();
+
+			std::thread echo{ [&server]
+			{
+				std::vector<nByte> buffer(messageSize);
+				for (nuInt i = 0; i < messageCount; ++i)
+				{
+					nLen readBytes{};
+					while (readBytes < messageSize)
+					{
+						readBytes += server.ReadBytes(buffer.data() + readBytes, messageSize - readBytes);
+					}
+				}
+
+				// 通知已接收全部数据
+				nByte byte{};
+				server.WriteBytes(&byte, 1);
+				for (nuInt i = 0; i < roundTripCount; ++i)
+				{
+					server.ReadBytes(&byte, 1);
+					server.WriteBytes(&byte, 1);
+				}
+			} };
+
+			const std::vector<nByte> message(messageSize);
+			natStopWatch stopWatch;
+			for (nuInt i = 0; i < messageCount; ++i)
+			{
+				client.WriteBytes(message.data(), messageSize);
+			}
+			nByte byte;
+			client.ReadBytes(&byte, 1);
+			const auto throughputTime = stopWatch.GetElpased();
+
+			stopWatch.Reset();
+			for (nuInt i = 0; i < roundTripCount; ++i)
+			{
+				client.WriteBytes(&byte, 1);
+				client.ReadBytes(&byte, 1);
+			}
+			const auto latencyTime = stopWatch.GetElpased();
+			echo.join();
+
+			logger.LogMsg("Named pipe: {0} MiB/s, {1} us per round trip"_nv,
+			              messageCount * messageSize / 1048576.0 / throughputTime, latencyTime * 1000000 / roundTripCount);
+		}
+
+#ifndef _WIN32
+		{
+			constexpr nLen dataSize = 256 * 1024 * 1024;
+			natSharedMemoryStream reader{ "NatsuLibBenchmark"_nv, PipeDirection::In, true };
+			nBool duplicatedThrown = false;
+			try
+			{
+				natSharedMemoryStream duplicated{ "NatsuLibBenchmark"_nv, PipeDirection::Out, true };
+			}
+			catch (natErrException& e)
+			{
+				duplicatedThrown = e.GetErrNo() == NatErr_Duplicated;
+			}
+			assert(duplicatedThrown);
+			std::thread writerThread{ []
+			{
+				natSharedMemoryStream writer{ "NatsuLibBenchmark"_nv, PipeDirection::Out, false };
+				nLen writtenBytes{};
+				while (writtenBytes < dataSize)
+				{
+					// 直接在共享内存中生成数据
+					const auto span = writer.AcquireWrite();
+					const auto size = std::min(span.Size, dataSize - writtenBytes);
+					std::memset(span.Data, 0x23, static_cast<size_t>(size));
+					writer.CommitWrite(size);
+					writtenBytes += size;
+				}
+			} };
+
+			natStopWatch stopWatch;
+			std::vector<nByte> buffer(65536);
+			nLen readBytes{}, currentReadBytes;
+			while ((currentReadBytes = reader.ReadBytes(buffer.data(), buffer.size())) > 0)
+			{
+				readBytes += currentReadBytes;
+			}
+			writerThread.join();
+			assert(readBytes == dataSize && reader.IsEndOfStream());
+			logger.LogMsg("Shared memory: {0} MiB/s"_nv, dataSize / 1048576.0 / stopWatch.GetElpased());
+		}
+#endif
+
+		{
+			// 单线程输出大量内容时可启用标准输出的缓冲区并关闭加锁
+			auto& stdOut = console.GetStdOut();
+			stdOut.SetBufferMode(natStdStream::FlushPolicy::Size, natStdStream::DefaultBufferSize, std::chrono::milliseconds{ 100 }, false);
+			assert(stdOut.GetFlushPolicy() == natStdStream::FlushPolicy::Size && stdOut.GetBufferSize() == natStdStream::DefaultBufferSize);
+			console.WriteLine("Buffered console output"_nv);
+			console.Flush();
+			stdOut.SetBufferMode(natStdStream::FlushPolicy::Unbuffered);
+		}
+
+		{
+			// 同时保存原始数据、计算Crc32并在线程池中压缩
+			const auto plainStream = make_ref<natMemoryStream>(0, true, true, true);
+			const auto crc32Stream = make_ref<natCrc32Stream>(make_ref<natMemoryStream>(0, true, true, true));
+			const auto compressedStream = make_ref<natMemoryStream>(0, true, true, true);
+			const auto deflateStream = make_ref<natDeflateStream>(compressedStream, natDeflateStream::CompressionLevel::Fastest);
+			const auto teeStream = make_ref<natTeeStream>();
+			teeStream->AddSink(plainStream);
+			teeStream->AddSink(crc32Stream);
+			teeStream->AddSink(deflateStream, true);
+			for (nuInt i = 0; i < 1024; ++i)
+			{
+				teeStream->WriteBytes(reinterpret_cast<ncData>("NatsuLib"), 8);
+			}
+			teeStream->Flush();
+			deflateStream->Finish();
+			assert(teeStream->GetPosition() == 8192 && plainStream->GetSize() == 8192);
+
+			const auto verifyCrc32Stream = make_ref<natCrc32Stream>(make_ref<natMemoryStream>(0, true, true, true));
+			verifyCrc32Stream->WriteBytes(plainStream->GetInternalBuffer(), plainStream->GetSize());
+			assert(crc32Stream->GetCrc32() == verifyCrc32Stream->GetCrc32());
+
+			compressedStream->SetPosition(NatSeek::Beg, 0);
+			std::vector<nByte> decompressed(8192);
+			assert(make_ref<natDeflateStream>(compressedStream)->ReadBytes(decompressed.data(), decompressed.size()) == decompressed.size());
+			assert(memcmp(decompressed.data(), plainStream->GetInternalBuffer(), decompressed.size()) == 0);
+
+			// 输出流无法写入全部数据时按照处理策略移除
+			nByte limitedBuffer[12];
+			const auto limitedStream = make_ref<natExternMemoryStream>(limitedBuffer, sizeof limitedBuffer, true, true);
+			const auto detachingTeeStream = make_ref<natTeeStream>(natTeeStream::ErrorPolicy::DetachFailed);
+			detachingTeeStream->AddSink(limitedStream);
+			detachingTeeStream->AddSink(plainStream);
+			detachingTeeStream->WriteBytes(reinterpret_cast<ncData>("NatsuLib"), 8);
+			assert(detachingTeeStream->GetDetachedSinks().empty());
+			detachingTeeStream->WriteBytes(reinterpret_cast<ncData>("NatsuLib"), 8);
+			assert(detachingTeeStream->GetDetachedSinks().size() == 1 && detachingTeeStream->GetDetachedSinks()[0].Sink == limitedStream);
+			assert(plainStream->GetSize() == 8208 && memcmp(limitedBuffer, "NatsuLibNats", sizeof limitedBuffer) == 0);
+		}
+
+		{
+			constexpr nLen dataSize = 32 * 1024 * 1024;
+			std::vector<nByte> data(dataSize);
+			nuInt seed = 1;
+			for (auto& byte : data)
+			{
+				// 生成有一定重复的文本数据
+				seed = seed * 1103515245 + 12345;
+				byte = static_cast<nByte>('a' + (seed >> 16) % 16);
+			}
+
+			const auto serialOutput = make_ref<natMemoryStream>(0, true, true, true);
+			natStopWatch stopWatch;
+			{
+				const auto deflateStream = make_ref<natDeflateStream>(serialOutput, natDeflateStream::CompressionLevel::Fastest);
+				deflateStream->WriteBytes(data.data(), dataSize);
+				deflateStream->Finish();
+			}
+			const auto serialTime = stopWatch.GetElpased();
+
+			const auto parallelOutput = make_ref<natMemoryStream>(0, true, true, true);
+			stopWatch.Reset();
+			const auto parallelDeflateStream = make_ref<natParallelDeflateStream>(parallelOutput, natDeflateStream::CompressionLevel::Fastest);
+			parallelDeflateStream->WriteBytes(data.data(), dataSize);
+			parallelDeflateStream->Finish();
+			const auto parallelTime = stopWatch.GetElpased();
+
+			parallelOutput->SetPosition(NatSeek::Beg, 0);
+			std::vector<nByte> decompressed(dataSize);
+			assert(make_ref<natDeflateStream>(parallelOutput)->ReadBytes(decompressed.data(), dataSize) == dataSize && decompressed == data);
+
+			const auto crc32Stream = make_ref<natCrc32Stream>(make_ref<natMemoryStream>(0, true, true, true));
+			crc32Stream->WriteBytes(data.data(), dataSize);
+			assert(parallelDeflateStream->GetCrc32() == crc32Stream->GetCrc32());
+
+			logger.LogMsg("Deflate: {0} MiB/s ({1} bytes), parallel deflate: {2} MiB/s ({3} bytes)"_nv,
+			              dataSize / 1048576.0 / serialTime, serialOutput->GetSize(), dataSize / 1048576.0 / parallelTime, parallelOutput->GetSize());
+		}
+
+		{
+			constexpr nLen dataSize = 32 * 1024 * 1024;
+			std::vector<nByte> data(dataSize);
+			nuInt seed = 1;
+			for (auto& byte : data)
+			{
+				seed = seed * 1103515245 + 12345;
+				byte = static_cast<nByte>('a' + (seed >> 16) % 16);
+			}
+
+			natThreadPool threadPool{ 2, 4 };
+			for (const auto compressionLevel : { natLz4Stream::CompressionLevel::Fast, natLz4Stream::CompressionLevel::HighCompression })
+			{
+				const auto output = make_ref<natMemoryStream>(0, true, true, true);
+				natStopWatch stopWatch;
+				{
+					const auto lz4Stream = make_ref<natLz4Stream>(output, compressionLevel, true, natLz4Stream::BlockSize::Max256KB);
+					lz4Stream->WriteBytes(data.data(), dataSize);
+					lz4Stream->Finish();
+				}
+				const auto compressTime = stopWatch.GetElpased();
+
+				std::vector<nByte> decompressed(dataSize);
+				output->SetPosition(NatSeek::Beg, 0);
+				stopWatch.Reset();
+				assert(make_ref<natLz4Stream>(output)->ReadBytes(decompressed.data(), dataSize) == dataSize && decompressed == data);
+				const auto decompressTime = stopWatch.GetElpased();
+
+				// 各块相互独立，可以在线程池中并行解压
+				std::fill(decompressed.begin(), decompressed.end(), nByte{});
+				output->SetPosition(NatSeek::Beg, 0);
+				stopWatch.Reset();
+				assert(make_ref<natLz4Stream>(output, threadPool)->ReadBytes(decompressed.data(), dataSize) == dataSize && decompressed == data);
+				const auto parallelDecompressTime = stopWatch.GetElpased();
+
+				logger.LogMsg("LZ4 ({0}): compress {1} MiB/s ({2} bytes), decompress {3} MiB/s, parallel decompress {4} MiB/s"_nv,
+				              compressionLevel == natLz4Stream::CompressionLevel::Fast ? "fast"_nv : "high compression"_nv, dataSize / 1048576.0 / compressTime, output->GetSize(),
+				              dataSize / 1048576.0 / decompressTime, dataSize / 1048576.0 / parallelDecompressTime);
+			}
+		}
+
+		{
+			constexpr char checkString[] = "123456789";
+			assert(natCrc::Update(natCrc::Polynomial::Crc32, 0, reinterpret_cast<ncData>(checkString), 9) == 0xCBF43926);
+			assert(natCrc::Update(natCrc::Polynomial::Crc32C, 0, reinterpret_cast<ncData>(checkString), 9) == 0xE3069283);
+
+			constexpr nLen dataSize = 64 * 1024 * 1024;
+			std::vector<nByte> data(dataSize);
+			nuInt seed = 1;
+			for (auto& byte : data)
+			{
+				seed = seed * 1103515245 + 12345;
+				byte = static_cast<nByte>(seed >> 16);
+			}
+
+			natThreadPool threadPool{ 2, 4 };
+			for (const auto polynomial : { natCrc::Polynomial::Crc32, natCrc::Polynomial::Crc32C })
+			{
+				natStopWatch stopWatch;
+				const auto crc = natCrc::Update(polynomial, 0, data.data(), dataSize);
+				const auto serialTime = stopWatch.GetElpased();
+
+				stopWatch.Reset();
+				assert(natCrc::ParallelUpdate(threadPool, polynomial, 0, data.data(), dataSize) == crc);
+				const auto parallelTime = stopWatch.GetElpased();
+
+				const auto half = dataSize / 2;
+				assert(natCrc::Combine(polynomial, natCrc::Update(polynomial, 0, data.data(), half), natCrc::Update(polynomial, 0, data.data() + half, dataSize - half), dataSize - half) == crc);
+
+				const auto crc32Stream = make_ref<natCrc32Stream>(make_ref<natMemoryStream>(0, true, true, true), polynomial);
+				crc32Stream->WriteBytes(data.data(), dataSize);
+				assert(crc32Stream->GetCrc32() == crc);
+
+				logger.LogMsg("CRC ({0}): {1} MiB/s, parallel {2} MiB/s"_nv, natCrc::GetImplementationName(polynomial), dataSize / 1048576.0 / serialTime, dataSize / 1048576.0 / parallelTime);
+			}
+		}
+
+		{
+			// 小段JSON共用预设字典
+			constexpr char dictionary[] = R"({"id":0,"name":"","email":"@example.com","active":true,"roles":["admin","user"]})";
+			natDeflateStream::CompressOptions compressOptions;
+			compressOptions.WindowBits = 10;
+			compressOptions.MemLevel = 2;
+			compressOptions.BufferSize = 256;
+			natDeflateStream::DecompressOptions decompressOptions;
+			decompressOptions.WindowBits = compressOptions.WindowBits;
+			decompressOptions.BufferSize = compressOptions.BufferSize;
+
+			for (const auto useDictionary : { false, true })
+			{
+				compressOptions.Dictionary = decompressOptions.Dictionary = useDictionary ? reinterpret_cast<ncData>(dictionary) : nullptr;
+				compressOptions.DictionaryLength = decompressOptions.DictionaryLength = useDictionary ? sizeof dictionary - 1 : 0;
+
+				nLen totalSize = 0, totalCompressedSize = 0;
+				natStopWatch stopWatch;
+				for (nuInt i = 0; i < 1000; ++i)
+				{
+					const auto id = std::to_string(i);
+					const auto message = R"({"id":)" + id + R"(,"name":"user)" + id + R"(","email":"user)" + id + R"(@example.com","active":)" + (i % 2 ? "true" : "false") + R"(,"roles":["user"]})";
+					const auto compressed = make_ref<natMemoryStream>(0, true, true, true);
+					{
+						const auto deflateStream = make_ref<natDeflateStream>(compressed, compressOptions, true);
+						deflateStream->WriteBytes(reinterpret_cast<ncData>(message.data()), message.size());
+						deflateStream->Finish();
+					}
+
+					std::vector<nByte> decompressed(message.size());
+					compressed->SetPosition(NatSeek::Beg, 0);
+					assert(make_ref<natDeflateStream>(compressed, decompressOptions, true)->ReadBytes(decompressed.data(), decompressed.size()) == message.size());
+					assert(memcmp(decompressed.data(), message.data(), message.size()) == 0);
+
+					totalSize += message.size();
+					totalCompressedSize += compressed->GetSize();
+				}
+
+				logger.LogMsg("Deflate small messages ({0}): {1} -> {2} bytes, {3} us per message"_nv,
+				              useDictionary ? "with dictionary"_nv : "without dictionary"_nv, totalSize, totalCompressedSize, stopWatch.GetElpased() * 1000);
+			}
+		}
+
+		{
+			// 通过检查点索引随机访问压缩的日志
+			std::string log;
+			for (nuInt i = 0; log.size() < 16 * 1024 * 1024; ++i)
+			{
+				log += "[info] request " + std::to_string(i * 2654435761u % 1000003) + " handled in " + std::to_string(i % 500) + " ms\n";
+			}
+
+			const auto compressed = make_ref<natMemoryStream>(0, true, true, true);
+			{
+				const auto deflateStream = make_ref<natDeflateStream>(compressed, natDeflateStream::CompressionLevel::Optimal, true);
+				deflateStream->WriteBytes(reinterpret_cast<ncData>(log.data()), log.size());
+				deflateStream->Finish();
+			}
+
+			const auto index = make_ref<natDeflateIndex>(256 * 1024);
+			compressed->SetPosition(NatSeek::Beg, 0);
+			auto deflateStream = make_ref<natDeflateStream>(compressed, index, true);
+			assert(deflateStream->GetSize() == log.size() && index->IsComplete());
+
+			// 索引可以保存后供之后打开的流使用
+			const auto indexStream = make_ref<natMemoryStream>(0, true, true, true);
+			index->Save(indexStream);
+			indexStream->SetPosition(NatSeek::Beg, 0);
+			compressed->SetPosition(NatSeek::Beg, 0);
+			deflateStream = make_ref<natDeflateStream>(compressed, natDeflateIndex::Load(indexStream), true);
+
+			std::mt19937 random{ 42 };
+			nByte buffer[4096];
+			natStopWatch stopWatch;
+			for (nuInt i = 0; i < 100; ++i)
+			{
+				const auto position = random() % (log.size() - sizeof buffer);
+				deflateStream->SetPosition(NatSeek::Beg, position);
+				assert(deflateStream->ReadBytes(buffer, sizeof buffer) == sizeof buffer);
+				assert(memcmp(buffer, log.data() + position, sizeof buffer) == 0);
+			}
+
+			logger.LogMsg("Deflate index: {0} access points, {1} bytes saved, {2} ms per random read"_nv,
+			              index->GetAccessPoints().size(), indexStream->GetSize(), stopWatch.GetElpased() * 10);
+
+			// 压缩数据位于内部流末尾的原始deflate流及最后一次解压没有输出的情况
+			for (const auto useHeader : { false, true })
+			{
+				natDeflateStream::CompressOptions compressOptions;
+				compressOptions.Level = natDeflateStream::MinLevel;
+				const auto storedStream = make_ref<natMemoryStream>(0, true, true, true);
+				{
+					const auto storingStream = make_ref<natDeflateStream>(storedStream, compressOptions, useHeader);
+					storingStream->WriteBytes(reinterpret_cast<ncData>(log.data()), 60328);
+					storingStream->Finish();
+				}
+
+				storedStream->SetPosition(NatSeek::Beg, 0);
+				const auto storedIndex = make_ref<natDeflateIndex>(4096);
+				const auto seekableStream = make_ref<natDeflateStream>(storedStream, storedIndex, useHeader);
+				assert(seekableStream->ReadBytes(buffer, sizeof buffer) == sizeof buffer);
+				assert(seekableStream->GetSize() == 60328 && seekableStream->GetPosition() == sizeof buffer);
+				seekableStream->SetPosition(NatSeek::End, -1);
+				assert(seekableStream->ReadBytes(buffer, sizeof buffer) == 1 && buffer[0] == log[60327]);
+				assert(seekableStream->IsEndOfStream());
+			}
+
+			// Flush后再Finish的流在数据末尾有块边界，保存的索引仍应可以加载
+			for (const auto useHeader : { false, true })
+			{
+				const auto flushedStream = make_ref<natMemoryStream>(0, true, true, true);
+				{
+					const auto flushingStream = make_ref<natDeflateStream>(flushedStream, natDeflateStream::CompressionLevel::Optimal, useHeader);
+					flushingStream->WriteBytes(reinterpret_cast<ncData>(log.data()), 100000);
+					flushingStream->Flush();
+					flushingStream->Finish();
+				}
+
+				flushedStream->SetPosition(NatSeek::Beg, 0);
+				const auto flushedIndex = make_ref<natDeflateIndex>(4096);
+				assert(make_ref<natDeflateStream>(flushedStream, flushedIndex, useHeader)->GetSize() == 100000 && flushedIndex->IsComplete());
+
+				const auto flushedIndexStream = make_ref<natMemoryStream>(0, true, true, true);
+				flushedIndex->Save(flushedIndexStream);
+				flushedIndexStream->SetPosition(NatSeek::Beg, 0);
+				flushedStream->SetPosition(NatSeek::Beg, 0);
+				const auto loadedStream = make_ref<natDeflateStream>(flushedStream, natDeflateIndex::Load(flushedIndexStream), useHeader);
+				assert(loadedStream->GetSize() == 100000);
+				loadedStream->SetPosition(NatSeek::Beg, 99000);
+				assert(loadedStream->ReadBytes(buffer, sizeof buffer) == 1000 && memcmp(buffer, log.data() + 99000, 1000) == 0);
+				assert(loadedStream->IsEndOfStream());
+			}
+		}
+
+		{
+			// 更新模式下被修改的入口会在写入时并行压缩
+			const auto zipStream = make_ref<natMemoryStream>(0, true, true, true);
+			{
+				natZipArchive zip{ zipStream, natZipArchive::ZipArchiveMode::Create };
+			}
+			zipStream->SetPosition(NatSeek::Beg, 0);
+			{
+				natZipArchive zip{ zipStream, natZipArchive::ZipArchiveMode::Update };
+				for (nuInt i = 0; i < 64; ++i)
+				{
+					const auto content = natUtil::FormatString("Entry {0}"_nv, i);
+					zip.CreateEntry(natUtil::FormatString("parallel/{0}.txt"_nv, i))->Open()->WriteBytes(reinterpret_cast<ncData>(content.data()), content.size());
+				}
+			}
+			zipStream->SetPosition(NatSeek::Beg, 0);
+			{
+				natZipArchive zip{ zipStream, natZipArchive::ZipArchiveMode::Read };
+				const auto entry = zip.GetEntry("parallel/42.txt"_nv);
+				nByte buffer[16]{};
+				assert(entry && entry->Open()->ReadBytes(buffer, sizeof buffer) == 8 && memcmp(buffer, "Entry 42", 8) == 0);
+			}
+		}
+
+		{
+			constexpr nuInt entryCount = 10000;
+			constexpr nLen entrySize = 4096;
+			{
+#ifdef _WIN32
+				auto fileStream = make_ref<natFileStream>("3.zip"_nv, true, true);
+				fileStream->SetSize(0);
+#else
+				auto fileStream = make_ref<natFileStream>("3.zip"_nv, true, true, true);
+#endif
+				natZipArchive zip{ fileStream, natZipArchive::ZipArchiveMode::Create };
+				std::vector<nByte> content(entrySize);
+				for (nuInt i = 0; i < entryCount; ++i)
+				{
+					nuInt seed = i + 1;
+					for (auto& byte : content)
+					{
+						seed = seed * 1103515245 + 12345;
+						byte = static_cast<nByte>('a' + (seed >> 16) % 16);
+					}
+					zip.CreateEntry(natUtil::FormatString("bulk/{0}.txt"_nv, i))->Open()->WriteBytes(content.data(), content.size());
+				}
+			}
+
+			natZipArchive zip{ make_ref<natFileStream>("3.zip"_nv, true, false), natZipArchive::ZipArchiveMode::Read };
+
+			natStopWatch stopWatch;
+			nLen serialBytes = 0;
+			for (auto&& entry : zip.GetEntries())
+			{
+				const auto sink = make_ref<natMemoryStream>(0, false, true, true);
+				serialBytes += entry->Open()->CopyTo(sink);
+			}
+			const auto serialTime = stopWatch.GetElpased();
+
+			std::vector<natRefPointer<natMemoryStream>> sinks;
+			stopWatch.Reset();
+			const auto extractedCount = zip.ExtractAll([&sinks](natZipArchive::ZipEntry const&) -> natRefPointer<natStream>
+			{
+				sinks.emplace_back(make_ref<natMemoryStream>(0, false, true, true));
+				return sinks.back();
+			});
+			const auto parallelTime = stopWatch.GetElpased();
+
+			nLen parallelBytes = 0;
+			for (auto&& sink : sinks)
+			{
+				parallelBytes += sink->GetSize();
+			}
+			assert(extractedCount == entryCount && serialBytes == entryCount * entrySize && parallelBytes == serialBytes);
+
+			nLen selectedBytes = 0;
+			zip.ExtractTo([](natZipArchive::ZipEntry const& entry)
+			{
+				return entry.GetEntryName() == "bulk/42.txt"_nv;
+			}, [&selectedBytes](natZipArchive::ZipEntry const& entry) -> natRefPointer<natStream>
+			{
+				selectedBytes += entry.GetUncompressedSize();
+				return make_ref<natMemoryStream>(0, false, true, true);
+			});
+			assert(selectedBytes == entrySize);
+
+			logger.LogMsg("Extract {0} entries: one by one {1} s, ExtractAll {2} s"_nv, entryCount, serialTime, parallelTime);
+		}
+
+		{
+			natStopWatch stopWatch;
+			natZipArchive zip{ make_ref<natFileStream>("3.zip"_nv, true, false), natZipArchive::ZipArchiveMode::Read };
+			const auto openTime = stopWatch.GetElpased();
+
+			stopWatch.Reset();
+			natZipArchive indexedZip{ make_ref<natFileStream>("3.zip"_nv, true, false), natZipArchive::ZipArchiveMode::Read, true };
+			const auto indexedOpenTime = stopWatch.GetElpased();
+
+			assert(indexedZip.GetEntryCount() == zip.GetEntryCount());
+			const auto entry = indexedZip.GetEntry("bulk/42.txt"_nv);
+			assert(entry && entry->GetUncompressedSize() == zip.GetEntry("bulk/42.txt"_nv)->GetUncompressedSize());
+			assert(!indexedZip.GetEntry("bulk/42"_nv));
+			// bulk/42.txt、bulk/420.txt至bulk/429.txt及bulk/4200.txt至bulk/4299.txt
+			assert(indexedZip.GetEntriesWithPrefix("bulk/42"_nv).count() == 111 && zip.GetEntriesWithPrefix("bulk/42"_nv).count() == 111);
+
+			logger.LogMsg("Open archive with {0} entries: {1} s, with compact index: {2} s"_nv, zip.GetEntryCount(), openTime, indexedOpenTime);
+		}
+
+		{
+			natStopWatch stopWatch;
+			{
+				natZipArchive zip{ make_ref<natFileStream>("3.zip"_nv, true, true), natZipArchive::ZipArchiveMode::Update };
+				zip.SetUpdateStrategy(natZipArchive::UpdateStrategy::Append);
+				zip.CreateEntry("appended.txt"_nv)->Open()->WriteBytes(reinterpret_cast<ncData>("Appended"), 8);
+			}
+			const auto appendTime = stopWatch.GetElpased();
+
+			stopWatch.Reset();
+			{
+				natZipArchive zip{ make_ref<natFileStream>("3.zip"_nv, true, true), natZipArchive::ZipArchiveMode::Update };
+				zip.CreateEntry("rewritten.txt"_nv)->Open()->WriteBytes(reinterpret_cast<ncData>("Rewritten"), 9);
+			}
+			const auto rewriteTime = stopWatch.GetElpased();
+
+			natZipArchive zip{ make_ref<natFileStream>("3.zip"_nv, true, false), natZipArchive::ZipArchiveMode::Read };
+			nByte buffer[16]{};
+			assert(zip.GetEntry("appended.txt"_nv)->Open()->ReadBytes(buffer, sizeof buffer) == 8 && memcmp(buffer, "Appended", 8) == 0);
+			assert(zip.GetEntry("rewritten.txt"_nv)->Open()->ReadBytes(buffer, sizeof buffer) == 9 && memcmp(buffer, "Rewritten", 9) == 0);
+
+			logger.LogMsg("Add an entry to archive with {0} entries: append {1} s, rewrite {2} s"_nv, zip.GetEntryCount() - 2, appendTime, rewriteTime);
+		}
+
+		{
+			// natTeeStream不支持定位，压缩文件将使用数据描述符写入
+			const auto archiveStream = make_ref<natMemoryStream>(0, true, true, true);
+			{
+				const auto teeStream = make_ref<natTeeStream>();
+				teeStream->AddSink(archiveStream);
+				assert(!teeStream->CanSeek());
+
+				natZipArchive zip{ teeStream, natZipArchive::ZipArchiveMode::Create };
+				zip.CreateEntry("streamed.txt"_nv)->Open()->WriteBytes(reinterpret_cast<ncData>("Streamed"), 8);
+				const auto encryptedEntry = zip.CreateEntry("encrypted.txt"_nv);
+				encryptedEntry->SetPassword("NatsuLib"_nv);
+				encryptedEntry->Open()->WriteBytes(reinterpret_cast<ncData>("Encrypted"), 9);
+				zip.CreateEntry("empty.txt"_nv)->Open();
+			}
+
+			archiveStream->SetPosition(NatSeek::Beg, 0);
+			natZipArchive zip{ archiveStream, natZipArchive::ZipArchiveMode::Read };
+			nByte buffer[16]{};
+			assert(zip.GetEntry("streamed.txt"_nv)->Open()->ReadBytes(buffer, sizeof buffer) == 8 && memcmp(buffer, "Streamed", 8) == 0);
+			const auto encryptedEntry = zip.GetEntry("encrypted.txt"_nv);
+			encryptedEntry->SetPassword("NatsuLib"_nv);
+			assert(encryptedEntry->Open()->ReadBytes(buffer, sizeof buffer) == 9 && memcmp(buffer, "Encrypted", 9) == 0);
+			assert(zip.GetEntry("empty.txt"_nv)->GetUncompressedSize() == 0);
+
+			// 更新后重新写入的入口不再使用数据描述符，第一个本地文件头的通用标志中的第3位应被清除
+			for (const auto strategy : { natZipArchive::UpdateStrategy::Rewrite, natZipArchive::UpdateStrategy::Append })
+			{
+				const auto updatedStream = make_ref<natMemoryStream>(archiveStream->GetInternalBuffer(), archiveStream->GetSize(), true, true, true);
+				{
+					natZipArchive updatedZip{ updatedStream, natZipArchive::ZipArchiveMode::Update };
+					updatedZip.SetUpdateStrategy(strategy);
+					updatedZip.GetEntry("streamed.txt"_nv)->Open()->WriteBytes(reinterpret_cast<ncData>("Updated"), 7);
+				}
+				if (strategy == natZipArchive::UpdateStrategy::Rewrite)
+				{
+					assert(!(updatedStream->GetInternalBuffer()[6] & 0x08));
+				}
+
+				updatedStream->SetPosition(NatSeek::Beg, 0);
+				natZipArchive updatedZip{ updatedStream, natZipArchive::ZipArchiveMode::Read };
+				assert(updatedZip.GetEntry("streamed.txt"_nv)->Open()->ReadBytes(buffer, sizeof buffer) == 15 && memcmp(buffer, "StreamedUpdated", 15) == 0);
+			}
+		}
+
+		{
+			// 仅包含以Stored方式存储的asset.txt（内容为"NatsuLib"）的压缩文件
+			static const nByte storedArchive[] = {
+				0x50, 0x4B, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0xBF, 0x69,
+				0xD7, 0x68, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x61, 0x73,
+				0x73, 0x65, 0x74, 0x2E, 0x74, 0x78, 0x74, 0x4E, 0x61, 0x74, 0x73, 0x75, 0x4C, 0x69, 0x62, 0x50,
+				0x4B, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0xBF,
+				0x69, 0xD7, 0x68, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x00, 0x00, 0x00, 0x00, 0x61, 0x73, 0x73,
+				0x65, 0x74, 0x2E, 0x74, 0x78, 0x74, 0x50, 0x4B, 0x05, 0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+				0x01, 0x00, 0x37, 0x00, 0x00, 0x00, 0x2F, 0x00, 0x00, 0x00, 0x00, 0x00,
+			};
+
+			natZipArchive zip{ make_ref<natExternMemoryStream>(storedArchive, true), natZipArchive::ZipArchiveMode::Read };
+			ncData data = nullptr;
+			nLen size = 0;
+			const auto gotStoredData = zip.GetEntry("asset.txt"_nv)->TryGetStoredData(data, size);
+			assert(gotStoredData);
+			assert(size == 8 && memcmp(data, "NatsuLib", 8) == 0 && data >= storedArchive && data + size <= storedArchive + sizeof storedArchive);
+
+			// 以Deflate方式存储的入口或不以内存为存储的文档无法直接获得数据
+			natZipArchive fileZip{ make_ref<natFileStream>("3.zip"_nv, true, false), natZipArchive::ZipArchiveMode::Read };
+			const auto gotDeflatedData = fileZip.GetEntry("appended.txt"_nv)->TryGetStoredData(data, size);
+			assert(!gotDeflatedData);
+
+			// 映射到内存的文件可以直接获得数据
+			natFileStream{ "6.zip"_nv, false, true, true }.WriteBytes(storedArchive, sizeof storedArchive);
+			const auto mappedFile = make_ref<natFileStream>("6.zip"_nv, true, false);
+			const auto mappedStream = mappedFile->MapToMemoryStream();
+			assert(mappedStream->GetSize() == sizeof storedArchive && mappedFile->MapToMemoryStream() == mappedStream);
+			natZipArchive mappedZip{ mappedStream, natZipArchive::ZipArchiveMode::Read };
+			const auto gotMappedData = mappedZip.GetEntry("asset.txt"_nv)->TryGetStoredData(data, size);
+			assert(gotMappedData);
+			assert(size == 8 && memcmp(data, "NatsuLib", 8) == 0 && data >= mappedStream->GetExternData() && data + size <= mappedStream->GetExternData() + mappedStream->GetSize());
+		}
+
+		{
+			// 生成仅有一个入口的文档及在其后附加最长注释的文档，注释中包含EOCD签名
+			{
+				const auto archiveStream = make_ref<natMemoryStream>(0, true, true, true);
+				{
+					natZipArchive zip{ archiveStream, natZipArchive::ZipArchiveMode::Create };
+					zip.CreateEntry("commented.txt"_nv)->Open()->WriteBytes(reinterpret_cast<ncData>("Commented"), 9);
+				}
+
+				natFileStream{ "4.zip"_nv, false, true, true }.WriteBytes(archiveStream->GetInternalBuffer(), archiveStream->GetSize());
+
+				constexpr nuShort commentLength = 0xFFFF;
+				std::vector<nByte> comment(commentLength, '#');
+				memcpy(comment.data() + 1024, "PK\x05\x06", 4);
+				// 新创建的文档没有注释，EOCD中的注释长度位于文档末尾
+				archiveStream->SetPosition(NatSeek::End, -static_cast<nLong>(sizeof commentLength));
+				archiveStream->WriteBytes(reinterpret_cast<ncData>(&commentLength), sizeof commentLength);
+				archiveStream->WriteBytes(comment.data(), comment.size());
+
+				natFileStream{ "5.zip"_nv, false, true, true }.WriteBytes(archiveStream->GetInternalBuffer(), archiveStream->GetSize());
+			}
+
+			constexpr nuInt openCount = 1000;
+			const auto measureOpenTime = [](nStrView path)
+			{
+				natStopWatch stopWatch;
+				for (nuInt i = 0; i < openCount; ++i)
+				{
+					natZipArchive zip{ make_ref<natFileStream>(path, true, false), natZipArchive::ZipArchiveMode::Read };
+					assert(zip.GetEntryCount() == 1);
+				}
+				return stopWatch.GetElpased() / openCount;
+			};
+
+			const auto plainOpenTime = measureOpenTime("4.zip"_nv);
+			const auto commentedOpenTime = measureOpenTime("5.zip"_nv);
+
+			logger.LogMsg("Average open latency: {0} s, with 64 KiB comment: {1} s"_nv, plainOpenTime, commentedOpenTime);
+		}
+
 		{
 			natStlStream<std::ostream> out{ std::cout };
 			out.WriteBytes(reinterpret_cast<ncData>("haha\n"), 5);